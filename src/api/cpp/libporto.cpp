@@ -12,16 +12,21 @@ extern "C" {
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <poll.h>
 }
 
 namespace Porto {
 
 static const char PortoSocket[] = "/run/portod.socket";
 
+/* PORTO_MAX_PIPELINE of portod: requests queued per connection */
+static const size_t PortoMaxPipeline = 64;
+
 class Connection::ConnectionImpl {
 public:
     int Fd = -1;
     int Timeout = 0;
+    bool Typed = false;
 
     rpc::TContainerRequest Req;
     rpc::TContainerResponse Rsp;
@@ -29,11 +34,17 @@ public:
     int LastError;
     std::string LastErrorMsg;
 
+    uint64_t RequestId = 0;
+
+    int SetError(int error, const std::string &msg) {
+        LastError = error;
+        LastErrorMsg = msg;
+        return LastError;
+    }
+
     int Error(int err, const std::string &prefix) {
-        LastError = EError::Unknown;
-        LastErrorMsg = std::string(prefix + ": " + strerror(err));
         Close();
-        return LastError;
+        return SetError(EError::Unknown, prefix + ": " + strerror(err));
     }
 
     ConnectionImpl() { }
@@ -54,7 +65,12 @@ public:
 
     int Send();
     int Recv();
+    int RecvExact();
     int Rpc();
+
+    int SendPipelined(const rpc::TContainerRequest &req, uint64_t id);
+    int Pipeline(const std::vector<rpc::TContainerRequest> &requests,
+                 std::vector<rpc::TContainerResponse> &responses);
 };
 
 int Connection::ConnectionImpl::Connect()
@@ -134,6 +150,36 @@ int Connection::ConnectionImpl::Recv() {
     return Error(raw.GetErrno() ?: EIO, "recv");
 }
 
+/* Reads exactly one message: following ones might be events */
+int Connection::ConnectionImpl::RecvExact() {
+    uint32_t size = 0;
+    uint8_t byte;
+    int shift = 0;
+
+    do {
+        if (shift > 28)
+            return Error(EPROTO, "recv");
+        ssize_t ret = read(Fd, &byte, 1);
+        if (ret != 1)
+            return Error(ret ? errno : EIO, "recv");
+        size |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    std::string buf(size, '\0');
+    for (size_t off = 0; off < size; ) {
+        ssize_t ret = read(Fd, &buf[off], size - off);
+        if (ret <= 0)
+            return Error(ret ? errno : EIO, "recv");
+        off += ret;
+    }
+
+    if (!Rsp.ParseFromString(buf))
+        return Error(EPROTO, "recv");
+
+    return EError::Success;
+}
+
 int Connection::ConnectionImpl::Rpc() {
     int ret = 0;
 
@@ -159,6 +205,79 @@ int Connection::ConnectionImpl::Rpc() {
     return ret;
 }
 
+int Connection::ConnectionImpl::SendPipelined(const rpc::TContainerRequest &req, uint64_t id) {
+    Req.CopyFrom(req);
+    Req.set_request_id(id);
+    int ret = Send();
+    Req.Clear();
+    return ret;
+}
+
+int Connection::ConnectionImpl::Pipeline(const std::vector<rpc::TContainerRequest> &requests,
+                                         std::vector<rpc::TContainerResponse> &responses) {
+    uint64_t first = RequestId + 1;
+    size_t sent = 0, received = 0;
+    int ret = 0;
+
+    for (size_t i = 0; i < requests.size(); i++)
+        if (!requests[i].IsInitialized())
+            return SetError(EError::InvalidValue, "Request " + std::to_string(i) +
+                            " is not initialized: " + requests[i].InitializationErrorString());
+
+    if (Fd < 0)
+        ret = Connect();
+    if (ret)
+        return ret;
+
+    responses.clear();
+    responses.resize(requests.size());
+    if (requests.empty())
+        return EError::Success;
+
+    /* porto stops reading when more are queued, never send ahead of that */
+    while (sent < requests.size() && sent < PortoMaxPipeline) {
+        ret = SendPipelined(requests[sent], first + sent);
+        if (ret)
+            return ret;
+        sent++;
+    }
+
+    /* created only now: constructor already waits for data */
+    google::protobuf::io::FileInputStream raw(Fd);
+    google::protobuf::io::CodedInputStream input(&raw);
+
+    while (received < requests.size()) {
+        uint32_t size;
+
+        Rsp.Clear();
+        if (!input.ReadVarint32(&size))
+            return Error(raw.GetErrno() ?: EIO, "recv");
+
+        auto limit = input.PushLimit(size);
+        if (!Rsp.ParseFromCodedStream(&input))
+            return Error(raw.GetErrno() ?: EIO, "recv");
+        input.PopLimit(limit);
+
+        uint64_t id = Rsp.request_id();
+        if (id < first || id - first >= sent)
+            return Error(EPROTO, "recv");
+
+        responses[id - first].Swap(&Rsp);
+        received++;
+
+        if (sent < requests.size()) {
+            ret = SendPipelined(requests[sent], first + sent);
+            if (ret)
+                return ret;
+            sent++;
+        }
+    }
+
+    RequestId += requests.size();
+
+    return EError::Success;
+}
+
 Connection::Connection() : Impl(new ConnectionImpl()) { }
 
 Connection::~Connection() {
@@ -176,6 +295,10 @@ int Connection::SetTimeout(int timeout) {
     return EError::Success;
 }
 
+void Connection::SetTypedValues(bool typed) {
+    Impl->Typed = typed;
+}
+
 void Connection::Close() {
     Impl->Close();
 }
@@ -260,6 +383,14 @@ int Connection::Get(const std::vector<std::string> &name,
                    const std::vector<std::string> &variable,
                    std::map<std::string, std::map<std::string, GetResponse>> &result,
                    bool nonblock) {
+    uint64_t generation = 0;
+    return Get(name, variable, result, generation, nonblock);
+}
+
+int Connection::Get(const std::vector<std::string> &name,
+                   const std::vector<std::string> &variable,
+                   std::map<std::string, std::map<std::string, GetResponse>> &result,
+                   uint64_t &generation, bool nonblock) {
     auto get = Impl->Req.mutable_get();
 
     for (const auto &n : name)
@@ -268,9 +399,14 @@ int Connection::Get(const std::vector<std::string> &name,
         get->add_variable(v);
     if (nonblock)
         get->set_nonblock(nonblock);
+    if (generation)
+        get->set_since_generation(generation);
+    if (Impl->Typed)
+        get->set_typed(true);
 
     int ret = Impl->Rpc();
     if (!ret) {
+         generation = Impl->Rsp.get().generation();
          for (int i = 0; i < Impl->Rsp.get().list_size(); i++) {
              const auto &entry = Impl->Rsp.get().list(i);
              const auto &name = entry.name();
@@ -286,6 +422,17 @@ int Connection::Get(const std::vector<std::string> &name,
                      resp.ErrorMsg = keyval.errormsg();
                  if (keyval.has_value())
                      resp.Value = keyval.value();
+                 if (keyval.has_value_uint()) {
+                     resp.ValueType = GetResponse::Uint;
+                     resp.UintValue = keyval.value_uint();
+                 } else if (keyval.has_value_double()) {
+                     resp.ValueType = GetResponse::Double;
+                     resp.DoubleValue = keyval.value_double();
+                 } else if (keyval.value_map_size()) {
+                     resp.ValueType = GetResponse::UintMap;
+                     for (auto &entry: keyval.value_map())
+                         resp.MapValue[entry.key()] = entry.val();
+                 }
 
                  result[name][keyval.variable()] = resp;
              }
@@ -331,6 +478,49 @@ int Connection::GetData(const std::string &name, const std::string &data,
     return ret;
 }
 
+int Connection::Batch(const std::string &name, std::vector<BatchStep> &steps) {
+    auto req = Impl->Req.mutable_batch();
+
+    req->set_name(name);
+    for (auto &step: steps) {
+        auto s = req->add_step();
+        switch (step.Action) {
+        case BatchStep::Create:
+            s->set_create(true);
+            break;
+        case BatchStep::CreateWeak:
+            s->set_createweak(true);
+            break;
+        case BatchStep::SetProperty:
+            s->set_property(step.Property);
+            s->set_value(step.Value);
+            break;
+        case BatchStep::Start:
+            s->set_start(true);
+            break;
+        case BatchStep::Stop:
+            s->set_stop(true);
+            if (step.Timeout >= 0)
+                s->set_timeout_ms(step.Timeout * 1000);
+            break;
+        }
+    }
+
+    int ret = Impl->Rpc();
+
+    for (size_t i = 0; i < steps.size(); i++) {
+        if ((int)i < Impl->Rsp.batch().step_size()) {
+            steps[i].Error = Impl->Rsp.batch().step(i).error();
+            steps[i].ErrorMsg = Impl->Rsp.batch().step(i).errormsg();
+        } else {
+            steps[i].Error = EError::Success;
+            steps[i].ErrorMsg = "";
+        }
+    }
+
+    return ret;
+}
+
 int Connection::GetVersion(std::string &tag, std::string &revision) {
     Impl->Req.mutable_version();
 
@@ -411,6 +601,74 @@ void Connection::GetLastError(int &error, std::string &msg) const {
     msg = Impl->LastErrorMsg;
 }
 
+int Connection::Pipeline(const std::vector<rpc::TContainerRequest> &requests,
+                         std::vector<rpc::TContainerResponse> &responses) {
+    return Impl->Pipeline(requests, responses);
+}
+
+int Connection::Subscribe(const std::vector<std::string> &names, uint64_t &seq) {
+    auto req = Impl->Req.mutable_subscribe();
+    int ret = 0;
+
+    for (auto &name: names)
+        req->add_name(name);
+
+    if (Impl->Fd < 0)
+        ret = Impl->Connect();
+    if (!ret)
+        ret = Impl->Send();
+    Impl->Req.Clear();
+
+    if (!ret) {
+        Impl->Rsp.Clear();
+        ret = Impl->RecvExact();
+    }
+
+    if (!ret) {
+        Impl->LastErrorMsg = Impl->Rsp.errormsg();
+        Impl->LastError = (int)Impl->Rsp.error();
+        ret = Impl->LastError;
+        seq = Impl->Rsp.subscribe().seq();
+    }
+
+    return ret;
+}
+
+int Connection::ReadEvents(std::vector<ContainerEvent> &events, int timeout) {
+    struct pollfd pfd;
+
+    if (Impl->Fd < 0)
+        return Impl->Error(ENOTCONN, "recv");
+
+    pfd.fd = Impl->Fd;
+    pfd.events = POLLIN;
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0)
+        return Impl->Error(errno, "poll");
+
+    events.clear();
+    if (!ret)
+        return EError::Success;
+
+    Impl->Rsp.Clear();
+    ret = Impl->RecvExact();
+    if (ret)
+        return ret;
+
+    for (auto &ev: Impl->Rsp.event()) {
+        events.emplace_back();
+        auto &event = events.back();
+        event.Seq = ev.seq();
+        event.Event = (ContainerEvent::Type)ev.type();
+        event.Name = ev.name();
+        event.State = ev.state();
+        event.Property = ev.property();
+        event.Lost = ev.lost();
+    }
+
+    return EError::Success;
+}
+
 int Connection::ListVolumeProperties(std::vector<Property> &list) {
     Impl->Req.mutable_listvolumeproperties();
 
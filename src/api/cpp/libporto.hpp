@@ -5,6 +5,11 @@
 #include <string>
 #include <memory>
 
+namespace rpc {
+    class TContainerRequest;
+    class TContainerResponse;
+}
+
 namespace Porto {
 
 struct Property {
@@ -38,6 +43,43 @@ struct GetResponse {
     std::string Value;
     int Error;
     std::string ErrorMsg;
+
+    /* with typed values numbers come here and Value stays empty */
+    enum Type { String, Uint, Double, UintMap };
+    Type ValueType = String;
+    uint64_t UintValue = 0;
+    double DoubleValue = 0;
+    std::map<std::string, uint64_t> MapValue;
+};
+
+struct BatchStep {
+    enum Type { Create, CreateWeak, SetProperty, Start, Stop };
+
+    Type Action;
+    std::string Property;
+    std::string Value;
+    int Timeout; /* for stop, in seconds */
+
+    /* result of step */
+    int Error;
+    std::string ErrorMsg;
+
+    BatchStep(Type action, const std::string &property = "",
+              const std::string &value = "", int timeout = -1) :
+        Action(action), Property(property), Value(value),
+        Timeout(timeout), Error(0) {}
+};
+
+struct ContainerEvent {
+    /* same values as in rpc::TContainerEvent::EType */
+    enum Type { Create = 1, Start, Death, Oom, Respawn, Destroy, PropertyChange, StateChange, Overflow };
+
+    uint64_t Seq;
+    Type Event;
+    std::string Name;
+    std::string State;
+    std::string Property;
+    uint64_t Lost; /* for overflow */
 };
 
 class Connection {
@@ -59,6 +101,9 @@ public:
     /* request timeout in seconds */
     int SetTimeout(int timeout);
 
+    /* Get returns numeric values in typed fields of GetResponse */
+    void SetTypedValues(bool typed);
+
     int Create(const std::string &name);
     int CreateWeakContainer(const std::string &name);
     int Destroy(const std::string &name);
@@ -82,6 +127,13 @@ public:
             std::map<std::string, std::map<std::string, GetResponse>> &result,
             bool nonblock = false);
 
+    /* Delta get: updates result with values changed since generation
+       and sets generation for next call, start with zero */
+    int Get(const std::vector<std::string> &name,
+            const std::vector<std::string> &variable,
+            std::map<std::string, std::map<std::string, GetResponse>> &result,
+            uint64_t &generation, bool nonblock = false);
+
     int GetProperty(const std::string &name,
             const std::string &property, std::string &value);
     int SetProperty(const std::string &name,
@@ -89,11 +141,34 @@ public:
 
     int GetData(const std::string &name,
             const std::string &data, std::string &value);
+
+    /* all steps are reverted if one fails, step results are filled,
+       stop is allowed only as last step */
+    int Batch(const std::string &name, std::vector<BatchStep> &steps);
     int GetVersion(std::string &tag, std::string &revision);
 
     int Raw(const std::string &message, std::string &response);
     void GetLastError(int &error, std::string &msg) const;
 
+    /*
+     * Send several requests at once over this connection, request ids
+     * are assigned here. Responses are matched by request id and could
+     * be completed by porto out of order. At most as many requests as
+     * porto queues per connection are in flight, the rest are sent as
+     * responses come.
+     */
+    int Pipeline(const std::vector<rpc::TContainerRequest> &requests,
+                 std::vector<rpc::TContainerResponse> &responses);
+
+    /*
+     * Subscribe to events of containers or wildcards, seq is last event
+     * before subscription. After that connection is only for ReadEvents.
+     */
+    int Subscribe(const std::vector<std::string> &names, uint64_t &seq);
+
+    /* Waits next events, timeout in ms, -1 waits forever */
+    int ReadEvents(std::vector<ContainerEvent> &events, int timeout = -1);
+
     int ListVolumeProperties(std::vector<Property> &list);
     int CreateVolume(const std::string &path,
                      const std::map<std::string, std::string> &config,
@@ -144,6 +144,10 @@ type API interface {
 
 	GetData(name string, data string) (string, error)
 
+	// Batch executes steps with one container atomically
+	Batch(name string, steps []*rpc.TContainerBatchRequest_TStep) (
+		[]*rpc.TContainerBatchResponse_TStepResult, error)
+
 	// VolumeAPI
 	ListVolumeProperties() ([]TProperty, error)
 	CreateVolume(path string, config map[string]string) (TVolumeDescription, error)
@@ -517,6 +521,23 @@ func (conn *portoConnection) GetData(name string, data string) (string, error) {
 	return resp.GetGetData().GetValue(), nil
 }
 
+func (conn *portoConnection) Batch(name string, steps []*rpc.TContainerBatchRequest_TStep) (
+	[]*rpc.TContainerBatchResponse_TStepResult, error) {
+	req := &rpc.TContainerRequest{
+		Batch: &rpc.TContainerBatchRequest{
+			Name: &name,
+			Step: steps,
+		},
+	}
+
+	resp, err := conn.performRequest(req)
+	if resp == nil {
+		return nil, err
+	}
+
+	return resp.GetBatch().GetStep(), err
+}
+
 // VolumeAPI
 func (conn *portoConnection) ListVolumeProperties() (ret []TProperty, err error) {
 	req := &rpc.TContainerRequest{
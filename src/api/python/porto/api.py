@@ -495,6 +495,47 @@ class Connection(object):
         request.setProperty.value = value
         self.rpc.call(request, self.rpc.timeout)
 
+    def Batch(self, name, steps):
+        """Execute steps with one container atomically.
+
+        Steps are tuples: ('create',), ('createWeak',), ('set', property, value),
+        ('start',), ('stop',) or ('stop', timeout). Returns container.
+        """
+        request = rpc_pb2.TContainerRequest()
+        request.batch.name = name
+        timeout = self.rpc.timeout
+        for step in steps:
+            s = request.batch.step.add()
+            if step[0] == 'create':
+                s.create = True
+            elif step[0] == 'createWeak':
+                s.createWeak = True
+            elif step[0] == 'set':
+                value = step[2]
+                if value is False:
+                    value = 'false'
+                elif value is True:
+                    value = 'true'
+                elif value is None:
+                    value = ''
+                elif isinstance(value, (int, long)):
+                    value = str(value)
+                s.property = step[1]
+                s.value = value
+            elif step[0] == 'start':
+                s.start = True
+            elif step[0] == 'stop':
+                s.stop = True
+                stop_timeout = 30
+                if len(step) > 1 and step[1] is not None and step[1] >= 0:
+                    stop_timeout = step[1]
+                    s.timeout_ms = stop_timeout * 1000
+                timeout = max(timeout, stop_timeout + 1)
+            else:
+                raise exceptions.InvalidValue("Unknown batch step {}".format(step[0]))
+        self.rpc.call(request, timeout)
+        return Container(self, name)
+
     def Set(self, container, **kwargs):
         for name, value in kwargs.items():
             self.SetProperty(container, name, value)
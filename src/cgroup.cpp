@@ -1,12 +1,18 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <csignal>
+#include <list>
+#include <mutex>
+#include <unordered_set>
 
 #include "cgroup.hpp"
 #include "device.hpp"
 #include "config.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
+#include "util/scan.hpp"
+#include "util/uring.hpp"
 #include "util/unix.hpp"
 
 extern "C" {
@@ -29,6 +35,265 @@ const TFlagsNames ControllersName = {
     { CGROUP_PIDS,      "pids" },
 };
 
+/*
+ * Descriptors of hot read-only knobs are kept open and reread with pread:
+ * one syscall per read instead of open, fstat, read, read and close.
+ * Least recently used are closed when budget cgroup_knob_fds is exceeded.
+ */
+static const std::unordered_set<std::string> CachedKnobs = {
+    "memory.usage_in_bytes",
+    "memory.max_usage_in_bytes",
+    "memory.anon.usage",
+    "memory.stat",
+    "cpuacct.usage",
+    "cpuacct.stat",
+    "pids.current",
+    "freezer.state",
+    "blkio.throttle.io_serviced",
+    "blkio.throttle.io_service_bytes",
+    "blkio.io_serviced_recursive",
+    "blkio.io_service_bytes_recursive",
+};
+
+static std::mutex KnobFdsMutex;
+static std::list<std::pair<std::string, std::shared_ptr<TFile>>> KnobFdsLru;
+static std::unordered_map<std::string, decltype(KnobFdsLru)::iterator> KnobFds;
+
+static std::shared_ptr<TFile> FindKnobFd(const std::string &path) {
+    std::lock_guard<std::mutex> lock(KnobFdsMutex);
+
+    auto it = KnobFds.find(path);
+    if (it == KnobFds.end())
+        return nullptr;
+
+    KnobFdsLru.splice(KnobFdsLru.begin(), KnobFdsLru, it->second);
+    return it->second->second;
+}
+
+/* Takes ownership of fd only if there is room in budget, null otherwise */
+static std::shared_ptr<TFile> AdoptKnobFd(const std::string &path, int fd) {
+    std::lock_guard<std::mutex> lock(KnobFdsMutex);
+
+    if (KnobFds.size() >= config().daemon().cgroup_knob_fds() || KnobFds.count(path))
+        return nullptr;
+
+    auto file = std::make_shared<TFile>();
+    file->SetFd = fd;
+    KnobFdsLru.emplace_front(path, file);
+    KnobFds[path] = KnobFdsLru.begin();
+    return file;
+}
+
+static std::shared_ptr<TFile> GetKnobFd(const TPath &path) {
+    auto file = FindKnobFd(path.ToString());
+    if (file)
+        return file;
+
+    file = std::make_shared<TFile>();
+    if (file->OpenRead(path))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(KnobFdsMutex);
+
+    size_t budget = config().daemon().cgroup_knob_fds();
+    if (!budget || KnobFds.count(path.ToString()))
+        return file;
+
+    KnobFdsLru.emplace_front(path.ToString(), file);
+    KnobFds[path.ToString()] = KnobFdsLru.begin();
+
+    while (KnobFds.size() > budget) {
+        KnobFds.erase(KnobFdsLru.back().first);
+        KnobFdsLru.pop_back();
+    }
+
+    return file;
+}
+
+static void DropKnobFd(const std::string &path) {
+    std::lock_guard<std::mutex> lock(KnobFdsMutex);
+    auto it = KnobFds.find(path);
+    if (it != KnobFds.end()) {
+        KnobFdsLru.erase(it->second);
+        KnobFds.erase(it);
+    }
+}
+
+/* Forget descriptors of cgroup and its sub-cgroups, directory goes away */
+static void DropKnobFds(const TCgroup &cg) {
+    std::string prefix = cg.Path().ToString() + "/";
+    std::lock_guard<std::mutex> lock(KnobFdsMutex);
+
+    for (auto it = KnobFdsLru.begin(); it != KnobFdsLru.end(); ) {
+        if (StringStartsWith(it->first, prefix)) {
+            KnobFds.erase(it->first);
+            it = KnobFdsLru.erase(it);
+        } else
+            ++it;
+    }
+}
+
+static TError ReadKnob(const std::string &knob, const TPath &path, std::string &text) {
+    if (CachedKnobs.count(knob)) {
+        auto file = GetKnobFd(path);
+        if (file) {
+            if (!file->PreadAll(text, 16 << 20))
+                return TError::Success();
+            /* cgroup was removed behind us */
+            DropKnobFd(path.ToString());
+        }
+    }
+    return path.ReadAll(text);
+}
+
+/* Big enough for memory.stat, larger knobs are read synchronously */
+constexpr unsigned KNOB_PREFETCH_SIZE = 8192;
+
+/* Ring is small, read buffer lives only during request */
+static thread_local std::unique_ptr<TUring> PrefetchUring;
+
+/* Kernel without io_uring or needed opcodes, checked once per daemon */
+static std::atomic<bool> PrefetchUringFailed(false);
+
+void TCgroupPrefetch::Add(TCgroupStat &stat, const TCgroup &cg, const std::string &knob) {
+    if (!cg.Subsystem)
+        return;
+
+    /* same knob might be wanted by several properties or containers */
+    std::string path = cg.Knob(knob).ToString();
+    auto it = Index.find(path);
+    if (it == Index.end()) {
+        Index[path] = Items.size();
+        Items.push_back({path, {&stat}});
+    } else if (Items[it->second].Stats.back() != &stat) {
+        Items[it->second].Stats.push_back(&stat);
+    }
+}
+
+TError TCgroupPrefetch::Run() {
+    TError error;
+
+    if (Items.empty() || !config().daemon().stat_io_uring())
+        return TError::Success();
+
+    if (PrefetchUringFailed)
+        return TError(EError::NotSupported, "io_uring is not available");
+
+    if (!PrefetchUring) {
+        PrefetchUring.reset(new TUring());
+        error = PrefetchUring->Setup(KNOB_PREFETCH_BATCH);
+        if (error) {
+            L("Cgroup stats are read without io_uring: {}", error);
+            PrefetchUring.reset();
+            /* retry later only after shortage of memory or descriptors */
+            int err = error.GetErrno();
+            if (err != ENOMEM && err != EAGAIN && err != EMFILE && err != ENFILE)
+                PrefetchUringFailed = true;
+            return error;
+        }
+    }
+
+    /* not zeroed, only completed reads are looked at */
+    size_t bufferSize = std::min(Items.size(), (size_t)KNOB_PREFETCH_BATCH);
+    std::unique_ptr<char[]> buffer(new char[bufferSize * KNOB_PREFETCH_SIZE]);
+
+    std::vector<std::shared_ptr<TFile>> files;
+    std::vector<int> fds;
+    std::vector<TUring::TOp> ops;
+    std::vector<size_t> index;
+
+    for (size_t first = 0; first < Items.size(); first += KNOB_PREFETCH_BATCH) {
+        size_t count = std::min(Items.size() - first, (size_t)KNOB_PREFETCH_BATCH);
+
+        files.assign(count, nullptr);
+        fds.assign(count, -1);
+        ops.clear();
+        index.clear();
+
+        for (size_t i = 0; i < count; i++) {
+            files[i] = FindKnobFd(Items[first + i].Path);
+            if (files[i]) {
+                fds[i] = files[i]->Fd;
+            } else {
+                ops.emplace_back(TUring::Open);
+                ops.back().Path = Items[first + i].Path.c_str();
+                index.push_back(i);
+            }
+        }
+
+        error = PrefetchUring->Submit(ops);
+        if (error) {
+            for (auto &op: ops)
+                if (op.Result >= 0)
+                    close(op.Result);
+            break;
+        }
+
+        /*
+         * Keep new descriptors while there is room in budget. Batch holds
+         * reference till the end: other thread could evict it from cache
+         * and fd number must not be reused under our reads.
+         */
+        std::vector<bool> owned(count, false);
+        for (size_t j = 0; j < ops.size(); j++) {
+            if (ops[j].Result < 0)
+                continue;
+            fds[index[j]] = ops[j].Result;
+            files[index[j]] = AdoptKnobFd(Items[first + index[j]].Path, ops[j].Result);
+            owned[index[j]] = !files[index[j]];
+        }
+
+        ops.clear();
+        index.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i] < 0)
+                continue;
+            ops.emplace_back(TUring::Read);
+            ops.back().Fd = fds[i];
+            ops.back().Buf = &buffer[i * KNOB_PREFETCH_SIZE];
+            ops.back().Size = KNOB_PREFETCH_SIZE;
+            index.push_back(i);
+        }
+
+        error = PrefetchUring->Submit(ops);
+
+        for (size_t j = 0; !error && j < ops.size(); j++) {
+            auto &item = Items[first + index[j]];
+            if (ops[j].Result < 0) {
+                if (files[index[j]])
+                    DropKnobFd(item.Path);
+            } else if ((unsigned)ops[j].Result < KNOB_PREFETCH_SIZE) {
+                for (auto stat: item.Stats)
+                    stat->Values[item.Path].assign(ops[j].Buf, ops[j].Result);
+            }
+        }
+
+        ops.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (owned[i]) {
+                ops.emplace_back(TUring::Close);
+                ops.back().Fd = fds[i];
+            }
+        }
+
+        if (error || PrefetchUring->Submit(ops)) {
+            for (auto &op: ops)
+                close(op.Fd);
+        }
+
+        if (error)
+            break;
+    }
+
+    /* ring is recreated on next request */
+    if (error) {
+        L_WRN("Cannot prefetch cgroup stats with io_uring: {}", error);
+        PrefetchUring.reset();
+    }
+
+    return error;
+}
+
 TPath TCgroup::Path() const {
     if (!Subsystem)
         return TPath();
@@ -58,6 +323,7 @@ TError TCgroup::Create() {
         return TError(EError::Unknown, "Cannot create secondary cgroup " + Type());
 
     L_ACT("Create cgroup {}", *this);
+    DropKnobFds(*this);
     error = Path().Mkdir(0755);
     if (error)
         L_ERR("Cannot create cgroup {} : {}", *this, error);
@@ -74,6 +340,8 @@ TError TCgroup::Create() {
 }
 
 TError TCgroup::SetSuffix(const std::string suffix) {
+    DropKnobFds(*this);
+
     auto dir = Path().DirName();
     auto basename = Path().BaseName();
     auto pos = basename.find('#');
@@ -102,6 +370,7 @@ TError TCgroup::Remove() {
         return TError(EError::Unknown, "Cannot create secondary cgroup " + Type());
 
     L_ACT("Remove cgroup {}", *this);
+    DropKnobFds(*this);
     error = Path().Rmdir();
 
     /* workaround for bad synchronization */
@@ -137,17 +406,37 @@ bool TCgroup::Has(const std::string &knob) const {
     return Knob(knob).IsRegularStrict();
 }
 
+__thread TCgroupStat *TCgroupStatCache::Current = nullptr;
+
 TError TCgroup::Get(const std::string &knob, std::string &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
-    return Knob(knob).ReadAll(value);
+
+    TPath path = Knob(knob);
+    auto cache = TCgroupStatCache::Current;
+    if (!cache)
+        return ReadKnob(knob, path, value);
+
+    auto it = cache->Values.find(path.ToString());
+    if (it != cache->Values.end()) {
+        value = it->second;
+        return TError::Success();
+    }
+
+    TError error = ReadKnob(knob, path, value);
+    if (!error)
+        cache->Values[path.ToString()] = value;
+    return error;
 }
 
 TError TCgroup::Set(const std::string &knob, const std::string &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot set to null cgroup");
-    L_ACT("Set {} {} = {}", *this, knob, value);
-    return Knob(knob).WriteAll(value);
+    L_CG("Set {} {} = {}", *this, knob, value);
+    TPath path = Knob(knob);
+    if (TCgroupStatCache::Current)
+        TCgroupStatCache::Current->Invalidate(path.ToString());
+    return path.WriteAll(value);
 }
 
 TError TCgroup::GetInt64(const std::string &knob, int64_t &value) const {
@@ -190,19 +479,57 @@ TError TCgroup::GetUintMap(const std::string &knob, TUintMap &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
 
-    FILE *file = fopen(Knob(knob).c_str(), "r");
-    char *key;
-    unsigned long long val;
+    TPath path = Knob(knob);
+    auto cache = TCgroupStatCache::Current;
+    if (cache) {
+        auto it = cache->Maps.find(path.ToString());
+        if (it != cache->Maps.end()) {
+            for (auto &kv: it->second)
+                value[kv.first] = kv.second;
+            return TError::Success();
+        }
+    }
 
-    if (!file)
-        return TError(EError::Unknown, errno, "Cannot open knob " + knob);
+    static thread_local std::string buffer;
+    const std::string *text = &buffer;
+    auto prefetched = cache ? cache->Values.find(path.ToString()) :
+                              decltype(cache->Values)::iterator();
 
-    while (fscanf(file, "%ms %llu\n", &key, &val) == 2) {
-        value[std::string(key)] = val;
-        free(key);
+    if (cache && prefetched != cache->Values.end()) {
+        text = &prefetched->second;
+    } else {
+        TError error = ReadKnob(knob, path, buffer);
+        if (error)
+            return TError(EError::Unknown, error.GetErrno(), "Cannot read knob " + knob);
     }
 
-    fclose(file);
+    TUintMap map;
+    TTextScanner scan(*text);
+    TStringRef line;
+    std::string key;
+
+    while (scan.NextLine(line)) {
+        TTextScanner words(line);
+        TStringRef word;
+        uint64_t val;
+
+        if (!words.NextWord(word) || !words.NextUint64(val))
+            break;
+
+        key.assign(word.Data, word.Size);
+        auto it = map.find(key);
+        if (it != map.end())
+            it->second = val;
+        else
+            map.emplace(key, val);
+    }
+
+    for (auto &kv: map)
+        value[kv.first] = kv.second;
+
+    if (cache)
+        cache->Maps[path.ToString()] = std::move(map);
+
     return TError::Success();
 }
 
@@ -218,6 +545,21 @@ TError TCgroup::Attach(pid_t pid) const {
     return error;
 }
 
+TError TCgroup::OpenAttach(TFile &procs) const {
+    if (Secondary())
+        return TError(EError::Unknown, "Cannot attach to secondary cgroup " + Type());
+
+    return procs.OpenWrite(Knob("cgroup.procs"));
+}
+
+TError TCgroup::AttachSelf(const TFile &procs) const {
+    /* zero pid means writer itself */
+    if (write(procs.Fd, "0", 1) != 1)
+        return TError(EError::Unknown, errno, "Cannot attach to " + Type() + " cgroup " + Name);
+
+    return TError::Success();
+}
+
 TError TCgroup::AttachAll(const TCgroup &cg) const {
     if (Secondary())
         return TError(EError::Unknown, "Cannot attach to secondary cgroup " + Type());
@@ -286,19 +628,21 @@ TError TCgroup::ChildsAll(std::vector<TCgroup> &cgroups) const {
 }
 
 TError TCgroup::GetPids(const std::string &knob, std::vector<pid_t> &pids) const {
-    FILE *file;
+    const std::string *text;
+    TError error;
     int pid;
 
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
 
     pids.clear();
-    file = fopen(Knob(knob).c_str(), "r");
-    if (!file)
-        return TError(EError::Unknown, errno, "Cannot open knob " + knob);
-    while (fscanf(file, "%d", &pid) == 1)
+    error = ReadFileBuffer(Knob(knob), text);
+    if (error)
+        return TError(EError::Unknown, error.GetErrno(), "Cannot read knob " + knob);
+
+    TTextScanner scan(*text);
+    while (scan.NextInt(pid))
         pids.push_back(pid);
-    fclose(file);
 
     return TError::Success();
 }
@@ -384,36 +728,35 @@ TCgroup TSubsystem::Cgroup(const std::string &name) const {
 }
 
 TError TSubsystem::TaskCgroup(pid_t pid, TCgroup &cgroup) const {
-    FILE *file = fopen(("/proc/" + std::to_string(pid) + "/cgroup").c_str(), "r");
+    const std::string *text;
+    TError error;
 
-    if (file) {
-        int id;
+    /* hierarchy-id:controller,controller:path */
+    error = ReadFileBuffer(TPath("/proc/" + std::to_string(pid) + "/cgroup"), text);
+    if (!error) {
+        TTextScanner scan(*text);
+        TStringRef line;
 
-        while (fscanf(file, "%d:", &id) == 1) {
-            bool found = false;
-            char *ss, *cg;
+        while (scan.NextLine(line)) {
+            TTextScanner fields(line);
+            TStringRef id, list, path, ss;
 
-            while (fscanf(file, "%m[^:,],", &ss) == 1) {
-                if (std::string(ss) == Type)
-                    found = true;
-                free(ss);
-            }
+            if (!fields.NextField(id, ':') || !fields.NextField(list, ':') ||
+                    !fields.NextField(path, '\n') || path.Empty())
+                continue;
 
-            if (fscanf(file, ":%ms\n", &cg) == 1) {
-                if (found) {
+            TTextScanner controllers(list);
+            while (controllers.NextField(ss, ',')) {
+                if (ss == Type) {
                     cgroup.Subsystem = this;
-                    cgroup.Name = std::string(cg);
-                    free(cg);
-                    fclose(file);
+                    cgroup.Name = path.ToString();
                     return TError::Success();
                 }
-                free(cg);
             }
         }
-        fclose(file);
     }
 
-    return TError(EError::Unknown, errno, "Cannot find " + Type +
+    return TError(EError::Unknown, error.GetErrno(), "Cannot find " + Type +
                     " cgroup for process " + std::to_string(pid));
 }
 
@@ -891,58 +1234,55 @@ TError TBlkioSubsystem::ResolveDisk(const std::string &key, std::string &disk) c
 }
 
 TError TBlkioSubsystem::GetIoStat(TCgroup &cg, TUintMap &map, int dir, bool iops) const {
-    std::vector<std::string> lines;
-    std::string knob, prev, name;
+    std::vector<TCgroup> list;
+    std::string knob = IoStatKnob(iops);
+    std::string text, disk, prev, name;
     TError error;
 
-    /* get statistics from throttler if possible, it has couners for raids */
-    if (HasThrottler)
-        knob = iops ? "blkio.throttle.io_serviced" : "blkio.throttle.io_service_bytes";
-    else
-        knob = iops ? "blkio.io_serviced_recursive" : "blkio.io_service_bytes_recursive";
-
-    error = cg.Knob(knob).ReadLines(lines);
-    if (error)
-        return error;
-
     /* in insane behavior throttler isn't hierarhical */
     if (HasThrottler && !HasSaneBehavior) {
-        std::vector<TCgroup> list;
-
         error = cg.ChildsAll(list);
         if (error)
             return error;
-
-        for (auto &cg: list) {
-            error = cg.Knob(knob).ReadLines(lines);
-            if (error)
-                return error;
-        }
     }
+    list.insert(list.begin(), cg);
 
-    for (auto &line: lines) {
-        std::vector<std::string> word;
-        if (SplitString(line, ' ', word) || word.size() != 3)
-            continue;
+    for (auto &cg: list) {
+        error = cg.Get(knob, text);
+        if (error)
+            return error;
 
-        if (word[1] == "Read") {
-            if (dir == 1)
-                continue;
-        } else if (word[1] == "Write") {
-            if (dir == 0)
+        TTextScanner scan(text);
+        TStringRef line;
+
+        while (scan.NextLine(line)) {
+            TTextScanner words(line);
+            TStringRef dev, op;
+            uint64_t val;
+
+            if (!words.NextWord(dev) || !words.NextWord(op) ||
+                    !words.NextUint64(val) || !words.Eof())
                 continue;
-        } else
-            continue;
 
-        if (word[0] != prev) {
-            if (DiskName(word[0], name))
+            if (op == "Read") {
+                if (dir == 1)
+                    continue;
+            } else if (op == "Write") {
+                if (dir == 0)
+                    continue;
+            } else
                 continue;
-            prev = word[0];
-        }
 
-        uint64_t val;
-        if (!StringToUint64(word[2], val) && val)
-            map[name] += val;
+            if (dev != prev) {
+                disk.assign(dev.Data, dev.Size);
+                if (DiskName(disk, name))
+                    continue;
+                prev = disk;
+            }
+
+            if (val)
+                map[name] += val;
+        }
     }
 
     return TError::Success();
@@ -1105,6 +1445,21 @@ std::vector<TSubsystem *> Subsystems;
 std::vector<TSubsystem *> Hierarchies;
 
 
+/*
+ * Each start migrates new task into every hierarchy, without favordynmods
+ * first migration waits for RCU grace period. Kernels before 6.2 reject it.
+ */
+static TError MountCgroup(const TPath &path, const std::vector<std::string> &controllers) {
+    if (config().daemon().cgroup_favordynmods()) {
+        auto options = controllers;
+        options.push_back("favordynmods");
+        if (!path.Mount("cgroup", "cgroup", 0, options))
+            return TError::Success();
+    }
+
+    return path.Mount("cgroup", "cgroup", 0, controllers);
+}
+
 TError InitializeCgroups() {
     TPath root("/sys/fs/cgroup");
     std::list<TMount> mounts;
@@ -1153,7 +1508,7 @@ TError InitializeCgroups() {
 
         if (!path.Exists())
             (void)path.Mkdir(0755);
-        error = path.Mount("cgroup", "cgroup", 0, {"memory", "blkio"});
+        error = MountCgroup(path, {"memory", "blkio"});
         if (!error) {
             (root / "memory").Symlink("memory,blkio");
             (root / "blkio").Symlink("memory,blkio");
@@ -1181,12 +1536,12 @@ TError InitializeCgroups() {
                 }
             }
 
-            error = subsys->Root.Mount("cgroup", "cgroup", 0, {subsys->Type});
+            error = MountCgroup(subsys->Root, {subsys->Type});
             /* in kernels < 3.14 cgroup net_cls was in module cls_cgroup */
             if (error && subsys->Type == "net_cls") {
                 if (system("modprobe cls_cgroup"))
                     L_ERR("Cannot load cls_cgroup");
-                error = subsys->Root.Mount("cgroup", "cgroup", 0, {subsys->Type});
+                error = MountCgroup(subsys->Root, {subsys->Type});
             }
 
             /* hugetlb is optional yet */
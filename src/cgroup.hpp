@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 
 #include "common.hpp"
 #include "util/path.hpp"
@@ -43,6 +44,54 @@ public:
     bool IsEnabled(const TCgroup &cgroup) const;
 };
 
+/* Knob contents read during one get request, keyed by knob path */
+struct TCgroupStat {
+    std::unordered_map<std::string, std::string> Values;
+    std::unordered_map<std::string, TUintMap> Maps;
+
+    void Invalidate(const std::string &path) {
+        Values.erase(path);
+        Maps.erase(path);
+    }
+};
+
+/*
+ * While alive caches knob contents read by this thread, thus
+ * every property in one get request reads cgroup file at most once.
+ */
+class TCgroupStatCache : public TNonCopyable {
+    TCgroupStat *Prev;
+    TCgroupStat Own;
+public:
+    static __thread TCgroupStat *Current;
+
+    TCgroupStatCache(TCgroupStat *stat = nullptr) : Prev(Current) {
+        Current = stat ? stat : &Own;
+    }
+    ~TCgroupStatCache() { Current = Prev; }
+};
+
+/* Also limit of transient descriptors opened by one prefetch */
+constexpr unsigned KNOB_PREFETCH_BATCH = 256;
+
+/*
+ * Reads knobs of many cgroups in few io_uring batches and puts
+ * contents into their TCgroupStat. Knobs which weren't read for
+ * any reason are later read synchronously as usual.
+ */
+class TCgroupPrefetch : public TNonCopyable {
+    struct TItem {
+        std::string Path;
+        std::vector<TCgroupStat *> Stats;
+    };
+    std::vector<TItem> Items;
+    std::unordered_map<std::string, size_t> Index;
+public:
+    void Add(TCgroupStat &stat, const TCgroup &cg, const std::string &knob);
+    bool Empty() const { return Items.empty(); }
+    TError Run();
+};
+
 class TCgroup {
 public:
     const TSubsystem *Subsystem;
@@ -98,6 +147,9 @@ public:
     bool IsEmpty() const;
 
     TError Attach(pid_t pid) const;
+    /* Attach caller via cgroup.procs opened in advance, safe after fork */
+    TError OpenAttach(TFile &procs) const;
+    TError AttachSelf(const TFile &procs) const;
     TError AttachAll(const TCgroup &cg) const;
 
     TPath Knob(const std::string &knob) const;
@@ -262,6 +314,12 @@ public:
         if (RootCgroup().GetBool("cgroup.sane_behavior", HasSaneBehavior))
             HasSaneBehavior = false;
     }
+    std::string IoStatKnob(bool iops) const {
+        /* get statistics from throttler if possible, it has couners for raids */
+        if (HasThrottler)
+            return iops ? "blkio.throttle.io_serviced" : "blkio.throttle.io_service_bytes";
+        return iops ? "blkio.io_serviced_recursive" : "blkio.io_service_bytes_recursive";
+    }
     TError GetIoStat(TCgroup &cg, TUintMap &map, int dir, bool iops) const;
     TError SetIoPolicy(TCgroup &cg, const std::string &policy) const;
     TError SetIoLimit(TCgroup &cg, const TUintMap &map, bool iops = false);
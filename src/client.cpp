@@ -6,6 +6,7 @@
 #include "client.hpp"
 #include "container.hpp"
 #include "volume.hpp"
+#include "kvalue.hpp"
 #include "property.hpp"
 #include "statistics.hpp"
 #include "config.hpp"
@@ -53,8 +54,8 @@ void TClient::CloseConnection() {
     TScopedLock lock(Mutex);
 
     if (Fd >= 0) {
-        if (InEpoll)
-            EpollLoop->RemoveSource(Fd);
+        if (Loop)
+            Loop->RemoveSource(Fd);
         ConnectionTime = GetCurrentTimeMs() - ConnectionTime;
         if (Verbose)
             L("Client disconnected: {}: {} ms", *this, ConnectionTime);
@@ -74,16 +75,29 @@ void TClient::CloseConnection() {
 
 void TClient::StartRequest() {
     RequestTimeMs = GetCurrentTimeMs();
+    LockWaitUs = 0;
     ActivityTimeMs = RequestTimeMs;
     PORTO_ASSERT(CL == nullptr);
     CL = this;
 }
 
-void TClient::FinishRequest() {
-    RequestTimeMs = GetCurrentTimeMs() - RequestTimeMs;
+TError TClient::FinishRequest() {
+    TError error;
+
     ReleaseContainer();
+
+    for (auto &commit: Commits) {
+        TError err = KvCommitter.Wait(commit.first, commit.second);
+        if (err && !error)
+            error = err;
+    }
+    Commits.clear();
+
+    RequestTimeMs = GetCurrentTimeMs() - RequestTimeMs;
     PORTO_ASSERT(CL == this);
     CL = nullptr;
+
+    return error;
 }
 
 TError TClient::IdentifyClient(bool initial) {
@@ -208,10 +222,10 @@ TError TClient::ResolveContainer(const std::string &relative_name,
 
 TError TClient::ReadContainer(const std::string &relative_name,
                               std::shared_ptr<TContainer> &ct, bool try_lock) {
-    auto lock = LockContainers();
     TError error = ResolveContainer(relative_name, ct);
     if (error)
         return error;
+    auto lock = LockContainers();
     ReleaseContainer(true);
     error = ct->LockRead(lock, try_lock);
     if (error)
@@ -224,10 +238,10 @@ TError TClient::WriteContainer(const std::string &relative_name,
                                std::shared_ptr<TContainer> &ct, bool child) {
     if (AccessLevel <= EAccessLevel::ReadOnly)
         return TError(EError::Permission, "Write access denied");
-    auto lock = LockContainers();
     TError error = ResolveContainer(relative_name, ct);
     if (error)
         return error;
+    auto lock = LockContainers();
     error = CanControl(*ct, child);
     if (error)
         return error;
@@ -236,6 +250,9 @@ TError TClient::WriteContainer(const std::string &relative_name,
     if (error)
         return error;
     LockedContainer = ct;
+    lock.unlock();
+    if (ct->Adopted)
+        (void)ct->VerifyAdopted();
     return TError::Success();
 }
 
@@ -243,9 +260,14 @@ TError TClient::LockContainer(std::shared_ptr<TContainer> &ct) {
     auto lock = LockContainers();
     ReleaseContainer(true);
     TError error = ct->Lock(lock);
-    if (!error)
-        LockedContainer = ct;
-    return error;
+    if (error)
+        return error;
+    LockedContainer = ct;
+    lock.unlock();
+    /* Container adopted on upgrade is checked before first change */
+    if (ct->Adopted)
+        (void)ct->VerifyAdopted();
+    return TError::Success();
 }
 
 void TClient::ReleaseContainer(bool locked) {
@@ -389,14 +411,52 @@ TError TClient::WriteAccess(const TFile &file) {
     return error;
 }
 
-TError TClient::ReadRequest(rpc::TContainerRequest &request) {
-    TScopedLock lock(Mutex);
+/* Stops at pipeline limit, the rest stays in buffer till NextRequest */
+TError TClient::ParseRequests() {
+    while (Offset && Requests.size() < PORTO_MAX_PIPELINE) {
+        if (Length && Offset < Length)
+            return TError::Success();
 
-    if (Processing) {
-        L_WRN("Client request before response: {}", *this);
-        return TError::Success();
+        google::protobuf::io::CodedInputStream input(&Buffer[0], Offset);
+
+        uint32_t length;
+        if (!input.ReadVarint32(&length))
+            return TError::Success();
+
+        size_t lengthSize = google::protobuf::io::CodedOutputStream::VarintSize32(length);
+
+        if (!Length) {
+            if (length > config().daemon().max_msg_len())
+                return TError(EError::Unknown, "oversized request: " + std::to_string(length));
+
+            Length = length + lengthSize;
+            if (Buffer.size() < Length)
+                Buffer.resize(Length + 4096);
+
+            if (Offset < Length)
+                return TError::Success();
+        }
+
+        Requests.emplace_back();
+        if (!Requests.back().ParseFromArray(&Buffer[lengthSize], length))
+            return TError(EError::Unknown, "cannot parse request");
+
+        Inflight++;
+
+        /* keep next pipelined requests */
+        if (Offset > Length)
+            memmove(&Buffer[0], &Buffer[Length], Offset - Length);
+        Offset -= Length;
+        Length = 0;
     }
 
+    return TError::Success();
+}
+
+TError TClient::ReadRequest(rpc::TContainerRequest &request) {
+    TScopedLock lock(Mutex);
+    TError error;
+
     if (Fd < 0)
         return TError(EError::Unknown, "Connection closed");
 
@@ -413,46 +473,68 @@ TError TClient::ReadRequest(rpc::TContainerRequest &request) {
 
     ActivityTimeMs = GetCurrentTimeMs();
 
-    if (Length && Offset < Length)
-        return TError::Queued();
+    error = ParseRequests();
+    if (error)
+        return error;
 
-    google::protobuf::io::CodedInputStream input(&Buffer[0], Offset);
+    if (Requests.size() >= PORTO_MAX_PIPELINE) {
+        error = UpdateEvents();
+        if (error)
+            return error;
+    }
 
-    uint32_t length;
-    if (!input.ReadVarint32(&length))
+    if (Processing || Requests.empty())
         return TError::Queued();
 
-    if (!Length) {
-        if (length > config().daemon().max_msg_len())
-            return TError(EError::Unknown, "oversized request: " + std::to_string(length));
+    request.Swap(&Requests.front());
+    Requests.pop_front();
+    Processing = true;
+
+    return TError::Success();
+}
 
-        Length = length + google::protobuf::io::CodedOutputStream::VarintSize32(length);
-        if (Buffer.size() < Length)
-            Buffer.resize(Length + 4096);
+/* Requests from one client are handled one by one in order of arrival */
+bool TClient::NextRequest(rpc::TContainerRequest &request) {
+    TScopedLock lock(Mutex);
 
-        if (Offset < Length)
-            return TError::Queued();
+    TError error = Fd < 0 ? TError::Success() : ParseRequests();
+    if (error) {
+        /* reactor drops client on hangup */
+        L_WRN("Cannot read request from {}: {}", *this, error);
+        shutdown(Fd, SHUT_RDWR);
+    }
+
+    if (Fd < 0 || error || Requests.empty()) {
+        Processing = false;
+        return false;
     }
 
-    if (!request.ParseFromCodedStream(&input))
-        return TError(EError::Unknown, "cannot parse request");
+    request.Swap(&Requests.front());
+    Requests.pop_front();
 
-    if (Offset > Length)
-        return TError(EError::Unknown, "garbage after request");
+    if (Requests.size() == PORTO_MAX_PIPELINE - 1)
+        (void)UpdateEvents();
 
-    Processing = true;
-    return EpollLoop->StopInput(Fd);
+    return true;
 }
 
-TError TClient::SendResponse(bool first) {
-    TScopedLock lock(Mutex);
+TError TClient::UpdateEvents() {
+    if (Fd < 0 || !Loop)
+        return TError::Success();
+
+    return Loop->SetEvents(Fd, Requests.size() < PORTO_MAX_PIPELINE &&
+                                   Output.size() - Sent < PORTO_MAX_OUTPUT,
+                           Sent < Output.size());
+}
 
+TError TClient::SendOutput(bool first) {
     if (Fd < 0)
         return TError::Success(); /* Connection closed */
 
-    ssize_t len = send(Fd, &Buffer[Offset], Length - Offset, MSG_DONTWAIT);
+    bool stalled = Output.size() - Sent >= PORTO_MAX_OUTPUT;
+    ssize_t len = send(Fd, &Output[Sent], Output.size() - Sent, MSG_DONTWAIT);
     if (len > 0)
-        Offset += len;
+        Sent += len;
     else if (len == 0) {
         if (!first)
             return TError(EError::Unknown, "send return zero");
@@ -464,31 +546,96 @@ TError TClient::SendResponse(bool first) {
 
     ActivityTimeMs = GetCurrentTimeMs();
 
-    if (Offset >= Length) {
-        Length = Offset = 0;
-        Processing = false;
-        return EpollLoop->StartInput(Fd);
+    if (Sent >= Output.size()) {
+        if (SendMethod >= 0) {
+            RecordRpcPhase(SendMethod, RPC_PHASE_SEND, GetCurrentTimeUs() - SendStartUs);
+            SendMethod = -1;
+        }
+        Output.clear();
+        Sent = 0;
+        return UpdateEvents();
     }
 
-    if (first)
-        return EpollLoop->StartOutput(Fd);
+    /* wait for output space, resume input once client reads enough */
+    if (first || (stalled && Output.size() - Sent < PORTO_MAX_OUTPUT))
+        return UpdateEvents();
 
     return TError::Success();
 }
 
-TError TClient::QueueResponse(rpc::TContainerResponse &response) {
+TError TClient::SendResponse(bool first) {
+    TScopedLock lock(Mutex);
+    TError error = SendOutput(first);
+    auto subscriber = Output.empty() ? Subscriber : nullptr;
+    lock.unlock();
+
+    /* output space is available for events */
+    if (!error && subscriber)
+        subscriber->Flush();
+
+    return error;
+}
+
+bool TClient::OutputIdle() {
+    TScopedLock lock(Mutex);
+    return Output.empty();
+}
+
+bool TClient::CanHandoff() {
+    TScopedLock lock(Mutex);
+    return Fd >= 0 && !Processing && !Inflight && !Offset && Requests.empty() &&
+        Output.empty() && !Subscriber && Waiters.empty() && WeakContainers.empty();
+}
+
+uint64_t TClient::IdleTimeMs(uint64_t now) {
+    TScopedLock lock(Mutex);
+    if (Processing || Inflight || Subscriber || now < ActivityTimeMs)
+        return 0;
+    return now - ActivityTimeMs;
+}
+
+void TClient::SetSubscriber(std::shared_ptr<TContainerSubscriber> subscriber) {
+    TScopedLock lock(Mutex);
+    Subscriber = subscriber;
+}
+
+bool TClient::Subscribed() {
+    TScopedLock lock(Mutex);
+    return Subscriber != nullptr;
+}
+
+TError TClient::QueueResponse(rpc::TContainerResponse &response, bool reply, int method) {
+    TScopedLock lock(Mutex);
+
+    if (Fd < 0)
+        return TError::Success(); /* Connection closed */
+
     uint32_t length = response.ByteSize();
     size_t lengthSize = google::protobuf::io::CodedOutputStream::VarintSize32(length);
+    size_t offset = Output.size();
+    bool pending = Sent < offset;
 
-    Offset = 0;
-    Length = lengthSize + length;
-
-    if (Buffer.size() < Length)
-        Buffer.resize(Length);
+    Output.resize(offset + lengthSize + length);
 
-    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(length, &Buffer[0]);
-    if (!response.SerializeToArray(&Buffer[lengthSize], length))
+    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(length, &Output[offset]);
+    if (!response.SerializeToArray(&Output[offset + lengthSize], length))
         return TError(EError::Unknown, "cannot serialize response");
 
-    return SendResponse(true);
+    if (reply && Inflight)
+        Inflight--;
+
+    if (reply && !offset) {
+        SendMethod = method;
+        SendStartUs = GetCurrentTimeUs();
+    }
+
+    /* previous responses are still waiting for output space */
+    if (pending) {
+        /* client does not read responses, stop reading its requests */
+        if (offset - Sent < PORTO_MAX_OUTPUT && Output.size() - Sent >= PORTO_MAX_OUTPUT)
+            return UpdateEvents();
+        return TError::Success();
+    }
+
+    return SendOutput(true);
 }
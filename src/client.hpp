@@ -3,10 +3,12 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <deque>
 
 #include "container.hpp"
 #include "common.hpp"
 #include "epoll.hpp"
+#include "statistics.hpp"
 #include "util/cred.hpp"
 #include "util/unix.hpp"
 
@@ -14,6 +16,12 @@
 
 class TEpollLoop;
 
+/* Requests parsed ahead of execution before reading from client stops */
+constexpr size_t PORTO_MAX_PIPELINE = 64;
+
+/* Unsent responses above which reading from client stops */
+constexpr size_t PORTO_MAX_OUTPUT = 4 << 20;
+
 namespace rpc {
     class TContainerRequest;
 }
@@ -29,8 +37,11 @@ public:
     std::shared_ptr<TContainer> LockedContainer;
     uint64_t ActivityTimeMs = 0;
     uint64_t RequestTimeMs = 0;
-    bool Processing = false;
-    bool InEpoll = false;
+    int RequestMethod = RPC_STAT_METHODS - 1;   /* for rpc statistics, worker only */
+    uint64_t LockWaitUs = 0;                    /* in current request */
+    bool Processing = false;    /* request is queued to or handled by worker */
+    uint64_t Inflight = 0;      /* requests without sent response */
+    std::shared_ptr<TEpollLoop> Loop; /* reactor which polls this client */
 
     TClient(int fd);
     TClient(const std::string &special);
@@ -52,7 +63,7 @@ public:
     void CloseConnection();
 
     void StartRequest();
-    void FinishRequest();
+    TError FinishRequest();
 
     TError IdentifyClient(bool initial);
     TError ComposeName(const std::string &name, std::string &relative_name) const;
@@ -95,16 +106,33 @@ public:
         return stream;
     }
 
-    std::shared_ptr<TContainerWaiter> Waiter;
+    std::list<std::shared_ptr<TContainerWaiter>> Waiters;
 
     TError ReadRequest(rpc::TContainerRequest &request);
+    bool NextRequest(rpc::TContainerRequest &request);
     bool ReadInterrupted();
 
-    TError QueueResponse(rpc::TContainerResponse &response);
+    /* reply completes request, otherwise it's unsolicited like events */
+    /* method is of request which is answered, for rpc statistics */
+    TError QueueResponse(rpc::TContainerResponse &response, bool reply = true,
+                         int method = RPC_STAT_METHODS - 1);
     TError SendResponse(bool first);
+    bool OutputIdle();
+
+    /* Nothing buffered or bound to connection, next slave could serve it */
+    bool CanHandoff();
+
+    /* Time since last activity, zero while request or subscription is active */
+    uint64_t IdleTimeMs(uint64_t now);
+
+    void SetSubscriber(std::shared_ptr<TContainerSubscriber> subscriber);
+    bool Subscribed();
 
     std::list<std::weak_ptr<TContainer>> WeakContainers;
 
+    /* Container saves queued in current request */
+    std::vector<std::pair<std::shared_ptr<TKeyValue>, uint64_t>> Commits;
+
 private:
     std::mutex Mutex;
     uint64_t ConnectionTime = 0;
@@ -114,6 +142,20 @@ private:
     uint64_t Length = 0;
     uint64_t Offset = 0;
     std::vector<uint8_t> Buffer;
+    std::deque<rpc::TContainerRequest> Requests;
+
+    uint64_t Sent = 0;
+    std::vector<uint8_t> Output;
+
+    /* first reply queued into empty output, timed till output is sent */
+    int SendMethod = -1;
+    uint64_t SendStartUs = 0;
+
+    std::shared_ptr<TContainerSubscriber> Subscriber;
+
+    TError ParseRequests();
+    TError SendOutput(bool first);
+    TError UpdateEvents();
 };
 
 extern TClient SystemClient;
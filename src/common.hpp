@@ -70,6 +70,7 @@ constexpr uint64_t PORTO_SOCKET_MODE = 0666;
 constexpr int  REAP_EVT_FD = 128;
 constexpr int  REAP_ACK_FD = 129;
 constexpr int  PORTO_SK_FD = 130;
+constexpr int  HANDOFF_FD = 131;
 
 constexpr const char *PORTO_VERSION_FILE = "/run/portod.version";
 constexpr const char *PORTO_BINARY_PATH = "/run/portod";
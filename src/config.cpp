@@ -24,9 +24,15 @@ void TConfig::LoadDefaults() {
     config().Clear();
 
     config().mutable_log()->set_verbose(false);
+    config().mutable_log()->set_actions(true);
+    config().mutable_log()->set_requests(true);
+    config().mutable_log()->set_responses(true);
+    config().mutable_log()->set_cgroups(true);
+    config().mutable_log()->set_locks(false);
 
     config().set_keyvalue_limit(1 << 20);
     config().set_keyvalue_size(32 << 20);
+    config().set_keyvalue_backend("files");
 
     config().mutable_daemon()->set_max_clients(1000);
     config().mutable_daemon()->set_max_clients_in_container(500);
@@ -39,10 +45,20 @@ void TConfig::LoadDefaults() {
     config().mutable_daemon()->set_workers(32);
     config().mutable_daemon()->set_max_msg_len(32 * 1024 * 1024);
     config().mutable_daemon()->set_event_workers(1);
+    config().mutable_daemon()->set_rpc_reactors(4);
     config().mutable_daemon()->set_portod_stop_timeout(30);
     config().mutable_daemon()->set_portod_start_timeout(60);
     config().mutable_daemon()->set_merge_memory_blkio_controllers(false);
     config().mutable_daemon()->set_client_idle_timeout(60);
+    config().mutable_daemon()->set_cgroup_knob_fds(8192);
+    config().mutable_daemon()->set_stat_io_uring(false);
+    config().mutable_daemon()->set_subscribe_buffer(1024);
+    config().mutable_daemon()->set_log_buffer(16384);
+    config().mutable_daemon()->set_log_overflow_block(false);
+    config().mutable_daemon()->set_restore_threads(8);
+    config().mutable_daemon()->set_upgrade_handoff(false);
+    config().mutable_daemon()->set_cgroup_favordynmods(false);
+    config().mutable_daemon()->set_kv_threads(1);
 
     config().mutable_container()->set_default_aging_time_s(60 * 60 * 24);
     config().mutable_container()->set_respawn_delay_ms(1000);
@@ -143,6 +159,14 @@ void TConfig::Load() {
 
     Verbose |= config().log().verbose();
 
+    auto &log = config().log();
+    LogCategories = (log.actions() << LOG_CAT_ACTION) |
+                    (log.requests() << LOG_CAT_REQUEST) |
+                    (log.responses() << LOG_CAT_RESPONSE) |
+                    (log.cgroups() << LOG_CAT_CGROUP) |
+                    ((log.locks() || Verbose) << LOG_CAT_LOCK) |
+                    (Verbose << LOG_CAT_VERBOSE);
+
     InitCred();
     InitCapabilities();
     InitIpcSysctl();
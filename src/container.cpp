@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <algorithm>
 #include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "portod.hpp"
 #include "statistics.hpp"
@@ -39,11 +41,17 @@ extern "C" {
 }
 
 std::mutex ContainersMutex;
-static std::condition_variable ContainersCV;
 std::shared_ptr<TContainer> RootContainer;
-std::map<std::string, std::shared_ptr<TContainer>> Containers;
+TContainerRegistry Containers;
 TPath ContainersKV;
 TIdMap ContainerIdMap(1, CONTAINER_ID_MAX);
+/* Reseeded in each slave, must be above anything given by previous one */
+std::atomic<uint64_t> ContainerGeneration(GetCurrentTimeMs() * 1000);
+
+/* WaitTask and SeizeTask pids for exit delivery */
+static std::unordered_map<pid_t, std::weak_ptr<TContainer>> TaskPids;
+static std::mutex TaskPidsMutex;
+static std::unordered_set<pid_t> PidFdPids;
 
 std::mutex CpuAffinityMutex;
 static std::vector<TBitMap> CoreThreads;
@@ -111,14 +119,79 @@ std::string TContainer::ParentName(const std::string &name) {
     return name.substr(0, sep);
 }
 
-std::shared_ptr<TContainer> TContainer::Find(const std::string &name) {
+std::unique_lock<std::mutex> TContainerRegistry::TShard::Lock() {
+    std::unique_lock<std::mutex> lock(Mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        lock.lock();
+        Contended++;
+    }
+    Locks++;
+    return lock;
+}
+
+void TContainerRegistry::Insert(std::shared_ptr<TContainer> ct) {
     PORTO_LOCKED(ContainersMutex);
-    auto it = Containers.find(name);
-    if (it == Containers.end())
+    auto &shard = GetShard(ct->Name);
+    auto lock = shard.Lock();
+    if (shard.Map.emplace(ct->Name, ct).second)
+        Count++;
+}
+
+void TContainerRegistry::Erase(const std::string &name) {
+    PORTO_LOCKED(ContainersMutex);
+    auto &shard = GetShard(name);
+    auto lock = shard.Lock();
+    Count -= shard.Map.erase(name);
+}
+
+std::shared_ptr<TContainer> TContainerRegistry::Find(const std::string &name) {
+    auto &shard = GetShard(name);
+    auto lock = shard.Lock();
+    auto it = shard.Map.find(name);
+    if (it == shard.Map.end())
         return nullptr;
     return it->second;
 }
 
+std::vector<std::shared_ptr<TContainer>> TContainerRegistry::List() {
+    std::vector<std::shared_ptr<TContainer>> list;
+
+    list.reserve(Count);
+    for (auto &shard: Shards) {
+        auto lock = shard.Lock();
+        for (auto &it: shard.Map)
+            list.push_back(it.second);
+    }
+
+    return list;
+}
+
+std::vector<std::shared_ptr<TContainer>> TContainerRegistry::ListSorted() {
+    auto list = List();
+
+    std::sort(list.begin(), list.end(),
+              [](const std::shared_ptr<TContainer> &a,
+                 const std::shared_ptr<TContainer> &b) {
+                  return a->Name < b->Name;
+              });
+
+    return list;
+}
+
+void TContainerRegistry::DumpContention() {
+    for (int i = 0; i < NR_SHARDS; i++) {
+        auto &shard = Shards[i];
+        auto lock = shard.Lock();
+        if (shard.Contended)
+            L("Shard {} containers {} locks {} contended {}", i,
+              shard.Map.size(), shard.Locks, shard.Contended);
+    }
+}
+
+std::shared_ptr<TContainer> TContainer::Find(const std::string &name) {
+    return Containers.Find(name);
+}
+
 TError TContainer::Find(const std::string &name, std::shared_ptr<TContainer> &ct) {
     ct = Find(name);
     if (ct)
@@ -126,6 +199,38 @@ TError TContainer::Find(const std::string &name, std::shared_ptr<TContainer> &ct
     return TError(EError::ContainerDoesNotExist, "container " + name + " not found");
 }
 
+std::shared_ptr<TContainer> TContainer::FindTaskPid(pid_t pid) {
+    std::lock_guard<std::mutex> guard(TaskPidsMutex);
+    auto it = TaskPids.find(pid);
+    if (it == TaskPids.end())
+        return nullptr;
+    auto ct = it->second.lock();
+    if (!ct)
+        TaskPids.erase(it);
+    return ct;
+}
+
+bool TContainer::PidFdWatched(pid_t pid) {
+    std::lock_guard<std::mutex> guard(TaskPidsMutex);
+    return PidFdPids.count(pid);
+}
+
+void TContainer::SetTaskPid(TTask &task, pid_t pid) {
+    std::unique_lock<std::mutex> guard(TaskPidsMutex);
+    if (task.Pid) {
+        auto it = TaskPids.find(task.Pid);
+        if (it != TaskPids.end() && it->second.lock().get() == this)
+            TaskPids.erase(it);
+    }
+    task.Pid = pid;
+    if (pid)
+        TaskPids[pid] = shared_from_this();
+    guard.unlock();
+
+    if (&task == &WaitTask)
+        WatchWaitTask();
+}
+
 TError TContainer::FindTaskContainer(pid_t pid, std::shared_ptr<TContainer> &ct) {
     TError error;
     TCgroup cg;
@@ -138,64 +243,161 @@ TError TContainer::FindTaskContainer(pid_t pid, std::shared_ptr<TContainer> &ct)
     std::string name = cg.Name;
     std::replace(name.begin(), name.end(), '%', '/');
 
-    auto containers_lock = LockContainers();
-
     if (!StringStartsWith(name, prefix))
         return TContainer::Find(ROOT_CONTAINER, ct);
 
     return TContainer::Find(name.substr(prefix.length()), ct);
 }
 
-/* lock subtree for read or write */
-TError TContainer::Lock(TScopedLock &lock, bool for_read, bool try_lock) {
-    if (Verbose)
-        L("{} {} {}",
-          (try_lock ? "TryLock " : "Lock "),
-          (for_read ? "read " : "write "),
-          Name);
-
-    while (1) {
-        if (State == EContainerState::Destroyed) {
-            if (Verbose)
-                L("Lock failed, container was destroyed: {}", Name);
-            return TError(EError::ContainerDoesNotExist, "Container was destroyed");
-        }
-        bool busy;
-        if (for_read)
-            busy = Locked < 0 || PendingWrite || SubtreeWrite;
-        else
-            busy = Locked || SubtreeRead || SubtreeWrite;
-        for (auto ct = Parent.get(); !busy && ct; ct = ct->Parent.get())
-            busy = ct->PendingWrite || (for_read ? ct->Locked < 0 : ct->Locked);
-        if (!busy)
-            break;
-        if (try_lock) {
-            if (Verbose)
-                L("TryLock {} Failed {}", (for_read ? "read" : "write"), Name);
-            return TError(EError::Busy, "Container is busy: " + Name);
-        }
-        if (!for_read)
-            PendingWrite = true;
-        ContainersCV.wait(lock);
+/*
+ * Waiter for container lock. It is queued at container which blocks it:
+ * locked container itself or its ancestor. Each state change which might
+ * unblock waiters processes queues of changed container and its ancestors
+ * in FIFO order and hands lock off to waiters directly.
+ */
+struct TContainerLockWaiter {
+    TContainer *Container;
+    TContainer *Blocker;
+    bool ForRead;
+    bool Upgrade;
+    bool Granted = false;
+    pid_t Tid;
+    std::condition_variable CV;
+
+    TContainerLockWaiter(TContainer *ct, TContainer *blocker, bool for_read, bool upgrade) :
+        Container(ct), Blocker(blocker), ForRead(for_read), Upgrade(upgrade), Tid(GetTid()) {}
+};
+
+/* Returns container which prevents locking or nullptr */
+TContainer *TContainer::LockBlocker(bool for_read, bool upgrade) {
+    if (upgrade)
+        return Locked != 1 ? this : nullptr;
+    if (for_read ? (Locked < 0 || PendingWrite || SubtreeWrite) :
+                   (Locked || SubtreeRead || SubtreeWrite))
+        return this;
+    for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
+        if (ct->PendingWrite || (for_read ? ct->Locked < 0 : ct->Locked))
+            return ct;
     }
-    PendingWrite = false;
+    return nullptr;
+}
+
+void TContainer::LockAcquire(bool for_read, pid_t tid) {
     Locked += for_read ? 1 : -1;
-    LastOwner = GetTid();
+    LastOwner = tid;
     for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
         if (for_read)
             ct->SubtreeRead++;
         else
             ct->SubtreeWrite++;
     }
+}
+
+void TContainer::WakeLockQueue() {
+    for (auto it = LockQueue.begin(); it != LockQueue.end(); ) {
+        auto waiter = *it;
+        auto ct = waiter->Container;
+        TContainer *blocker = nullptr;
+
+        if (ct->State != EContainerState::Destroyed) {
+            blocker = ct->LockBlocker(waiter->ForRead, waiter->Upgrade);
+            if (blocker == this) {
+                ++it;
+                continue;
+            }
+        }
+
+        it = LockQueue.erase(it);
+        waiter->Blocker = blocker;
+
+        if (blocker) {
+            blocker->LockQueue.push_back(waiter);
+            continue;
+        }
+
+        if (ct->State != EContainerState::Destroyed) {
+            if (!waiter->ForRead)
+                ct->PendingWrite--;
+            if (waiter->Upgrade) {
+                ct->Locked = -1;
+                ct->LastOwner = waiter->Tid;
+            } else
+                ct->LockAcquire(waiter->ForRead, waiter->Tid);
+            waiter->Granted = true;
+        }
+
+        waiter->CV.notify_one();
+    }
+}
+
+/* Lock state of container changed, recheck waiters which might be blocked by it */
+void TContainer::WakeLockQueues() {
+    for (auto ct = this; ct; ct = ct->Parent.get()) {
+        if (!ct->LockQueue.empty())
+            ct->WakeLockQueue();
+    }
+}
+
+TError TContainer::LockWait(TScopedLock &lock, TContainer *blocker,
+                            bool for_read, bool upgrade) {
+    TContainerLockWaiter waiter(this, blocker, for_read, upgrade);
+    uint64_t start = GetCurrentTimeUs();
+
+    if (!for_read)
+        PendingWrite++;
+
+    blocker->LockQueue.push_back(&waiter);
+
+    while (!waiter.Granted && waiter.Blocker)
+        waiter.CV.wait(lock);
+
+    uint64_t wait = GetCurrentTimeUs() - start;
+    LockWaits++;
+    LockWaitTime += wait / 1000;
+    if (CL)
+        CL->LockWaitUs += wait;
+
+    if (!waiter.Granted) {
+        if (!for_read)
+            PendingWrite--;
+        L_LCK("Lock failed, container was destroyed: {}", Name);
+        return TError(EError::ContainerDoesNotExist, "Container was destroyed");
+    }
+
     return TError::Success();
 }
 
+/* lock subtree for read or write */
+TError TContainer::Lock(TScopedLock &lock, bool for_read, bool try_lock) {
+    L_LCK("{} {} {}",
+          (try_lock ? "TryLock " : "Lock "),
+          (for_read ? "read " : "write "),
+          Name);
+
+    if (State == EContainerState::Destroyed) {
+        L_LCK("Lock failed, container was destroyed: {}", Name);
+        return TError(EError::ContainerDoesNotExist, "Container was destroyed");
+    }
+
+    auto blocker = LockBlocker(for_read);
+    if (!blocker) {
+        LockAcquire(for_read, GetTid());
+        return TError::Success();
+    }
+
+    if (try_lock) {
+        L_LCK("TryLock {} Failed {}", (for_read ? "read" : "write"), Name);
+        return TError(EError::Busy, "Container is busy: " + Name);
+    }
+
+    return LockWait(lock, blocker, for_read, false);
+}
+
 void TContainer::DowngradeLock() {
     auto lock = LockContainers();
     PORTO_ASSERT(Locked == -1);
 
-    if (Verbose)
-        L("Downgrading write to read {}", Name);
+    L_LCK("Downgrading write to read {}", Name);
 
     for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
         ct->SubtreeRead++;
@@ -203,34 +405,30 @@ void TContainer::DowngradeLock() {
     }
 
     Locked = 1;
-    ContainersCV.notify_all();
+    WakeLockQueues();
 }
 
 void TContainer::UpgradeLock() {
     auto lock = LockContainers();
 
-    if (Verbose)
-        L("Upgrading read back to write {}", Name);
-
-    PendingWrite = true;
+    L_LCK("Upgrading read back to write {}", Name);
 
     for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
         ct->SubtreeRead--;
         ct->SubtreeWrite++;
     }
 
-    while (Locked != 1)
-        ContainersCV.wait(lock);
-
-    Locked = -1;
-    LastOwner = GetTid();
-
-    PendingWrite = false;
+    if (LockBlocker(false, true)) {
+        TError error = LockWait(lock, this, false, true);
+        PORTO_ASSERT(!error);
+    } else {
+        Locked = -1;
+        LastOwner = GetTid();
+    }
 }
 
 void TContainer::Unlock(bool locked) {
-    if (Verbose)
-        L("Unlock {} {}", (Locked > 0 ? "read " : "write "), Name);
+    L_LCK("Unlock {} {}", (Locked > 0 ? "read " : "write "), Name);
     if (!locked)
         ContainersMutex.lock();
     for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
@@ -244,26 +442,28 @@ void TContainer::Unlock(bool locked) {
     }
     PORTO_ASSERT(Locked);
     Locked += (Locked > 0) ? -1 : 1;
-    /* not so effective and fair but simple */
-    ContainersCV.notify_all();
+    WakeLockQueues();
     if (!locked)
         ContainersMutex.unlock();
 }
 
 void TContainer::DumpLocks() {
+    auto containers = Containers.List();
     auto lock = LockContainers();
-    for (auto &it: Containers) {
-        auto &ct = it.second;
+    for (auto &ct: containers) {
         if (ct->Locked || ct->PendingWrite || ct->SubtreeRead || ct->SubtreeWrite)
-            L("{} Locked {} by {} Read {} Write {}{}", ct->Name, ct->Locked,
-                ct->LastOwner, ct->SubtreeRead, ct->SubtreeWrite,
-                (ct->PendingWrite ? " PendingWrite" : ""));
+            L("{} Locked {} by {} Read {} Write {}{} Queued {} Waits {} Wait {} ms",
+                ct->Name, ct->Locked, ct->LastOwner, ct->SubtreeRead, ct->SubtreeWrite,
+                (ct->PendingWrite ? " PendingWrite" : ""), ct->LockQueue.size(),
+                ct->LockWaits, ct->LockWaitTime);
     }
+    lock.unlock();
+    Containers.DumpContention();
 }
 
 void TContainer::Register() {
     PORTO_LOCKED(ContainersMutex);
-    Containers[Name] = shared_from_this();
+    Containers.Insert(shared_from_this());
     if (Parent)
         Parent->Children.emplace_back(shared_from_this());
     Statistics->ContainersCreated++;
@@ -274,7 +474,7 @@ TContainer::TContainer(std::shared_ptr<TContainer> parent, const std::string &na
     FirstName(!parent ? "" : parent->IsRoot() ? name : name.substr(parent->Name.length() + 1)),
     Level(parent ? parent->Level + 1 : 0),
     Stdin(0), Stdout(1), Stderr(2),
-    ClientsCount(0), ContainerRequests(0), OomEvents(0)
+    ClientsCount(0), ContainerRequests(0), LockWaits(0), LockWaitTime(0), OomEvents(0)
 {
     Statistics->ContainersCount++;
     RealCreationTime = time(nullptr);
@@ -352,6 +552,8 @@ TContainer::TContainer(std::shared_ptr<TContainer> parent, const std::string &na
         AccessLevel = EAccessLevel::ReadOnly;
     else
         AccessLevel = EAccessLevel::Normal;
+
+    Touch();
 }
 
 TContainer::~TContainer() {
@@ -360,7 +562,8 @@ TContainer::~TContainer() {
     Statistics->ContainersCount--;
 }
 
-TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &ct) {
+TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &ct,
+                          bool locked) {
     auto nrMax = config().container().max_total();
     TError error;
 
@@ -383,12 +586,12 @@ TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &
     } else if (name != ROOT_CONTAINER)
         return TError(EError::ContainerDoesNotExist, "parent container not found for " + name);
 
-    if (Containers.find(name) != Containers.end()) {
+    if (Containers.Exists(name)) {
         error = TError(EError::ContainerAlreadyExists, "container " + name + " already exists");
         goto err;
     }
 
-    if (Containers.size() >= nrMax + NR_SERVICE_CONTAINERS) {
+    if (Containers.Size() >= nrMax + NR_SERVICE_CONTAINERS) {
         error = TError(EError::ResourceNotAvailable,
                 "number of containers reached limit: " + std::to_string(nrMax));
         goto err;
@@ -431,9 +634,20 @@ TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &
 
     ct->Register();
 
+    TContainerSubscriber::Notify(*ct, EContainerEvent::Create);
+
     if (parent)
         parent->Unlock(true);
 
+    /* Nobody could lock it yet: containers lock is still held */
+    if (locked) {
+        CL->ReleaseContainer(true);
+        error = ct->Lock(lock);
+        if (error)
+            return error;
+        CL->LockedContainer = ct;
+    }
+
     return TError::Success();
 
 err:
@@ -445,7 +659,8 @@ err:
     return error;
 }
 
-TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct) {
+TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct,
+                           bool adopt) {
     TError error;
     int id;
 
@@ -453,11 +668,11 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
     if (error)
         return error;
 
-    L_ACT("Restore container {}", kv.Name);
+    L_ACT("{} container {}", adopt ? "Adopt" : "Restore", kv.Name);
 
     auto lock = LockContainers();
 
-    if (Containers.find(kv.Name) != Containers.end())
+    if (Containers.Exists(kv.Name))
         return TError(EError::ContainerAlreadyExists, kv.Name);
 
     std::shared_ptr<TContainer> parent;
@@ -479,18 +694,19 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
 
     ct->Id = id;
     ct->RootPath = parent->RootPath / ct->Root;
+    ct->Storage = std::make_shared<TKeyValue>(kv);
 
     /* SyncState might stop container, take lock for it */
-    error = SystemClient.LockContainer(ct);
+    error = CL->LockContainer(ct);
     if (error)
         return error;
 
     ct->SyncState();
 
-    SystemClient.ReleaseContainer();
+    CL->ReleaseContainer();
 
     if (ct->Task.Pid) {
-        error = ct->RestoreNetwork();
+        error = ct->RestoreNetwork(adopt);
         if (error && !ct->WaitTask.IsZombie()) {
             L_WRN("Cannot restore network: {}", error);
             ct->Reap(false);
@@ -506,73 +722,37 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
         if (error)
             goto err;
 
-        /* Kernel without group rt forbids moving RT tasks in to cpu cgroup */
-        if (ct->Task.Pid && (!CpuSubsystem.HasRtGroup || CpuSubsystem.HasSmart)) {
-            auto cpuCg = ct->GetCgroup(CpuSubsystem);
-            TCgroup cg;
-            bool smart;
-
-            if (!CpuSubsystem.TaskCgroup(ct->Task.Pid, cg) && cg != cpuCg) {
-                auto freezerCg = ct->GetCgroup(FreezerSubsystem);
-
-                /* Disable smart if we're moving tasks into another cgroup */
-                if (CpuSubsystem.HasSmart && !cg.GetBool("cpu.smart", smart) && smart) {
-                    cg.SetBool("cpu.smart", false);
-                } else if (!CpuSubsystem.HasRtGroup) {
-                    std::vector<pid_t> prev, pids;
-                    struct sched_param param;
-                    param.sched_priority = 0;
-                    bool retry;
-
-                    /* Disable RT for all task in freezer cgroup */
-                    do {
-                        error = freezerCg.GetTasks(pids);
-                        retry = false;
-                        for (auto pid: pids) {
-                            if (std::find(prev.begin(), prev.end(), pid) == prev.end() &&
-                                    sched_getscheduler(pid) == SCHED_RR &&
-                                    !sched_setscheduler(pid, SCHED_OTHER, &param))
-                                retry = true;
-                        }
-                        prev = pids;
-                    } while (retry);
-                }
-
-                /* Move tasks into correct cpu cgroup before enabling RT */
-                if (!CpuSubsystem.HasRtGroup && ct->SchedPolicy == SCHED_RR) {
-                    error = cpuCg.AttachAll(freezerCg);
-                    if (error)
-                        L_WRN("Cannot move to corrent cpu cgroup: {}", error);
-                }
-            }
-        }
-
-        /* Disable memory guarantee in old cgroup */
-        if (ct->MemGuarantee) {
-            TCgroup memCg;
-            if (!MemorySubsystem.TaskCgroup(ct->Task.Pid, memCg) &&
-                    memCg != ct->GetCgroup(MemorySubsystem))
-                MemorySubsystem.SetGuarantee(memCg, 0);
-        }
-
-        error = ct->ApplyDynamicProperties();
-        if (error)
-            goto err;
-
-        error = ct->SyncCgroups();
+        /*
+         * Previous slave has applied knobs and synced cgroups, only
+         * cpu distribution must be rebuilt in memory right now.
+         */
+        if (!adopt)
+            error = ct->RestoreCgroups();
+        else if (ct->TestClearPropDirty(EProperty::CPU_SET) && ct->Parent)
+            error = ct->Parent->DistributeCpus();
         if (error)
             goto err;
     }
 
+    if (ct->State == EContainerState::Dead)
+        ct->ScheduleAging();
+
     if (ct->MayRespawn())
         ct->ScheduleRespawn();
 
-    error = ct->Save();
-    if (error)
-        goto err;
+    /* Adopted node is the same as stored, state is saved by VerifyAdopted */
+    if (!adopt) {
+        error = ct->Save();
+        if (error)
+            goto err;
+    }
 
     lock.lock();
     ct->Register();
+    if (adopt) {
+        ct->Adopted = true;
+        Statistics->HandoffUnverified++;
+    }
     return TError::Success();
 
 err:
@@ -582,6 +762,97 @@ err:
     return error;
 }
 
+/* Brings kernel state of restored running container in line with properties */
+TError TContainer::RestoreCgroups() {
+    TError error;
+
+    /* Kernel without group rt forbids moving RT tasks in to cpu cgroup */
+    if (Task.Pid && (!CpuSubsystem.HasRtGroup || CpuSubsystem.HasSmart)) {
+        auto cpuCg = GetCgroup(CpuSubsystem);
+        TCgroup cg;
+        bool smart;
+
+        if (!CpuSubsystem.TaskCgroup(Task.Pid, cg) && cg != cpuCg) {
+            auto freezerCg = GetCgroup(FreezerSubsystem);
+
+            /* Disable smart if we're moving tasks into another cgroup */
+            if (CpuSubsystem.HasSmart && !cg.GetBool("cpu.smart", smart) && smart) {
+                cg.SetBool("cpu.smart", false);
+            } else if (!CpuSubsystem.HasRtGroup) {
+                std::vector<pid_t> prev, pids;
+                struct sched_param param;
+                param.sched_priority = 0;
+                bool retry;
+
+                /* Disable RT for all task in freezer cgroup */
+                do {
+                    error = freezerCg.GetTasks(pids);
+                    retry = false;
+                    for (auto pid: pids) {
+                        if (std::find(prev.begin(), prev.end(), pid) == prev.end() &&
+                                sched_getscheduler(pid) == SCHED_RR &&
+                                !sched_setscheduler(pid, SCHED_OTHER, &param))
+                            retry = true;
+                    }
+                    prev = pids;
+                } while (retry);
+            }
+
+            /* Move tasks into correct cpu cgroup before enabling RT */
+            if (!CpuSubsystem.HasRtGroup && SchedPolicy == SCHED_RR) {
+                error = cpuCg.AttachAll(freezerCg);
+                if (error)
+                    L_WRN("Cannot move to corrent cpu cgroup: {}", error);
+            }
+        }
+    }
+
+    /* Disable memory guarantee in old cgroup */
+    if (MemGuarantee) {
+        TCgroup memCg;
+        if (!MemorySubsystem.TaskCgroup(Task.Pid, memCg) &&
+                memCg != GetCgroup(MemorySubsystem))
+            MemorySubsystem.SetGuarantee(memCg, 0);
+    }
+
+    error = ApplyDynamicProperties();
+    if (error)
+        return error;
+
+    return SyncCgroups();
+}
+
+/*
+ * Finishes restore of container adopted from previous slave: re-applies
+ * knobs, syncs cgroups and traffic classes. Called under container lock
+ * before first change and by background pass after rpc is served.
+ */
+TError TContainer::VerifyAdopted() {
+    TError error;
+
+    if (!Adopted.exchange(false))
+        return TError::Success();
+
+    Statistics->HandoffUnverified--;
+
+    L_ACT("Verify adopted container {}", Name);
+
+    if (Task.Pid && Net) {
+        error = UpdateTrafficClasses();
+        if (error)
+            L_WRN("Cannot update traffic classes of {}: {}", Name, error);
+    }
+
+    if (State != EContainerState::Stopped &&
+            State != EContainerState::Dead) {
+        error = RestoreCgroups();
+        if (error)
+            L_WRN("Cannot restore cgroups of {}: {}", Name, error);
+    }
+
+    return Save();
+}
+
 std::string TContainer::StateName(EContainerState state) {
     switch (state) {
     case EContainerState::Stopped:
@@ -691,6 +962,7 @@ void TContainer::SetState(EContainerState next) {
     auto lock = LockContainers();
     auto prev = State;
     State = next;
+    Touch();
 
     if (prev == EContainerState::Running || next == EContainerState::Running) {
         for (auto p = Parent; p; p = p->Parent) {
@@ -704,6 +976,19 @@ void TContainer::SetState(EContainerState next) {
             next != EContainerState::Meta &&
             next != EContainerState::Starting)
         NotifyWaiters();
+
+    if (next == EContainerState::Dead)
+        ScheduleAging();
+    else if (prev == EContainerState::Dead)
+        CancelTimers();
+
+    if (next == EContainerState::Running ||
+            (next == EContainerState::Meta && prev == EContainerState::Starting))
+        TContainerSubscriber::Notify(*this, EContainerEvent::Start);
+    else if (next == EContainerState::Dead)
+        TContainerSubscriber::Notify(*this, EContainerEvent::Death);
+    else
+        TContainerSubscriber::Notify(*this, EContainerEvent::State);
 }
 
 TError TContainer::Destroy() {
@@ -738,21 +1023,39 @@ TError TContainer::Destroy() {
         Net = nullptr;
     }
 
+    /* pid could be taken by other container already, drop only ours */
+    std::unique_lock<std::mutex> guard(TaskPidsMutex);
+    for (auto pid: { Task.Pid, WaitTask.Pid, SeizeTask.Pid }) {
+        auto it = pid ? TaskPids.find(pid) : TaskPids.end();
+        if (it != TaskPids.end() && it->second.lock().get() == this)
+            TaskPids.erase(it);
+    }
+    guard.unlock();
+
     auto lock = LockContainers();
 
     error = ContainerIdMap.Put(Id);
     if (error)
         L_WRN("Cannot put container id : {}", error);
 
-    Containers.erase(Name);
+    Containers.Erase(Name);
     if (Parent)
         Parent->Children.remove(shared_from_this());
     State = EContainerState::Destroyed;
+    WakeLockQueues();
 
-    TPath path(ContainersKV / std::to_string(Id));
-    error = path.Unlink();
+    if (Adopted.exchange(false))
+        Statistics->HandoffUnverified--;
+
+    TContainerSubscriber::Notify(*this, EContainerEvent::Destroy);
+
+    if (Storage)
+        KvCommitter.Cancel(Storage);
+
+    TKeyValue node(ContainersKV / std::to_string(Id));
+    error = node.Remove();
     if (error)
-        L_ERR("Can't remove key-value node {}: {}", path, error);
+        L_ERR("Can't remove key-value node {}: {}", node.Path, error);
 
     return TError::Success();
 }
@@ -783,6 +1086,13 @@ std::list<std::shared_ptr<TContainer>> TContainer::Childs() {
     return childs;
 }
 
+uint64_t TContainer::ChangeGeneration() const {
+    uint64_t generation = Generation;
+    for (auto p = Parent; p; p = p->Parent)
+        generation = std::max(generation, p->Generation.load());
+    return generation;
+}
+
 std::shared_ptr<TContainer> TContainer::GetParent() const {
     return Parent;
 }
@@ -1406,6 +1716,70 @@ void TContainer::ShutdownOom() {
     OomEvent.Close();
 }
 
+/* Without pidfd support exit status comes only from master */
+void TContainer::WatchWaitTask() {
+    if (WaitSource)
+        EpollLoop->RemoveSource(WaitSource->Fd);
+    WaitSource = nullptr;
+
+    if (WaitPidFd.Fd >= 0) {
+        int status;
+
+        /* SIGCHLD was ignored for it, do not leave zombie behind */
+        (void)PidFdReap(WaitPidFd.Fd, status);
+        WaitPidFd.Close();
+
+        std::lock_guard<std::mutex> guard(TaskPidsMutex);
+        PidFdPids.erase(WaitPidFdPid);
+        WaitPidFdPid = 0;
+    }
+
+    if (!WaitTask.Pid || !EpollLoop)
+        return;
+
+    WaitPidFd.SetFd = PidFdOpen(WaitTask.Pid);
+    if (WaitPidFd.Fd < 0)
+        return;
+
+    WaitSource = std::make_shared<TEpollSource>(WaitPidFd.Fd, EPOLL_EVENT_PIDFD, shared_from_this());
+    TError error = EpollLoop->AddSource(WaitSource);
+    if (error) {
+        L_WRN("Cannot watch pidfd of {}: {}", WaitTask.Pid, error);
+        WaitSource = nullptr;
+        WaitPidFd.Close();
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(TaskPidsMutex);
+    WaitPidFdPid = WaitTask.Pid;
+    PidFdPids.insert(WaitPidFdPid);
+}
+
+/* Like master with AckExitStatus keeps zombie until dead state is saved */
+void TContainer::PidFdExit(int status) {
+    TFile pidfd;
+    pid_t pid;
+
+    if (WaitSource)
+        EpollLoop->RemoveSource(WaitSource->Fd);
+    WaitSource = nullptr;
+
+    /* Detach pidfd, otherwise ForgetPid reaps task before Save */
+    std::unique_lock<std::mutex> guard(TaskPidsMutex);
+    pidfd.SetFd = WaitPidFd.Fd;
+    WaitPidFd.SetFd = -1;
+    pid = WaitPidFdPid;
+    WaitPidFdPid = 0;
+    guard.unlock();
+
+    Exit(status, false);
+
+    (void)PidFdReap(pidfd.Fd, status);
+
+    guard.lock();
+    PidFdPids.erase(pid);
+}
+
 TError TContainer::PrepareOomMonitor() {
     TCgroup memoryCg = GetCgroup(MemorySubsystem);
     TError error;
@@ -2262,9 +2636,9 @@ TError TContainer::Terminate(uint64_t deadline) {
 void TContainer::ForgetPid() {
     Task.Pid = 0;
     TaskVPid = 0;
-    WaitTask.Pid = 0;
+    SetTaskPid(WaitTask, 0);
     ClearProp(EProperty::ROOT_PID);
-    SeizeTask.Pid = 0;
+    SetTaskPid(SeizeTask, 0);
     ClearProp(EProperty::SEIZE_PID);
 }
 
@@ -2420,7 +2794,7 @@ TError TContainer::Pause() {
         if (ct->State == EContainerState::Running ||
                 ct->State == EContainerState::Meta) {
             ct->SetState(EContainerState::Paused);
-            error = ct->Save();
+            error = ct->Save(false);
             if (error)
                 L_ERR("Cannot save state after pause: {}", error);
         }
@@ -2450,7 +2824,7 @@ TError TContainer::Resume() {
             FreezerSubsystem.Thaw(cg, false);
         if (ct->State == EContainerState::Paused)
             ct->SetState(IsMeta() ? EContainerState::Meta : EContainerState::Running);
-        error = ct->Save();
+        error = ct->Save(false);
         if (error)
             L_ERR("Cannot save state after resume: {}", error);
     }
@@ -2522,6 +2896,31 @@ TError TContainer::GetProperty(const std::string &origProperty, std::string &val
     return error;
 }
 
+TError TContainer::GetTypedProperty(const std::string &property, TTypedValue &value) const {
+    auto it = ContainerProperties.find(property);
+    if (it == ContainerProperties.end() || !it->second->IsSupported)
+        return TError(EError::NotSupported, "No typed value: " + property);
+    auto prop = it->second;
+
+    CT = const_cast<TContainer *>(this);
+    TError error = prop->GetUint(value.UintValue);
+    if (!error) {
+        value.Type = TTypedValue::Uint;
+    } else if (error.GetError() == EError::NotSupported) {
+        error = prop->GetDouble(value.DoubleValue);
+        if (!error) {
+            value.Type = TTypedValue::Double;
+        } else if (error.GetError() == EError::NotSupported) {
+            error = prop->GetUintMap(value.MapValue);
+            if (!error)
+                value.Type = TTypedValue::UintMap;
+        }
+    }
+    CT = nullptr;
+
+    return error;
+}
+
 TError TContainer::SetProperty(const std::string &origProperty,
                                const std::string &origValue) {
     if (IsRoot())
@@ -2569,12 +2968,77 @@ TError TContainer::SetProperty(const std::string &origProperty,
     CT = nullptr;
 
     if (!error)
-        error = Save();
+        error = Save(false);
+
+    if (!error) {
+        Touch();
+        TContainerSubscriber::Notify(*this, EContainerEvent::Property, origProperty);
+    }
+
+    return error;
+}
+
+TError TContainer::SavePropertyState(const std::string &origProperty,
+                                     TPropertyState &state) {
+    std::string property = origProperty;
+    std::string idx;
+    TError error;
+
+    ParsePropertyName(property, idx);
+
+    auto it = ContainerProperties.find(property);
+    if (it == ContainerProperties.end())
+        return TError(EError::InvalidProperty, "Invalid property " + property);
+    auto prop = it->second;
+
+    state.Name = origProperty;
+    state.Prop = prop->Prop;
+
+    /* Not serializable, best we could do is to set old value back */
+    if (state.Prop == EProperty::NONE) {
+        state.Set = true;
+        return GetProperty(origProperty, state.Value);
+    }
+
+    state.Name = property;
+    state.Set = HasProp(state.Prop);
+
+    CT = this;
+    error = prop->GetToSave(state.Value);
+    CT = nullptr;
+
+    return error;
+}
+
+TError TContainer::RevertProperty(const TPropertyState &state) {
+    if (state.Prop == EProperty::NONE)
+        return SetProperty(state.Name, state.Value);
+
+    auto prop = ContainerProperties.at(state.Name);
+    TError error;
+
+    CT = this;
+    error = prop->SetFromRestore(state.Value);
+    if (!error && !state.Set)
+        ClearProp(state.Prop);
+    if (!error && (State == EContainerState::Running ||
+                   State == EContainerState::Meta ||
+                   State == EContainerState::Paused))
+        error = ApplyDynamicProperties();
+    CT = nullptr;
+
+    if (!error)
+        error = Save(false);
+
+    if (!error) {
+        Touch();
+        TContainerSubscriber::Notify(*this, EContainerEvent::Property, state.Name);
+    }
 
     return error;
 }
 
-TError TContainer::RestoreNetwork() {
+TError TContainer::RestoreNetwork(bool adopt) {
     TNamespaceFd netns;
     TError error;
 
@@ -2582,6 +3046,10 @@ TError TContainer::RestoreNetwork() {
     if (error)
         return error;
 
+    /* Siblings are restored concurrently and might share netns */
+    static std::mutex restoreMutex;
+    std::unique_lock<std::mutex> lock(restoreMutex);
+
     Net = TNetwork::GetNetwork(netns.GetInode());
 
     /* Create a new one */
@@ -2596,8 +3064,14 @@ TError TContainer::RestoreNetwork() {
         TNetwork::AddNetwork(netns.GetInode(), Net);
     }
 
+    lock.unlock();
+
     ChooseTrafficClasses();
 
+    /* Classes are left by previous slave, checked in VerifyAdopted */
+    if (adopt)
+        return TError::Success();
+
     error = UpdateTrafficClasses();
     if (error)
         return error;
@@ -2605,13 +3079,21 @@ TError TContainer::RestoreNetwork() {
     return TError::Success();
 }
 
-TError TContainer::Save(void) {
-    TKeyValue node(ContainersKV / std::to_string(Id));
+TError TContainer::Save(bool wait) {
+    if (DeferSave) {
+        SavePending = true;
+        return TError::Success();
+    }
+
+    if (!Storage)
+        Storage = std::make_shared<TKeyValue>(ContainersKV / std::to_string(Id));
+
+    std::map<std::string, std::string> data;
     TError error;
 
     /* These are not properties */
-    node.Set(P_RAW_ID, std::to_string(Id));
-    node.Set(P_RAW_NAME, Name);
+    data[P_RAW_ID] = std::to_string(Id);
+    data[P_RAW_NAME] = Name;
 
     CT = this;
 
@@ -2626,7 +3108,7 @@ TError TContainer::Save(void) {
         if (error)
             break;
 
-        node.Set(knob.first, value);
+        data[knob.first] = value;
     }
 
     CT = nullptr;
@@ -2634,7 +3116,15 @@ TError TContainer::Save(void) {
     if (error)
         return error;
 
-    return node.Save();
+    uint64_t ticket = KvCommitter.Queue(Storage, std::move(data));
+
+    /* Client waits after releasing container lock */
+    if (!wait && CL) {
+        CL->Commits.emplace_back(Storage, ticket);
+        return TError::Success();
+    }
+
+    return KvCommitter.Wait(Storage, ticket);
 }
 
 TError TContainer::Load(const TKeyValue &node) {
@@ -2724,7 +3214,7 @@ TError TContainer::Seize() {
             while(!kill(SeizeTask.Pid, SIGKILL))
                 usleep(100000);
         }
-        SeizeTask.Pid = 0;
+        SetTaskPid(SeizeTask, 0);
     }
 
     auto pidStr = std::to_string(WaitTask.Pid);
@@ -2750,6 +3240,7 @@ TError TContainer::Seize() {
         return error;
 
     if (SeizeTask.Pid) {
+        SetTaskPid(SeizeTask, SeizeTask.Pid);
         SetProp(EProperty::SEIZE_PID);
         return TError::Success();
     }
@@ -2909,6 +3400,7 @@ bool TContainer::RecvOomEvents() {
         OomEvents += val;
         Statistics->ContainersOOM += val;
         L_EVT("OOM in {}", Name);
+        TContainerSubscriber::Notify(*this, EContainerEvent::Oom);
         return true;
     }
 
@@ -2917,7 +3409,20 @@ bool TContainer::RecvOomEvents() {
 
 void TContainer::ScheduleRespawn() {
     TEvent e(EEventType::Respawn, shared_from_this());
-    EventQueue->Add(config().container().respawn_delay_ms(), e);
+    EventQueue->Cancel(RespawnTimer.exchange(
+                EventQueue->Add(config().container().respawn_delay_ms(), e)));
+}
+
+void TContainer::ScheduleAging() {
+    uint64_t now = GetCurrentTimeMs(), due = DeathTime + AgingTime;
+    TEvent e(EEventType::DestroyAgedContainer, shared_from_this());
+    EventQueue->Cancel(AgingTimer.exchange(
+                EventQueue->Add(due > now ? due - now : 0, e)));
+}
+
+void TContainer::CancelTimers() {
+    EventQueue->Cancel(RespawnTimer.exchange(0));
+    EventQueue->Cancel(AgingTimer.exchange(0));
 }
 
 TError TContainer::Respawn() {
@@ -2930,6 +3435,8 @@ TError TContainer::Respawn() {
     RespawnCount++;
     SetProp(EProperty::RESPAWN_COUNT);
 
+    TContainerSubscriber::Notify(*this, EContainerEvent::Respawn);
+
     // FIXME
     CL->LockedContainer = shared_from_this();
     error = Start();
@@ -2945,6 +3452,24 @@ void TContainer::Event(const TEvent &event) {
     auto ct = event.Container.lock();
 
     switch (event.Type) {
+    case EEventType::TaskExit:
+    {
+        if (ct) {
+            error = ct->Lock(lock);
+            lock.unlock();
+            if (!error) {
+                int status;
+
+                /* Tasks started by previous slave are reaped by master */
+                if (ct->WaitPidFd.Fd >= 0 && PidFdPeek(ct->WaitPidFd.Fd, status)) {
+                    Statistics->PidfdExits++;
+                    ct->PidFdExit(status);
+                }
+                ct->Unlock();
+            }
+        }
+        break;
+    }
     case EEventType::OOM:
     {
         if (ct) {
@@ -2975,29 +3500,25 @@ void TContainer::Event(const TEvent &event) {
     case EEventType::ChildExit:
     {
         bool delivered = false;
-        for (auto &it: Containers) {
-            auto ct = it.second;
-            if (ct->WaitTask.Pid != event.Exit.Pid &&
-                    ct->SeizeTask.Pid != event.Exit.Pid)
-                continue;
-            error = ct->Lock(lock);
+        auto task_ct = FindTaskPid(event.Exit.Pid);
+        if (task_ct) {
+            error = task_ct->Lock(lock);
             lock.unlock();
             if (!error) {
-                if (ct->WaitTask.Pid == event.Exit.Pid ||
-                        ct->SeizeTask.Pid == event.Exit.Pid) {
-                    ct->Exit(event.Exit.Status, false);
+                if (task_ct->WaitTask.Pid == event.Exit.Pid ||
+                        task_ct->SeizeTask.Pid == event.Exit.Pid) {
+                    task_ct->Exit(event.Exit.Status, false);
                     delivered = true;
                 }
-                ct->Unlock();
+                task_ct->Unlock();
             }
-            break;
         }
         if (event.Type == EEventType::Exit)
             AckExitStatus(event.Exit.Pid);
         else {
             if (!delivered)
                 L("Unknown zombie {} {}", event.Exit.Pid, event.Exit.Status);
-            (void)waitpid(event.Exit.Pid, NULL, 0);
+            (void)waitpid(event.Exit.Pid, NULL, WNOHANG);
         }
         break;
     }
@@ -3014,10 +3535,14 @@ void TContainer::Event(const TEvent &event) {
             error = ct->Lock(lock);
             lock.unlock();
             if (!error) {
-                if (ct->State == EContainerState::Dead &&
-                        GetCurrentTimeMs() >= ct->DeathTime + ct->AgingTime) {
-                    Statistics->RemoveDead++;
-                    ct->Destroy();
+                if (ct->State == EContainerState::Dead) {
+                    if (GetCurrentTimeMs() >= ct->DeathTime + ct->AgingTime) {
+                        Statistics->RemoveDead++;
+                        ct->Destroy();
+                    } else {
+                        /* fired before due time, nothing else is armed */
+                        ct->ScheduleAging();
+                    }
                 }
                 ct->Unlock();
             }
@@ -3039,11 +3564,6 @@ void TContainer::Event(const TEvent &event) {
     case EEventType::RotateLogs:
         lock.unlock();
         for (auto &ct: RootContainer->Subtree()) {
-            if (ct->State == EContainerState::Dead &&
-                    GetCurrentTimeMs() >= ct->DeathTime + ct->AgingTime) {
-                TEvent ev(EEventType::DestroyAgedContainer, ct);
-                EventQueue->Add(0, ev);
-            }
             if (ct->State == EContainerState::Running) {
                 ct->Stdout.Rotate(*ct);
                 ct->Stderr.Rotate(*ct);
@@ -3055,7 +3575,8 @@ void TContainer::Event(const TEvent &event) {
     case EEventType::NetworkWatchdog:
         lock.unlock();
         TNetwork::RefreshNetworks();
-        EventQueue->Add(config().network().watchdog_ms(), event);
+        if (config().network().watchdog_ms())
+            EventQueue->Add(config().network().watchdog_ms(), event);
         break;
 
     }
@@ -3155,6 +3676,12 @@ TContainerWaiter::TContainerWaiter(std::shared_ptr<TClient> client,
     Client(client), Callback(callback) {
 }
 
+TContainerWaiter::~TContainerWaiter() {
+    uint64_t timer = Timer;
+    if (timer && timer != TimerWoken && EventQueue)
+        EventQueue->Cancel(timer);
+}
+
 void TContainerWaiter::WakeupWaiter(const TContainer *who, bool wildcard) {
     std::shared_ptr<TClient> client = Client.lock();
     if (client) {
@@ -3166,7 +3693,13 @@ void TContainerWaiter::WakeupWaiter(const TContainer *who, bool wildcard) {
             return;
         Callback(client, err, name);
         Client.reset();
-        client->Waiter = nullptr;
+        /* timer set later is cancelled by its setter */
+        uint64_t timer = Timer.exchange(TimerWoken);
+        if (timer)
+            EventQueue->Cancel(timer);
+        client->Waiters.remove_if([this](const std::shared_ptr<TContainerWaiter> &w) {
+            return w.get() == this;
+        });
     }
 }
 
@@ -3202,3 +3735,121 @@ bool TContainerWaiter::MatchWildcard(const std::string &name) {
             return true;
     return false;
 }
+
+std::mutex TContainerSubscriber::ListLock;
+std::list<std::weak_ptr<TContainerSubscriber>> TContainerSubscriber::Subscribers;
+uint64_t TContainerSubscriber::Sequence = 0;
+
+TContainerSubscriber::TContainerSubscriber(std::shared_ptr<TClient> client,
+                                           const std::vector<std::string> &wildcards,
+                                           bool hasId, uint64_t requestId) :
+    Client(client), Wildcards(wildcards), HasId(hasId), RequestId(requestId) {
+}
+
+void TContainerSubscriber::Add(std::shared_ptr<TContainerSubscriber> subscriber,
+                               std::function<void(uint64_t)> reply) {
+    std::lock_guard<std::mutex> lock(ListLock);
+
+    for (auto iter = Subscribers.begin(); iter != Subscribers.end();) {
+        if (iter->expired())
+            iter = Subscribers.erase(iter);
+        else
+            iter++;
+    }
+
+    /* reply goes before any event */
+    reply(Sequence);
+    Subscribers.push_back(subscriber);
+}
+
+void TContainerSubscriber::Notify(const TContainer &ct, EContainerEvent type,
+                                  const std::string &property) {
+    std::vector<std::shared_ptr<TContainerSubscriber>> queued;
+    std::unique_lock<std::mutex> lock(ListLock);
+
+    if (Subscribers.empty())
+        return;
+
+    /* events are queued in order of sequence */
+    uint64_t seq = ++Sequence;
+
+    for (auto iter = Subscribers.begin(); iter != Subscribers.end();) {
+        auto subscriber = iter->lock();
+        if (!subscriber) {
+            iter = Subscribers.erase(iter);
+            continue;
+        }
+        if (subscriber->Push(ct, seq, type, property))
+            queued.push_back(subscriber);
+        iter++;
+    }
+
+    lock.unlock();
+
+    /* sending is serialized by subscriber lock, not by global one */
+    for (auto &subscriber: queued)
+        subscriber->Flush();
+}
+
+bool TContainerSubscriber::Push(const TContainer &ct, uint64_t seq,
+                                EContainerEvent type, const std::string &property) {
+    auto client = Client.lock();
+    std::string name;
+
+    if (!client || client->ComposeName(ct.Name, name))
+        return false;
+
+    bool match = false;
+    for (auto &wildcard: Wildcards)
+        match = match || StringMatch(name, wildcard);
+    if (!match)
+        return false;
+
+    std::lock_guard<std::mutex> lock(Mutex);
+
+    /* keep freshest, client has to resync after overflow anyway */
+    if (Pending.size() >= std::max(config().daemon().subscribe_buffer(), 1u)) {
+        LostSeq = Pending.front().Seq;
+        Pending.pop_front();
+        Lost++;
+    }
+
+    Pending.push_back({seq, type, name, TContainer::StateName(ct.State), property});
+    return true;
+}
+
+void TContainerSubscriber::Flush() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    auto client = Client.lock();
+
+    if (!client || (Pending.empty() && !Lost) || !client->OutputIdle())
+        return;
+
+    rpc::TContainerResponse rsp;
+    rsp.set_error(EError::Success);
+    if (HasId)
+        rsp.set_request_id(RequestId);
+
+    if (Lost) {
+        auto event = rsp.add_event();
+        event->set_seq(LostSeq);
+        event->set_type(rpc::TContainerEvent::Overflow);
+        event->set_lost(Lost);
+        Lost = 0;
+    }
+
+    for (auto &record: Pending) {
+        auto event = rsp.add_event();
+        event->set_seq(record.Seq);
+        event->set_type((rpc::TContainerEvent::EType)record.Type);
+        event->set_name(record.Name);
+        event->set_state(record.State);
+        if (!record.Property.empty())
+            event->set_property(record.Property);
+    }
+    Pending.clear();
+
+    TError error = client->QueueResponse(rsp, false);
+    if (error)
+        L_WRN("Cannot send events to {} : {}", *client, error);
+}
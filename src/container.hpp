@@ -3,8 +3,11 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <atomic>
+#include <unordered_map>
 
 #include "util/unix.hpp"
 #include "util/locks.hpp"
@@ -26,6 +29,7 @@ class TClient;
 class TVolume;
 class TKeyValue;
 struct TBindMount;
+struct TContainerLockWaiter;
 
 struct TEnv;
 
@@ -50,6 +54,9 @@ enum class ECpuSetType {
 
 class TProperty;
 
+/* Global counter of changes, starts from start time in us to stay monotonic across restarts */
+extern std::atomic<uint64_t> ContainerGeneration;
+
 class TContainer : public std::enable_shared_from_this<TContainer>,
                    public TNonCopyable {
     friend class TProperty;
@@ -57,9 +64,18 @@ class TContainer : public std::enable_shared_from_this<TContainer>,
     int Locked = 0;
     int SubtreeRead = 0;
     int SubtreeWrite = 0;
-    bool PendingWrite = false;
+    int PendingWrite = 0;
     pid_t LastOwner = 0;
 
+    /* protected with ContainersMutex */
+    std::list<TContainerLockWaiter *> LockQueue;
+
+    TContainer *LockBlocker(bool for_read, bool upgrade = false);
+    void LockAcquire(bool for_read, pid_t tid);
+    TError LockWait(TScopedLock &lock, TContainer *blocker, bool for_read, bool upgrade);
+    void WakeLockQueue();
+    void WakeLockQueues();
+
     TFile OomEvent;
 
     /* protected with ContainersMutex */
@@ -67,6 +83,11 @@ class TContainer : public std::enable_shared_from_this<TContainer>,
 
     std::shared_ptr<TEpollSource> Source;
 
+    /* pidfd of WaitTask, reports exit without round trip via master */
+    TFile WaitPidFd;
+    pid_t WaitPidFdPid = 0;
+    std::shared_ptr<TEpollSource> WaitSource;
+
     // data
     TError UpdateSoftLimit();
     void SetState(EContainerState next);
@@ -75,9 +96,12 @@ class TContainer : public std::enable_shared_from_this<TContainer>,
     TError ApplySchedPolicy() const;
     TError ApplyDynamicProperties();
     TError PrepareWorkDir();
-    TError RestoreNetwork();
+    TError RestoreNetwork(bool adopt = false);
+    TError RestoreCgroups();
     TError PrepareOomMonitor();
     void ShutdownOom();
+    void WatchWaitTask();
+    void PidFdExit(int status);
     TError PrepareCgroups();
     TError ConfigureDevices(std::vector<TDevice> &devices);
     TError ParseNetConfig(struct TNetCfg &NetCfg);
@@ -88,6 +112,7 @@ class TContainer : public std::enable_shared_from_this<TContainer>,
     TError StartOne();
 
     void ScheduleRespawn();
+    void CancelTimers();
     TError Respawn();
     TError PrepareResources();
     void FreeRuntimeResources();
@@ -120,6 +145,9 @@ public:
 
     bool PropSet[(int)EProperty::NR_PROPERTIES];
     bool PropDirty[(int)EProperty::NR_PROPERTIES];
+
+    /* ContainerGeneration at last change of properties or state */
+    std::atomic<uint64_t> Generation{0};
     uint64_t Controllers, RequiredControllers;
     TCred OwnerCred;
     TCred TaskCred;
@@ -156,6 +184,12 @@ public:
     uint64_t DeathTime;
     uint64_t AgingTime;
 
+    /* Pending respawn and aging events, superseded ones are cancelled */
+    std::atomic<uint64_t> RespawnTimer{0};
+    std::atomic<uint64_t> AgingTimer{0};
+
+    void ScheduleAging();
+
     TStringMap Ulimit;
 
     std::string NsName;
@@ -208,8 +242,21 @@ public:
     EAccessLevel AccessLevel;
     std::atomic<int> ClientsCount;
     std::atomic<uint64_t> ContainerRequests;
+    std::atomic<uint64_t> LockWaits;
+    std::atomic<uint64_t> LockWaitTime;
 
     bool IsWeak = false;
+
+    /* Batch request saves container once after all steps */
+    bool DeferSave = false;
+    bool SavePending = false;
+
+    /* Last saved state, Save appends only changes */
+    std::shared_ptr<TKeyValue> Storage;
+
+    /* Restored from upgrade hand-off, kernel state is not checked yet */
+    std::atomic<bool> Adopted{false};
+
     bool OomIsFatal = true;
     int OomScoreAdj = 0;
     std::atomic<uint64_t> OomEvents;
@@ -227,6 +274,7 @@ public:
     pid_t TaskVPid;
     TTask WaitTask;
     TTask SeizeTask;
+    void SetTaskPid(TTask &task, pid_t pid);
     std::shared_ptr<TNetwork> Net;
 
     TPath GetCwd() const;
@@ -248,13 +296,22 @@ public:
     void SetProp(EProperty prop) {
         PropSet[(int)prop] = true;
         PropDirty[(int)prop] = true;
+        Touch();
     }
 
     void ClearProp(EProperty prop) {
         PropSet[(int)prop] = false;
         PropDirty[(int)prop] = true;
+        Touch();
+    }
+
+    void Touch() {
+        Generation = ++ContainerGeneration;
     }
 
+    /* Latest change of this container or ancestors, they are inherited */
+    uint64_t ChangeGeneration() const;
+
     bool TestPropDirty(EProperty prop) const {
         return PropDirty[(int)prop];
     }
@@ -308,14 +365,29 @@ public:
     TError Destroy();
 
     TError GetProperty(const std::string &property, std::string &value) const;
+    /* NotSupported for text properties, indexes and cgroup knobs */
+    TError GetTypedProperty(const std::string &property, TTypedValue &value) const;
     TError SetProperty(const std::string &property, const std::string &value);
 
+    /* Whole state of property before change, including "not set" */
+    struct TPropertyState {
+        std::string Name;
+        EProperty Prop;
+        bool Set;
+        std::string Value;
+    };
+
+    TError SavePropertyState(const std::string &property, TPropertyState &state);
+    TError RevertProperty(const TPropertyState &state);
+
     void ForgetPid();
     void SyncState();
     TError Seize();
     TError SyncCgroups();
+    TError VerifyAdopted();
 
-    TError Save(void);
+    /* Without wait client waits commit after request */
+    TError Save(bool wait = true);
     TError Load(const TKeyValue &node);
 
     TCgroup GetCgroup(const TSubsystem &subsystem) const;
@@ -345,9 +417,16 @@ public:
     static std::shared_ptr<TContainer> Find(const std::string &name);
     static TError Find(const std::string &name, std::shared_ptr<TContainer> &ct);
     static TError FindTaskContainer(pid_t pid, std::shared_ptr<TContainer> &ct);
+    static std::shared_ptr<TContainer> FindTaskPid(pid_t pid);
+    /* Exit of such task is reaped only via pidfd, not by SIGCHLD */
+    static bool PidFdWatched(pid_t pid);
 
-    static TError Create(const std::string &name, std::shared_ptr<TContainer> &ct);
-    static TError Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct);
+    /* With locked new container is returned locked by current client */
+    static TError Create(const std::string &name, std::shared_ptr<TContainer> &ct,
+                         bool locked = false);
+    /* Adopt trusts kernel state left by previous slave till VerifyAdopted */
+    static TError Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct,
+                          bool adopt = false);
 
     static void Event(const TEvent &event);
 };
@@ -365,13 +444,115 @@ public:
     static void WakeupWildcard(const TContainer *who);
     static void AddWildcard(std::shared_ptr<TContainerWaiter> &waiter);
 
+    ~TContainerWaiter();
+
+    /* wait timeout event, set after waiter is published */
+    static constexpr uint64_t TimerWoken = UINT64_MAX;
+    std::atomic<uint64_t> Timer{0};
     std::vector<std::string> Wildcards;
     bool MatchWildcard(const std::string &name);
 };
 
+/* Same values as in rpc::TContainerEvent::EType */
+enum class EContainerEvent {
+    Create = 1,
+    Start = 2,
+    Death = 3,
+    Oom = 4,
+    Respawn = 5,
+    Destroy = 6,
+    Property = 7,
+    State = 8,
+    Overflow = 9,
+};
+
+/* Change feed: long-lived stream of container events for one client */
+class TContainerSubscriber {
+private:
+    static std::mutex ListLock;
+    static std::list<std::weak_ptr<TContainerSubscriber>> Subscribers;
+    static uint64_t Sequence;
+
+    struct TRecord {
+        uint64_t Seq;
+        EContainerEvent Type;
+        std::string Name;
+        std::string State;
+        std::string Property;
+    };
+
+    std::mutex Mutex;
+    std::weak_ptr<TClient> Client;
+    std::vector<std::string> Wildcards;
+    std::deque<TRecord> Pending;
+    uint64_t Lost = 0;
+    uint64_t LostSeq = 0;
+    bool HasId;
+    uint64_t RequestId;
+
+    /* Queues event if it matches, returns true if queued */
+    bool Push(const TContainer &ct, uint64_t seq, EContainerEvent type,
+              const std::string &property);
+public:
+    TContainerSubscriber(std::shared_ptr<TClient> client,
+                         const std::vector<std::string> &wildcards,
+                         bool hasId, uint64_t requestId);
+
+    /* Sends reply with current sequence and starts streaming */
+    static void Add(std::shared_ptr<TContainerSubscriber> subscriber,
+                    std::function<void(uint64_t)> reply);
+    static void Notify(const TContainer &ct, EContainerEvent type,
+                       const std::string &property = "");
+
+    /* Sends pending events when client has no other output */
+    void Flush();
+};
+
+/* Name index of all containers, hash-sharded to keep lookups off ContainersMutex */
+class TContainerRegistry : public TNonCopyable {
+    static constexpr int NR_SHARDS = 64;
+
+    struct TShard {
+        std::mutex Mutex;
+        std::unordered_map<std::string, std::shared_ptr<TContainer>> Map;
+        uint64_t Locks = 0;
+        uint64_t Contended = 0;
+
+        std::unique_lock<std::mutex> Lock();
+    } Shards[NR_SHARDS];
+
+    std::atomic<size_t> Count;
+
+    TShard &GetShard(const std::string &name) {
+        return Shards[std::hash<std::string>()(name) % NR_SHARDS];
+    }
+
+public:
+    TContainerRegistry() : Count(0) {}
+
+    /* modified only with ContainersMutex */
+    void Insert(std::shared_ptr<TContainer> ct);
+    void Erase(const std::string &name);
+
+    std::shared_ptr<TContainer> Find(const std::string &name);
+    bool Exists(const std::string &name) {
+        return Find(name) != nullptr;
+    }
+    size_t Size() const {
+        return Count;
+    }
+
+    /* snapshot in no particular order */
+    std::vector<std::shared_ptr<TContainer>> List();
+    /* sorted by name: parents go before children */
+    std::vector<std::shared_ptr<TContainer>> ListSorted();
+
+    void DumpContention();
+};
+
 extern std::mutex ContainersMutex;
 extern std::shared_ptr<TContainer> RootContainer;
-extern std::map<std::string, std::shared_ptr<TContainer>> Containers;
+extern TContainerRegistry Containers;
 extern TPath ContainersKV;
 extern TIdMap ContainerIdMap;
 
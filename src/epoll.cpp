@@ -17,13 +17,7 @@ static TError EpollCreate(int &epfd) {
 }
 
 TError TEpollLoop::Create() {
-    TError error = EpollCreate(EpollFd);
-    if (error)
-        return error;
-
-    Statistics->EpollSources = 0;
-
-    return TError::Success();
+    return EpollCreate(EpollFd);
 }
 
 void TEpollLoop::Destroy() {
@@ -118,6 +112,11 @@ TError TEpollLoop::StartOutput(int fd) const {
     return ModifySourceEvents(fd, EPOLLOUT);
 }
 
+TError TEpollLoop::SetEvents(int fd, bool input, bool output) const {
+    return ModifySourceEvents(fd, (input ? (uint32_t)EPOLLIN : 0u) |
+                                  (output ? (uint32_t)EPOLLOUT : 0u));
+}
+
 std::shared_ptr<TEpollSource> TEpollLoop::GetSource(int fd) {
     auto lock = ScopedLock();
 
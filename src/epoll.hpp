@@ -7,6 +7,7 @@
 #include "util/locks.hpp"
 
 constexpr int EPOLL_EVENT_OOM = 1;
+constexpr int EPOLL_EVENT_PIDFD = 2;
 
 class TContainer;
 class TEpollLoop;
@@ -45,6 +46,7 @@ public:
     TError StartInput(int fd) const;
     TError StopInput(int fd) const;
     TError StartOutput(int fd) const;
+    TError SetEvents(int fd, bool input, bool output) const;
 
     TError GetEvents(std::vector<struct epoll_event> &evts, int timeout);
 };
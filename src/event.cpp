@@ -1,51 +1,96 @@
+#include <condition_variable>
+#include <thread>
+
 #include "config.hpp"
 #include "statistics.hpp"
 #include "event.hpp"
 #include "util/log.hpp"
 #include "util/unix.hpp"
-#include "util/worker.hpp"
+#include "util/timerwheel.hpp"
 #include "container.hpp"
 #include "client.hpp"
 
-class TEventWorker : public TWorker<TEvent, std::priority_queue<TEvent>> {
+/* Lane is a thread with own timer wheel, events of one container share lane */
+class TEventWorker : public TNonCopyable {
+    std::mutex Mutex;
+    std::condition_variable Cv;
+    TTimerWheel<TEvent> Wheel;
+    std::thread Thread;
+    bool Valid = true;
+    const size_t Lane;
+
+    void Run() {
+        TClient client("<event>");
+        TEvent event(EEventType::RotateLogs);
+        uint64_t due;
+
+        std::unique_lock<std::mutex> lock(Mutex);
+        while (Valid) {
+            uint64_t now = GetCurrentTimeMs();
+
+            Wheel.Advance(now);
+
+            if (Wheel.Pop(event, due)) {
+                Statistics->QueuedEvents--;
+                Statistics->EventLagMs = now - due;
+                lock.unlock();
+
+                client.ClientContainer = RootContainer;
+                client.StartRequest();
+                TContainer::Event(event);
+                client.FinishRequest();
+
+                lock.lock();
+                continue;
+            }
+
+            uint64_t next = Wheel.NextTick();
+            if (next != UINT64_MAX) {
+                if (!Lane)
+                    Statistics->SlaveTimeoutMs = next - now;
+                Cv.wait_for(lock, std::chrono::milliseconds(next - now));
+            } else {
+                if (!Lane)
+                    Statistics->SlaveTimeoutMs = 0;
+                Cv.wait(lock);
+            }
+        }
+    }
+
 public:
-    TEventWorker(const size_t nr) : TWorker("portod-event", nr), client("<event>") {}
+    TEventWorker(size_t lane) : Wheel(GetCurrentTimeMs()), Lane(lane) { }
 
-    TClient client;
+    void Start() {
+        Thread = std::thread([this] {
+            SetProcessName("portod-event" + std::to_string(Lane));
+            Run();
+        });
+    }
+
+    void Stop() {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Valid = false;
+        Cv.notify_all();
+        lock.unlock();
 
-    const TEvent &Top() override {
-        return Queue.top();
+        if (Thread.joinable())
+            Thread.join();
     }
 
-    void Wait(TScopedLock &lock) override {
-        if (!Valid)
-            return;
-
-        Statistics->QueuedEvents = Queue.size();
-
-        if (Queue.size()) {
-            auto now = GetCurrentTimeMs();
-            if (Top().DueMs <= now)
-                return;
-            auto timeout = Top().DueMs - now;
-            Statistics->SlaveTimeoutMs = timeout;
-            Cv.wait_for(lock, std::chrono::milliseconds(timeout));
-        } else {
-            Statistics->SlaveTimeoutMs = 0;
-            TWorker::Wait(lock);
-        }
+    uint64_t Add(uint64_t dueMs, const TEvent &event) {
+        std::unique_lock<std::mutex> lock(Mutex);
+        uint64_t id = Wheel.Add(dueMs, event);
+        Statistics->QueuedEvents++;
+        Cv.notify_one();
+        return id;
     }
 
-    bool Handle(const TEvent &event) override {
-        if (event.DueMs <= GetCurrentTimeMs()) {
-            client.ClientContainer = RootContainer;
-            client.StartRequest();
-            TContainer::Event(event);
-            client.FinishRequest();
-            return true;
+    void Cancel(uint64_t id) {
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (Wheel.Cancel(id)) {
+            Statistics->QueuedEvents--;
+            Statistics->CancelledEvents++;
         }
-
-        return false;
     }
 };
 
@@ -57,6 +102,8 @@ std::string TEvent::GetMsg() const {
         case EEventType::Exit:
             return "exit status " + std::to_string(Exit.Status)
                 + " for pid " + std::to_string(Exit.Pid);
+        case EEventType::TaskExit:
+            return "task exit";
         case EEventType::RotateLogs:
             return "rotate logs";
         case EEventType::NetworkWatchdog:
@@ -76,24 +123,44 @@ std::string TEvent::GetMsg() const {
     }
 }
 
-bool TEvent::operator<(const TEvent& rhs) const {
-    return DueMs >= rhs.DueMs;
+/* Lane zero is for global events, containers are spread by id */
+size_t TEventQueue::Lane(const TEvent &e) const {
+    auto ct = e.Container.lock();
+
+    if (!ct && (e.Type == EEventType::Exit || e.Type == EEventType::ChildExit))
+        ct = TContainer::FindTaskPid(e.Exit.Pid);
+
+    if (!ct || Workers.size() == 1)
+        return 0;
+
+    return 1 + ct->Id % (Workers.size() - 1);
+}
+
+/* Handle encodes lane and timer id in it */
+uint64_t TEventQueue::Add(uint64_t timeoutMs, const TEvent &e) {
+    size_t lane = Lane(e);
+    uint64_t id = Workers[lane]->Add(GetCurrentTimeMs() + timeoutMs, e);
+    return id * Workers.size() + lane;
 }
 
-void TEventQueue::Add(uint64_t timeoutMs, const TEvent &e) {
-    TEvent copy = e;
-    copy.DueMs = GetCurrentTimeMs() + timeoutMs;
-    Worker->Push(copy);
+void TEventQueue::Cancel(uint64_t handle) {
+    if (handle)
+        Workers[handle % Workers.size()]->Cancel(handle / Workers.size());
 }
 
 TEventQueue::TEventQueue() {
-    Worker = std::make_shared<TEventWorker>(config().daemon().event_workers());
+    size_t lanes = 1 + config().daemon().event_workers();
+
+    for (size_t lane = 0; lane < lanes; lane++)
+        Workers.push_back(std::make_shared<TEventWorker>(lane));
 }
 
 void TEventQueue::Start() {
-    Worker->Start();
+    for (auto &worker: Workers)
+        worker->Start();
 }
 
 void TEventQueue::Stop() {
-    Worker->Stop();
+    for (auto &worker: Workers)
+        worker->Stop();
 }
@@ -2,8 +2,8 @@
 
 #include <string>
 #include <memory>
-
-#include "util/worker.hpp"
+#include <vector>
+#include <cstdint>
 
 class TContainer;
 class TContainerWaiter;
@@ -11,6 +11,7 @@ class TContainerWaiter;
 enum class EEventType {
     Exit,
     ChildExit,
+    TaskExit,
     RotateLogs,
     NetworkWatchdog,
     Respawn,
@@ -36,23 +37,25 @@ public:
         std::weak_ptr<TContainerWaiter> Waiter;
     } WaitTimeout;
 
-    uint64_t DueMs = 0;
-
     TEvent(EEventType type, std::shared_ptr<TContainer> container = nullptr) :
         Type(type), Container(container) {}
 
-    bool operator<(const TEvent& rhs) const;
-
     std::string GetMsg() const;
 };
 
 class TEventQueue {
-    std::shared_ptr<TEventWorker> Worker;
+    std::vector<std::shared_ptr<TEventWorker>> Workers;
+
+    size_t Lane(const TEvent &e) const;
 
 public:
     TEventQueue();
     void Start();
     void Stop();
 
-    void Add(uint64_t timeoutMs, const TEvent &e);
+    /* Returns handle for Cancel, never zero */
+    uint64_t Add(uint64_t timeoutMs, const TEvent &e);
+
+    /* Drops pending event, fired events and zero handle are ignored */
+    void Cancel(uint64_t handle);
 };
@@ -1,12 +1,62 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
 #include "kvalue.hpp"
 #include "config.hpp"
 #include "kv.pb.h"
 #include "protobuf.hpp"
+#include "statistics.hpp"
 #include "util/log.hpp"
+#include "util/unix.hpp"
+#include "util/crc32.hpp"
 
 extern "C" {
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+}
+
+static constexpr const char *STORE_NAME = ".store";
+static constexpr uint32_t STORE_MAGIC = 0x5653564b; /* "KVSV" */
+
+static std::mutex StoresMutex;
+static std::map<std::string, std::shared_ptr<TKeyValueStore>> Stores;
+
+static TError SerializeNode(const kv::TNode &node, std::string &buf) {
+    uint32_t len = node.ByteSize();
+    size_t lenLen = google::protobuf::io::CodedOutputStream::VarintSize32(len);
+
+    if (len + lenLen > config().keyvalue_limit())
+        return TError(EError::Unknown, "KeyValue: object too big");
+
+    buf.resize(len + lenLen);
+
+    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(len, (uint8_t *)&buf[0]);
+    if (!node.SerializeToArray((uint8_t *)&buf[lenLen], len))
+        return TError(EError::Unknown, "KeyValue: cannot serialize");
+
+    return TError::Success();
+}
+
+static TError WriteNodeFile(const TPath &path, const std::string &buf) {
+    TPath tmpPath(path.ToString() + ".tmp");
+    TError error;
+
+    error = tmpPath.Mkfile(0640);
+    if (!error)
+        error = tmpPath.Chown(RootUser, PortoGroup);
+    if (!error)
+        error = tmpPath.WriteAll(buf);
+    if (!error)
+        error = tmpPath.Rename(path);
+
+    if (error)
+        (void)tmpPath.Unlink();
+
+    return error;
 }
 
 TError TKeyValue::Load() {
@@ -14,18 +64,27 @@ TError TKeyValue::Load() {
     kv::TNode node;
     TError error;
 
-    error = Path.ReadAll(buf, config().keyvalue_limit());
+    if (Store)
+        error = Store->Read(Path.BaseName(), buf);
+    else
+        error = Path.ReadAll(buf, config().keyvalue_limit());
     if (error)
         return error;
 
     ssize_t size = buf.size();
     google::protobuf::io::CodedInputStream input((uint8_t *)&buf[0], size);
+    bool torn = false;
 
     while (size) {
         uint32_t len;
 
-        if (!input.ReadVarint32(&len))
-            return TError(EError::Unknown, "KeyValue: corrupted storage");
+        /* Append interrupted by crash, keys are consistent without it */
+        if (!input.ReadVarint32(&len) ||
+                len + google::protobuf::io::CodedOutputStream::VarintSize32(len) > (size_t)size) {
+            L_WRN("KeyValue: {} ends with incomplete record, ignored", Path);
+            torn = true;
+            break;
+        }
 
         size -= google::protobuf::io::CodedOutputStream::VarintSize32(len);
         size -= len;
@@ -42,6 +101,10 @@ TError TKeyValue::Load() {
             Data[pair.key()] = pair.val();
     }
 
+    Stored = Data;
+    StoredSize = torn ? 0 : buf.size();
+    SnapshotSize = buf.size();
+
     return TError::Success();
 }
 
@@ -50,37 +113,83 @@ TError TKeyValue::Save() {
     kv::TNode node;
     TError error;
 
+    if (!StoredSize)
+        return Compact();
+
+    for (const auto &pair: Stored) {
+        if (!Data.count(pair.first))
+            return Compact();
+    }
+
     for (const auto &pair: Data) {
+        auto it = Stored.find(pair.first);
+        if (it != Stored.end() && it->second == pair.second)
+            continue;
         auto kv = node.add_pairs();
         kv->set_key(pair.first);
         kv->set_val(pair.second);
     }
 
-    uint32_t len = node.ByteSize();
-    size_t lenLen = google::protobuf::io::CodedOutputStream::VarintSize32(len);
+    if (!node.pairs_size())
+        return TError::Success();
 
-    if (len + lenLen > config().keyvalue_limit())
-        return TError(EError::Unknown, "KeyValue: object too big");
+    /* Store is a log itself */
+    if (Store)
+        return Compact();
 
-    buf.resize(len + lenLen);
+    error = SerializeNode(node, buf);
+    if (error)
+        return error;
 
-    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(len, (uint8_t *)&buf[0]);
-    if (!node.SerializeToArray((uint8_t *)&buf[lenLen], len))
-        return TError(EError::Unknown, "KeyValue: cannot serialize");
+    if (StoredSize + buf.size() > std::min(std::max(SnapshotSize * 2, (size_t)4096),
+                                           (size_t)config().keyvalue_limit()))
+        return Compact();
 
-    TPath tmpPath(Path.ToString() + ".tmp");
-    error = tmpPath.Mkfile(0640);
-    if (!error)
-        error = tmpPath.Chown(RootUser, PortoGroup);
-    if (!error)
-        error = tmpPath.WriteAll(buf);
-    if (!error)
-        error = tmpPath.Rename(Path);
+    TFile file;
+    error = file.OpenAppend(Path);
+    if (!error) {
+        error = file.WriteAll(buf);
+        if (error && ftruncate(file.Fd, StoredSize))
+            L_WRN("KeyValue: cannot truncate {}: {}", Path, TError(EError::Unknown, errno, "ftruncate"));
+    }
+    if (error) {
+        L_WRN("KeyValue: cannot append {}: {}", Path, error);
+        return Compact();
+    }
+
+    for (const auto &kv: node.pairs())
+        Stored[kv.key()] = kv.val();
+    StoredSize += buf.size();
 
+    return TError::Success();
+}
+
+TError TKeyValue::Compact() {
+    std::string buf;
+    kv::TNode node;
+    TError error;
+
+    for (const auto &pair: Data) {
+        auto kv = node.add_pairs();
+        kv->set_key(pair.first);
+        kv->set_val(pair.second);
+    }
+
+    error = SerializeNode(node, buf);
     if (error)
-        (void)tmpPath.Unlink();
+        return error;
 
-    return error;
+    if (Store)
+        error = Store->Write(Path.BaseName(), buf);
+    else
+        error = WriteNodeFile(Path, buf);
+    if (error)
+        return error;
+
+    Stored = Data;
+    StoredSize = SnapshotSize = buf.size();
+
+    return TError::Success();
 }
 
 TError TKeyValue::Mount(const TPath &root) {
@@ -110,22 +219,92 @@ TError TKeyValue::Mount(const TPath &root) {
 
     std::vector<std::string> names;
     error = root.ReadDirectory(names);
-    if (!error) {
+    if (error)
+        return error;
+
+    for (auto &name : names) {
+        if (StringEndsWith(name, ".tmp"))
+            (void)(root / name).Unlink();
+    }
+
+    auto store = std::make_shared<TKeyValueStore>(root / STORE_NAME);
+    bool useStore = config().keyvalue_backend() == "log";
+
+    if (!useStore && !store->Path.Exists())
+        return TError::Success();
+
+    error = store->Open(useStore ? config().keyvalue_size() / 2 : 0);
+    if (error)
+        return error;
+
+    if (useStore) {
+        /* Migrate from file per node, file is removed after copy */
         for (auto &name : names) {
-            if (StringEndsWith(name, ".tmp"))
-                (void)(root / name).Unlink();
+            std::string buf;
+
+            if (name[0] == '.' || StringEndsWith(name, ".tmp"))
+                continue;
+
+            error = (root / name).ReadAll(buf, config().keyvalue_limit());
+            if (!error)
+                error = store->Write(name, buf);
+            if (error)
+                return error;
+
+            (void)(root / name).Unlink();
         }
+
+        auto lock = std::unique_lock<std::mutex>(StoresMutex);
+        Stores[root.ToString()] = store;
+    } else {
+        /* Migrate back, store is removed when all nodes are copied */
+        for (auto &name : store->List()) {
+            std::string buf;
+
+            error = store->Read(name, buf);
+            if (!error)
+                error = WriteNodeFile(root / name, buf);
+            if (error)
+                return error;
+        }
+
+        store = nullptr;
+        error = (root / STORE_NAME).Unlink();
     }
 
     return error;
 }
 
+std::shared_ptr<TKeyValueStore> TKeyValue::FindStore(const TPath &root) {
+    auto lock = std::unique_lock<std::mutex>(StoresMutex);
+    auto it = Stores.find(root.ToString());
+    return it == Stores.end() ? nullptr : it->second;
+}
+
+void TKeyValue::CloseStores() {
+    auto lock = std::unique_lock<std::mutex>(StoresMutex);
+    Stores.clear();
+}
+
+TError TKeyValue::Remove() const {
+    if (Store)
+        return Store->Remove(Path.BaseName());
+    return Path.Unlink();
+}
+
 TError TKeyValue::ListAll(const TPath &root, std::list<TKeyValue> &nodes) {
+    auto store = FindStore(root);
+    if (store) {
+        for (auto &name: store->List())
+            nodes.emplace_back(root / name);
+        return TError::Success();
+    }
+
     std::vector<std::string> names;
     TError error = root.ReadDirectory(names);
     if (!error) {
         for (auto &name : names) {
-            if (!StringEndsWith(name, ".tmp"))
+            if (name[0] != '.' && !StringEndsWith(name, ".tmp"))
                 nodes.emplace_back(root / name);
         }
     }
@@ -136,10 +315,23 @@ void TKeyValue::DumpAll(const TPath &root) {
     std::vector<std::string> names;
     TError error;
 
-    error = root.ReadDirectory(names);
-    if (error) {
-        L("ERROR {}", error);
-        return;
+    /* Running portod might append, open store read-only */
+    auto store = std::make_shared<TKeyValueStore>(root / STORE_NAME);
+    if (store->Path.Exists()) {
+        error = store->Open(0, true);
+        if (error) {
+            L("ERROR {}", error);
+            return;
+        }
+        names = store->List();
+        auto lock = std::unique_lock<std::mutex>(StoresMutex);
+        Stores[root.ToString()] = store;
+    } else {
+        error = root.ReadDirectory(names);
+        if (error) {
+            L("ERROR {}", error);
+            return;
+        }
     }
 
     for (auto &name : names) {
@@ -160,3 +352,376 @@ void TKeyValue::DumpAll(const TPath &root) {
             L("{} = {} ", kv.first, kv.second);
     }
 }
+
+TKeyValueStore::~TKeyValueStore() {
+    Close();
+}
+
+void TKeyValueStore::Close() {
+    if (Data)
+        munmap(Data, Capacity);
+    Data = nullptr;
+    if (Fd >= 0)
+        close(Fd);
+    Fd = -1;
+    Index.clear();
+    Tail = Garbage = 0;
+}
+
+size_t TKeyValueStore::RecordSize(const TRecord *rec) {
+    size_t size = sizeof(TRecord) + rec->NameSize + rec->DataSize;
+    return (size + 7) & ~(size_t)7;
+}
+
+TError TKeyValueStore::Open(size_t capacity, bool readOnly) {
+    struct stat st;
+
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    Close();
+    ReadOnly = readOnly;
+
+    Fd = open(Path.c_str(), (readOnly ? O_RDONLY : O_RDWR | O_CREAT) | O_CLOEXEC | O_NOCTTY, 0640);
+    if (Fd < 0)
+        return TError(EError::Unknown, errno, "open " + Path.ToString());
+
+    if (fstat(Fd, &st))
+        return TError(EError::Unknown, errno, "fstat " + Path.ToString());
+
+    Capacity = std::max((size_t)st.st_size, capacity) & ~(size_t)7;
+    if (Capacity < sizeof(TRecord))
+        return TError(EError::Unknown, "KeyValue: store " + Path.ToString() + " is too small");
+
+    if (!readOnly) {
+        if (fchown(Fd, RootUser, PortoGroup))
+            return TError(EError::Unknown, errno, "fchown " + Path.ToString());
+        if ((size_t)st.st_size < Capacity && ftruncate(Fd, Capacity))
+            return TError(EError::Unknown, errno, "ftruncate " + Path.ToString());
+    }
+
+    void *data = mmap(nullptr, Capacity, readOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+                      MAP_SHARED, Fd, 0);
+    if (data == MAP_FAILED)
+        return TError(EError::Unknown, errno, "mmap " + Path.ToString());
+    Data = (char *)data;
+
+    size_t off = 0;
+    while (off + sizeof(TRecord) <= Capacity) {
+        auto rec = (const TRecord *)(Data + off);
+
+        if (__atomic_load_n(&rec->Magic, __ATOMIC_ACQUIRE) != STORE_MAGIC)
+            break;
+
+        size_t size = RecordSize(rec);
+        if (rec->NameSize == 0 || size > Capacity - off ||
+                Crc32((const char *)&rec->NameSize,
+                      8 + rec->NameSize + rec->DataSize) != rec->Crc) {
+            L_WRN("KeyValue: store {} has broken record at {}, rest is ignored", Path, off);
+            break;
+        }
+
+        std::string name(Data + off + sizeof(TRecord), rec->NameSize);
+        auto it = Index.find(name);
+        if (it != Index.end())
+            Garbage += RecordSize((const TRecord *)(Data + it->second));
+
+        if (rec->DataSize) {
+            Index[name] = off;
+        } else {
+            if (it != Index.end())
+                Index.erase(it);
+            Garbage += size;
+        }
+
+        off += size;
+    }
+
+    Tail = off;
+
+    /* Appends expect zeroes after tail */
+    if (!readOnly && Tail < Capacity &&
+            fallocate(Fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, Tail, Capacity - Tail))
+        memset(Data + Tail, 0, Capacity - Tail);
+
+    return TError::Success();
+}
+
+TError TKeyValueStore::Read(const std::string &name, std::string &data) {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    auto it = Index.find(name);
+    if (it == Index.end())
+        return TError(EError::Unknown, ENOENT, "KeyValue: " + name + " not found in " + Path.ToString());
+
+    auto rec = (const TRecord *)(Data + it->second);
+    data.assign(Data + it->second + sizeof(TRecord) + rec->NameSize, rec->DataSize);
+    return TError::Success();
+}
+
+std::vector<std::string> TKeyValueStore::List() {
+    std::unique_lock<std::mutex> lock(Mutex);
+    std::vector<std::string> names;
+
+    for (auto &it: Index)
+        names.push_back(it.first);
+
+    return names;
+}
+
+TError TKeyValueStore::Write(const std::string &name, const std::string &data) {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    if (data.empty())
+        return TError(EError::Unknown, "KeyValue: empty node " + name);
+
+    return Append(name, data);
+}
+
+TError TKeyValueStore::Remove(const std::string &name) {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    if (!Index.count(name))
+        return TError(EError::Unknown, ENOENT, "KeyValue: " + name + " not found in " + Path.ToString());
+
+    return Append(name, "");
+}
+
+TError TKeyValueStore::Compact() {
+    std::unique_lock<std::mutex> lock(Mutex);
+    return CompactLocked();
+}
+
+TError TKeyValueStore::Append(const std::string &name, const std::string &data) {
+    TRecord hdr;
+    TError error;
+
+    if (ReadOnly)
+        return TError(EError::Unknown, "KeyValue: store " + Path.ToString() + " is read-only");
+
+    hdr.Magic = 0;
+    hdr.NameSize = name.size();
+    hdr.DataSize = data.size();
+    size_t size = RecordSize(&hdr);
+
+    if (Tail + size > Capacity) {
+        error = CompactLocked();
+        if (error)
+            return error;
+        if (Tail + size > Capacity)
+            return TError(EError::ResourceNotAvailable, "KeyValue: store " + Path.ToString() + " is full");
+    }
+
+    char *rec = Data + Tail;
+    memcpy(rec + offsetof(TRecord, NameSize), &hdr.NameSize, 8);
+    memcpy(rec + sizeof(TRecord), name.data(), name.size());
+    memcpy(rec + sizeof(TRecord) + name.size(), data.data(), data.size());
+    hdr.Crc = Crc32(rec + offsetof(TRecord, NameSize), 8 + name.size() + data.size());
+    memcpy(rec + offsetof(TRecord, Crc), &hdr.Crc, 4);
+    __atomic_store_n((uint32_t *)rec, STORE_MAGIC, __ATOMIC_RELEASE);
+
+    auto it = Index.find(name);
+    if (it != Index.end())
+        Garbage += RecordSize((const TRecord *)(Data + it->second));
+
+    if (data.size()) {
+        Index[name] = Tail;
+    } else {
+        Index.erase(name);
+        Garbage += size;
+    }
+
+    Tail += size;
+
+    if (Garbage > Tail / 2 && Tail > Capacity / 4) {
+        error = CompactLocked();
+        if (error)
+            L_WRN("KeyValue: cannot compact {}: {}", Path, error);
+    }
+
+    return TError::Success();
+}
+
+/* Live records are copied into new file which replaces this one */
+TError TKeyValueStore::CompactLocked() {
+    TPath tmpPath(Path.ToString() + ".tmp");
+    TError error;
+
+    if (!Garbage)
+        return TError::Success();
+
+    int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOCTTY, 0640);
+    if (fd < 0)
+        return TError(EError::Unknown, errno, "open " + tmpPath.ToString());
+
+    if (fchown(fd, RootUser, PortoGroup) || ftruncate(fd, Capacity)) {
+        error = TError(EError::Unknown, errno, "ftruncate " + tmpPath.ToString());
+        close(fd);
+        (void)tmpPath.Unlink();
+        return error;
+    }
+
+    void *data = mmap(nullptr, Capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        error = TError(EError::Unknown, errno, "mmap " + tmpPath.ToString());
+        close(fd);
+        (void)tmpPath.Unlink();
+        return error;
+    }
+
+    /* Keep order of records, it is order of saves */
+    std::vector<size_t> offsets;
+    for (auto &it: Index)
+        offsets.push_back(it.second);
+    std::sort(offsets.begin(), offsets.end());
+
+    std::unordered_map<std::string, size_t> index;
+    size_t tail = 0;
+
+    for (auto off: offsets) {
+        auto rec = (const TRecord *)(Data + off);
+        size_t size = RecordSize(rec);
+        memcpy((char *)data + tail, rec, size);
+        index[std::string(Data + off + sizeof(TRecord), rec->NameSize)] = tail;
+        tail += size;
+    }
+
+    error = tmpPath.Rename(Path);
+    if (error) {
+        munmap(data, Capacity);
+        close(fd);
+        (void)tmpPath.Unlink();
+        return error;
+    }
+
+    L_ACT("KeyValue: compact {} {} -> {} bytes", Path, Tail, tail);
+
+    munmap(Data, Capacity);
+    close(Fd);
+
+    Fd = fd;
+    Data = (char *)data;
+    Index = std::move(index);
+    Tail = tail;
+    Garbage = 0;
+
+    return TError::Success();
+}
+
+TKeyValueCommitter KvCommitter;
+
+void TKeyValueCommitter::Start(unsigned threads) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    Running = true;
+    Stopping = false;
+    for (unsigned i = 0; i < std::max(threads, 1u); i++)
+        Lanes.emplace_back(new TLane());
+    for (auto &lane: Lanes)
+        lane->Thread = std::thread(&TKeyValueCommitter::Run, this, lane.get());
+}
+
+void TKeyValueCommitter::Stop() {
+    std::unique_lock<std::mutex> lock(Mutex);
+    if (!Running)
+        return;
+    Stopping = true;
+    for (auto &lane: Lanes)
+        lane->Wakeup.notify_one();
+    lock.unlock();
+    for (auto &lane: Lanes)
+        lane->Thread.join();
+    lock.lock();
+    Lanes.clear();
+    Running = false;
+}
+
+uint64_t TKeyValueCommitter::Queue(std::shared_ptr<TKeyValue> node,
+                                   std::map<std::string, std::string> &&data) {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    /* previous contents will never be written */
+    if (node->QueuedTicket > node->WriteTicket)
+        Statistics->KvCoalesced++;
+
+    node->Queued = std::move(data);
+    node->QueuedTicket = ++Tickets;
+    Statistics->KvSaves++;
+
+    /* threads drain only what was queued before stop */
+    if (!Running || Stopping) {
+        Write(node, lock);
+    } else {
+        auto &lane = Lane(*node);
+        if (lane.Pending.emplace(node.get(), node).second)
+            lane.Wakeup.notify_one();
+    }
+
+    return node->QueuedTicket;
+}
+
+TError TKeyValueCommitter::Wait(std::shared_ptr<TKeyValue> node, uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    while (node->CommittedTicket < ticket)
+        Committed.wait(lock);
+    return node->CommitError;
+}
+
+void TKeyValueCommitter::Cancel(std::shared_ptr<TKeyValue> node) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    if (!Lanes.empty())
+        Lane(*node).Pending.erase(node.get());
+    while (node->Writing)
+        Committed.wait(lock);
+    node->WriteTicket = node->QueuedTicket;
+    node->CommittedTicket = node->QueuedTicket;
+    node->CommitError = TError::Success();
+    Committed.notify_all();
+}
+
+/* Writes latest queued contents, lock is released during write */
+void TKeyValueCommitter::Write(std::shared_ptr<TKeyValue> node,
+                               std::unique_lock<std::mutex> &lock) {
+    /* inline write and thread could meet at the same node */
+    while (node->Writing)
+        Committed.wait(lock);
+
+    /* written by other one, or cancelled */
+    if (node->CommittedTicket >= node->QueuedTicket)
+        return;
+
+    uint64_t ticket = node->QueuedTicket;
+    node->WriteTicket = ticket;
+    node->Data = std::move(node->Queued);
+    node->Queued.clear();
+    node->Writing = true;
+
+    lock.unlock();
+    TError error = node->Save();
+    lock.lock();
+
+    node->Writing = false;
+    Statistics->KvWrites++;
+    node->CommittedTicket = ticket;
+    node->CommitError = error;
+    Committed.notify_all();
+}
+
+void TKeyValueCommitter::Run(TLane *lane) {
+    SetProcessName("portod-kv");
+
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    while (true) {
+        while (!Stopping && lane->Pending.empty())
+            lane->Wakeup.wait(lock);
+
+        if (lane->Pending.empty())
+            break;
+
+        auto batch = std::move(lane->Pending);
+        lane->Pending.clear();
+        Statistics->KvBatches++;
+
+        for (auto &it: batch)
+            Write(it.second, lock);
+    }
+}
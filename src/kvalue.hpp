@@ -3,16 +3,42 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include "common.hpp"
 #include "util/path.hpp"
 
+class TKeyValueStore;
+
 class TKeyValue {
 public:
     const TPath Path;
+    const std::shared_ptr<TKeyValueStore> Store;    /* null for file backend */
     std::string Name;
     std::map<std::string, std::string> Data;
 
-    TKeyValue(const TPath &path) : Path(path) { }
+    /*
+     * Storage is a journal of records, each one overrides keys of previous.
+     * Save appends changed keys while journal is smaller than twice
+     * of last full snapshot, removal of keys or overflow rewrites it.
+     */
+    std::map<std::string, std::string> Stored;
+    size_t StoredSize = 0;      /* zero if storage must be rewritten */
+    size_t SnapshotSize = 0;
+
+    /* Guarded by committer */
+    std::map<std::string, std::string> Queued;
+    uint64_t QueuedTicket = 0;
+    uint64_t WriteTicket = 0;       /* contents taken by writer */
+    uint64_t CommittedTicket = 0;
+    TError CommitError;
+    bool Writing = false;
+
+    TKeyValue(const TPath &path) : Path(path), Store(FindStore(path.DirName())) { }
 
     friend bool operator<(const TKeyValue &lhs, const TKeyValue &rhs) {
         return lhs.Name < rhs.Name;
@@ -37,8 +63,102 @@ public:
 
     TError Load();
     TError Save();
+    TError Compact();
+    TError Remove() const;
+
+    static std::shared_ptr<TKeyValueStore> FindStore(const TPath &root);
+    static void CloseStores();
 
     static TError Mount(const TPath &root);
     static TError ListAll(const TPath &root, std::list<TKeyValue> &nodes);
     static void DumpAll(const TPath &root);
 };
+
+/*
+ * Log-structured storage for all nodes of directory in one mmap'ed file.
+ * Record is header, name and node contents, last record of name wins,
+ * record without contents removes node. Magic is written last, so record
+ * torn by crash is zero or fails checksum and ends the log. File is
+ * rewritten when more than half of it is garbage or when it is full.
+ */
+class TKeyValueStore : public TNonCopyable {
+public:
+    const TPath Path;
+
+    TKeyValueStore(const TPath &path) : Path(path) { }
+    ~TKeyValueStore();
+
+    /* Zero capacity keeps size of existing file */
+    TError Open(size_t capacity, bool readOnly = false);
+
+    TError Read(const std::string &name, std::string &data);
+    TError Write(const std::string &name, const std::string &data);
+    TError Remove(const std::string &name);
+    std::vector<std::string> List();
+    TError Compact();
+
+private:
+    struct TRecord {
+        uint32_t Magic;
+        uint32_t Crc;       /* of sizes, name and data */
+        uint32_t NameSize;
+        uint32_t DataSize;
+    };
+
+    std::mutex Mutex;
+    int Fd = -1;
+    char *Data = nullptr;
+    size_t Capacity = 0;
+    size_t Tail = 0;
+    size_t Garbage = 0;
+    bool ReadOnly = false;
+    std::unordered_map<std::string, size_t> Index;  /* name -> record offset */
+
+    static size_t RecordSize(const TRecord *rec);
+    TError Append(const std::string &name, const std::string &data);
+    TError CompactLocked();
+    void Close();
+};
+
+/*
+ * Group commit: Queue keeps only latest contents of each node, background
+ * threads write queued nodes in batches, Wait blocks till write of ticket.
+ * Node always goes to the same thread, nodes in different threads are
+ * written in parallel. Without running threads nodes are written right
+ * in Queue. Lock is never held during file I/O.
+ */
+class TKeyValueCommitter : public TNonCopyable {
+public:
+    void Start(unsigned threads);
+    void Stop();
+
+    uint64_t Queue(std::shared_ptr<TKeyValue> node,
+                   std::map<std::string, std::string> &&data);
+    TError Wait(std::shared_ptr<TKeyValue> node, uint64_t ticket);
+
+    /* Drops queued write and waits for current one */
+    void Cancel(std::shared_ptr<TKeyValue> node);
+
+private:
+    struct TLane {
+        std::condition_variable Wakeup;
+        std::map<TKeyValue *, std::shared_ptr<TKeyValue>> Pending;
+        std::thread Thread;
+    };
+
+    std::mutex Mutex;
+    std::condition_variable Committed;
+    std::vector<std::unique_ptr<TLane>> Lanes;
+    uint64_t Tickets = 0;
+    bool Running = false;
+    bool Stopping = false;
+
+    TLane &Lane(const TKeyValue &node) {
+        return *Lanes[std::hash<std::string>()(node.Path.ToString()) % Lanes.size()];
+    }
+
+    void Write(std::shared_ptr<TKeyValue> node, std::unique_lock<std::mutex> &lock);
+    void Run(TLane *lane);
+};
+
+extern TKeyValueCommitter KvCommitter;
@@ -705,8 +705,7 @@ TError TNetwork::RefreshClasses() {
     if (error)
         L_ERR("Cannot refresh tc for / : {}", error);
 
-    for (auto &it: Containers) {
-        auto ct = it.second.get();
+    for (auto &ct: Containers.ListSorted()) {
         if (ct->Net.get() == this && !ct->IsRoot() &&
             (ct->State == EContainerState::Running ||
              ct->State == EContainerState::Meta)) {
@@ -1742,8 +1741,7 @@ TError TNetCfg::PrepareNetwork() {
             L3lan.size() && L3lan[0].Addrs.size()) {
         auto lock = LockContainers();
 
-        for (auto &it: Containers) {
-            auto &ct = it.second;
+        for (auto &ct: Containers.List()) {
             if (!ct->Net || ct->IpList.empty())
                 continue;
 
@@ -1266,6 +1266,64 @@ public:
     }
 };
 
+class TStatCmd final : public ICmd {
+public:
+    TStatCmd(Porto::Connection *api) : ICmd(api, "stat", 0, "",
+             "show rpc latency per method: p50/p99 of queue, lock wait, execution and send [us]") {}
+
+    int Execute(TCommandEnviroment *env) final override {
+        std::string value;
+        TUintMap stat;
+
+        int ret = Api->GetData("/", "porto_stat", value);
+        if (ret) {
+            PrintError("Can't get porto_stat");
+            return ret;
+        }
+
+        TError error = StringToUintMap(value, stat);
+        if (error) {
+            std::cerr << "Can't parse porto_stat: " << error << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        const std::vector<std::string> phases = { "queue", "lock", "exec", "send" };
+        const int w = 16;
+
+        std::cout << std::left << std::setw(24) << "method" << std::right
+                  << std::setw(10) << "count";
+        for (auto &phase: phases)
+            std::cout << std::setw(w) << phase;
+        std::cout << std::endl;
+
+        for (auto &it: stat) {
+            const std::string &key = it.first;
+            const std::string suffix = "_count";
+
+            if (!StringStartsWith(key, "rpc_") || key.size() <= 4 + suffix.size() ||
+                    key.compare(key.size() - suffix.size(), suffix.size(), suffix))
+                continue;
+
+            std::string prefix = key.substr(0, key.size() - suffix.size() + 1);
+            std::cout << std::left << std::setw(24) << prefix.substr(4, prefix.size() - 5)
+                      << std::right << std::setw(10) << it.second;
+
+            for (auto &phase: phases) {
+                auto p50 = stat.find(prefix + phase + "_p50_us");
+                auto p99 = stat.find(prefix + phase + "_p99_us");
+                if (p50 == stat.end() || p99 == stat.end())
+                    std::cout << std::setw(w) << "-";
+                else
+                    std::cout << std::setw(w) << (std::to_string(p50->second) + "/" +
+                                                  std::to_string(p99->second));
+            }
+            std::cout << std::endl;
+        }
+
+        return EXIT_SUCCESS;
+    }
+};
+
 class TListCmd final : public ICmd {
 public:
     TListCmd(Porto::Connection *api) : ICmd(api, "list", 0,
@@ -2365,6 +2423,7 @@ int main(int argc, char *argv[]) {
     handler.RegisterCommand<TGcCmd>();
     handler.RegisterCommand<TFindCmd>();
     handler.RegisterCommand<TWaitCmd>();
+    handler.RegisterCommand<TStatCmd>();
 
     handler.RegisterCommand<TCreateVolumeCmd>();
     handler.RegisterCommand<TLinkVolumeCmd>();
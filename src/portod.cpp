@@ -3,6 +3,11 @@
 #include <algorithm>
 #include <csignal>
 #include <iostream>
+#include <thread>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 
 #include "version.hpp"
 #include "statistics.hpp"
@@ -27,18 +32,21 @@
 #include "property.hpp"
 #include "portod.hpp"
 #include "libporto.hpp"
+#include "kv.pb.h"
 
 extern "C" {
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/un.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <grp.h>
 #define GNU_SOURCE
 #include <sys/socket.h>
@@ -60,7 +68,15 @@ static bool respawnSlave = true;
 static bool slaveMode = false;
 static bool discardState = false;
 
+/* Upgrade hand-off: memfd with state and idle client connections */
+static int handoffSock = -1;
+static std::vector<int> handoffFds;
+static kv::THandoff handoffState;
+static bool handedOff = false;
+
 static void FatalError(const std::string &text, TError &error) {
+    /* flush queued messages and write this one synchronously */
+    TLogger::StopAsync();
     L_ERR("{}: {}", text, error);
     _exit(EXIT_FAILURE);
 }
@@ -75,6 +91,11 @@ static void AllocStatistics() {
 static void DaemonOpenLog(bool master) {
     TLogger::CloseLog();
     TLogger::OpenLog(stdlog, master ? PORTO_MASTER_LOG : PORTO_SLAVE_LOG, 0644);
+
+    /* workers of slave should not wait for log writes */
+    if (!master)
+        TLogger::StartAsync(config().daemon().log_buffer(),
+                            config().daemon().log_overflow_block());
 }
 
 static void DaemonPrepare(bool master) {
@@ -101,6 +122,7 @@ static void DaemonPrepare(bool master) {
 }
 
 static void DaemonShutdown(bool master, int code) {
+    TLogger::StopAsync();
     L_SYS("Stopped {}", code);
 
     TLogger::CloseLog();
@@ -124,6 +146,7 @@ static void DaemonShutdown(bool master, int code) {
 struct TRequest {
     std::shared_ptr<TClient> Client;
     rpc::TContainerRequest Request;
+    uint64_t QueuedUs;
 };
 
 class TRpcWorker : public TWorker<TRequest> {
@@ -135,10 +158,22 @@ public:
     }
 
     bool Handle(const TRequest &request) override {
-        HandleRpcRequest(request.Request, request.Client);
+        auto &client = request.Client;
+        int method = RpcMethod(request.Request);
+        uint64_t start = GetCurrentTimeUs();
+
+        client->RequestMethod = method;
+        HandleRpcRequest(request.Request, client);
         Statistics->RequestsCompleted++;
         Statistics->RequestsQueued--;
 
+        uint64_t lockWait = client->LockWaitUs;
+        uint64_t exec = GetCurrentTimeUs() - start;
+        Statistics->Rpc[method].Count.fetch_add(1, std::memory_order_relaxed);
+        RecordRpcPhase(method, RPC_PHASE_QUEUE, start - request.QueuedUs);
+        RecordRpcPhase(method, RPC_PHASE_LOCK, lockWait);
+        RecordRpcPhase(method, RPC_PHASE_EXEC, exec - std::min(exec, lockWait));
+
         auto time = request.Client->RequestTimeMs;
         if (time > 1000)
             Statistics->RequestsLonger1s++;
@@ -149,6 +184,14 @@ public:
         if (time > 300000)
             Statistics->RequestsLonger5m++;
 
+        /* continue with next pipelined request from this client */
+        TRequest next {request.Client, {}, GetCurrentTimeUs()};
+        if (request.Client->NextRequest(next.Request)) {
+            request.Client->ClientContainer->ContainerRequests++;
+            Statistics->RequestsQueued++;
+            Push(next);
+        }
+
         return true;
     }
 };
@@ -247,19 +290,23 @@ static int ForwardCore(pid_t pid, pid_t tid, pid_t vpid, pid_t vtid, int sig) {
         {"CORE_CONTAINER", origin},
     };
 
-    if (conn.CreateWeakContainer(core) ||
-            conn.SetProperty(core, P_ISOLATE, "false") ||
-            conn.SetProperty(core, P_STDIN_PATH, "/dev/fd/0") ||
-            conn.SetProperty(core, P_STDOUT_PATH, "/dev/null") ||
-            conn.SetProperty(core, P_STDERR_PATH, "/dev/null") ||
-            conn.SetProperty(core, P_COMMAND, core_command) ||
-            conn.SetProperty(core, P_USER, user) ||
-            conn.SetProperty(core, P_GROUP, group) ||
-            conn.SetProperty(core, P_OWNER_USER, owner_user) ||
-            conn.SetProperty(core, P_OWNER_GROUP, owner_group) ||
-            conn.SetProperty(core, P_CWD, cwd) ||
-            conn.SetProperty(core, P_ENV, MergeEscapeStrings(env, '=', ';')) ||
-            conn.Start(core))
+    std::vector<Porto::BatchStep> steps = {
+        { Porto::BatchStep::CreateWeak },
+        { Porto::BatchStep::SetProperty, P_ISOLATE, "false" },
+        { Porto::BatchStep::SetProperty, P_STDIN_PATH, "/dev/fd/0" },
+        { Porto::BatchStep::SetProperty, P_STDOUT_PATH, "/dev/null" },
+        { Porto::BatchStep::SetProperty, P_STDERR_PATH, "/dev/null" },
+        { Porto::BatchStep::SetProperty, P_COMMAND, core_command },
+        { Porto::BatchStep::SetProperty, P_USER, user },
+        { Porto::BatchStep::SetProperty, P_GROUP, group },
+        { Porto::BatchStep::SetProperty, P_OWNER_USER, owner_user },
+        { Porto::BatchStep::SetProperty, P_OWNER_GROUP, owner_group },
+        { Porto::BatchStep::SetProperty, P_CWD, cwd },
+        { Porto::BatchStep::SetProperty, P_ENV, MergeEscapeStrings(env, '=', ';') },
+        { Porto::BatchStep::Start },
+    };
+
+    if (conn.Batch(core, steps))
         return EXIT_FAILURE;
 
     std::string result;
@@ -395,25 +442,181 @@ retry:
     return 0;
 }
 
-static std::map<int, std::shared_ptr<TClient>> Clients;
+/*
+ * Client connections are spread across several reactor threads, each with
+ * its own epoll loop and its own share of clients. The control loop only
+ * accepts connections and handles signals, OOM events and the master pipe.
+ */
+class TRpcReactor : public TNonCopyable {
+    TRpcWorker &Worker;
+    const int Index;
+    std::shared_ptr<TEpollSource> WakeSource;
+    std::thread Thread;
+
+    void Run();
+
+public:
+    std::shared_ptr<TEpollLoop> Loop;
+    std::map<int, std::shared_ptr<TClient>> Clients;
+    std::mutex Mutex;
+
+    TRpcReactor(TRpcWorker &worker, int index) : Worker(worker), Index(index) {}
+    ~TRpcReactor();
+
+    TError Start();
+    void Stop();
+
+    TError AddClient(std::shared_ptr<TClient> client);
+    void DropClient(std::shared_ptr<TClient> client);
+};
+
+static std::vector<std::unique_ptr<TRpcReactor>> Reactors;
+static size_t NextReactor = 0;
+
+TRpcReactor::~TRpcReactor() {
+    if (Loop)
+        Loop->Destroy();
+    if (WakeSource)
+        close(WakeSource->Fd);
+}
+
+TError TRpcReactor::Start() {
+    TError error;
+
+    Loop = std::make_shared<TEpollLoop>();
+    error = Loop->Create();
+    if (error)
+        return error;
+
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+        return TError(EError::Unknown, errno, "Cannot create eventfd");
+
+    WakeSource = std::make_shared<TEpollSource>(fd);
+    error = Loop->AddSource(WakeSource);
+    if (error)
+        return error;
+
+    Thread = std::thread(&TRpcReactor::Run, this);
+    return TError::Success();
+}
+
+void TRpcReactor::Stop() {
+    if (Thread.joinable()) {
+        uint64_t val = 1;
+        if (write(WakeSource->Fd, &val, sizeof(val)) != sizeof(val))
+            L_ERR("Cannot wake rpc reactor {}: {}", Index, strerror(errno));
+        Thread.join();
+    }
+}
+
+TError TRpcReactor::AddClient(std::shared_ptr<TClient> client) {
+    TError error;
+
+    client->Loop = Loop;
+
+    {
+        TScopedLock lock(Mutex);
+        Clients[client->Fd] = client;
+    }
+
+    error = Loop->AddSource(client);
+    if (error) {
+        client->Loop = nullptr;
+        TScopedLock lock(Mutex);
+        Clients.erase(client->Fd);
+    }
+
+    return error;
+}
+
+void TRpcReactor::DropClient(std::shared_ptr<TClient> client) {
+    {
+        TScopedLock lock(Mutex);
+        auto it = Clients.find(client->Fd);
+        if (it != Clients.end() && it->second == client)
+            Clients.erase(it);
+    }
+    client->CloseConnection();
+}
+
+void TRpcReactor::Run() {
+    std::vector<struct epoll_event> events;
+    TError error;
+
+    SetProcessName("portod-rpc" + std::to_string(Index));
+
+    while (true) {
+        error = Loop->GetEvents(events, -1);
+        if (error) {
+            L_ERR("rpc reactor {}: epoll error {}", Index, error);
+            Crash();
+        }
+
+        for (auto ev : events) {
+            if (ev.data.fd == WakeSource->Fd)
+                return;
+
+            std::shared_ptr<TClient> client;
+            {
+                TScopedLock lock(Mutex);
+                auto it = Clients.find(ev.data.fd);
+                if (it != Clients.end())
+                    client = it->second;
+            }
+
+            /* already dropped */
+            if (!client)
+                continue;
+
+            error = TError::Success();
+
+            if (ev.events & EPOLLIN) {
+                TRequest req {client, {}, 0};
+                error = client->ReadRequest(req.Request);
+                req.QueuedUs = GetCurrentTimeUs();
+
+                if (!error) {
+                    error = client->IdentifyClient(false);
+                    if (!error) {
+                        client->ClientContainer->ContainerRequests++;
+                        Statistics->RequestsQueued++;
+                        Worker.Push(req);
+                    }
+                }
+            }
+
+            if (ev.events & EPOLLOUT)
+                error = client->SendResponse(false);
+
+            if ((ev.events & EPOLLHUP) || (ev.events & EPOLLERR) ||
+                    (error && error.GetError() != EError::Queued))
+                DropClient(client);
+        }
+    }
+}
 
 static TError DropIdleClient(std::shared_ptr<TContainer> from = nullptr) {
     uint64_t idle = config().daemon().client_idle_timeout() * 1000;
     uint64_t now = GetCurrentTimeMs();
     std::shared_ptr<TClient> victim;
+    TRpcReactor *victimReactor = nullptr;
 
-    for (auto &it: Clients) {
-        auto &client = it.second;
+    for (auto &reactor: Reactors) {
+        TScopedLock lock(reactor->Mutex);
 
-        if (client->Processing)
-            continue;
+        for (auto &it: reactor->Clients) {
+            auto &client = it.second;
 
-        if (from && client->ClientContainer != from)
-            continue;
+            if (from && client->ClientContainer != from)
+                continue;
 
-        if (now - client->ActivityTimeMs > idle) {
-            victim = client;
-            idle = now - client->ActivityTimeMs;
+            uint64_t clientIdle = client->IdleTimeMs(now);
+            if (clientIdle > idle) {
+                victim = client;
+                victimReactor = reactor.get();
+                idle = clientIdle;
+            }
         }
     }
 
@@ -423,25 +626,12 @@ static TError DropIdleClient(std::shared_ptr<TContainer> from = nullptr) {
                       (from ? from->Name : "globally"));
 
     L("Drop client {} idle for {} ms", *victim, idle);
-    Clients.erase(victim->Fd);
-    victim->CloseConnection();
+    victimReactor->DropClient(victim);
     return TError::Success();
 }
 
-static TError AcceptConnection(int listenFd) {
-    struct sockaddr_un peer_addr;
-    socklen_t peer_addr_size;
+static TError AddConnection(int clientFd) {
     TError error;
-    int clientFd;
-
-    peer_addr_size = sizeof(struct sockaddr_un);
-    clientFd = accept4(listenFd, (struct sockaddr *) &peer_addr,
-                       &peer_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
-    if (clientFd < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            return TError::Success(); /* client already gone */
-        return TError(EError::Unknown, errno, "accept4()");
-    }
 
     auto client = std::make_shared<TClient>(clientFd);
     error = client->IdentifyClient(true);
@@ -463,18 +653,198 @@ static TError AcceptConnection(int listenFd) {
             return error;
     }
 
-    error = EpollLoop->AddSource(client);
-    if (error)
-        return error;
+    auto &reactor = Reactors[NextReactor++ % Reactors.size()];
+    return reactor->AddClient(client);
+}
+
+static TError AcceptConnection(int listenFd) {
+    struct sockaddr_un peer_addr;
+    socklen_t peer_addr_size;
+    int clientFd;
 
-    client->InEpoll = true; /* FIXME cleanup this crap */
-    Clients[client->Fd] = client;
+    peer_addr_size = sizeof(struct sockaddr_un);
+    clientFd = accept4(listenFd, (struct sockaddr *) &peer_addr,
+                       &peer_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (clientFd < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return TError::Success(); /* client already gone */
+        return TError(EError::Unknown, errno, "accept4()");
+    }
 
-    return TError::Success();
+    return AddConnection(clientFd);
+}
+
+/* Sends containers and volumes state and idle connections to master for the next slave */
+static void HandoffState() {
+    TUnixSocket sock(HANDOFF_FD);
+    kv::THandoff handoff;
+    size_t clients = 0;
+    TError error;
+    char request;
+    int fd = -1;
+
+    /* Master reads only when it asked for hand-off before SIGHUP */
+    if (recv(HANDOFF_FD, &request, 1, MSG_DONTWAIT) != 1)
+        return;
+
+    handoff.set_version(PORTO_VERSION);
+    handoff.set_revision(PORTO_REVISION);
+    handoff.set_backend(config().keyvalue_backend());
+
+    for (auto &ct: Containers.List()) {
+        if (ct->IsRoot() || !ct->Storage)
+            continue;
+        auto &kv = *ct->Storage;
+        auto node = handoff.add_containers();
+        node->set_name(kv.Path.BaseName());
+        for (auto &it: kv.Stored) {
+            auto pair = node->add_pairs();
+            pair->set_key(it.first);
+            pair->set_val(it.second);
+        }
+        node->set_stored_size(kv.StoredSize);
+        node->set_snapshot_size(kv.SnapshotSize);
+    }
+
+    auto volumes_lock = LockVolumes();
+    for (auto &it: Volumes) {
+        auto &volume = it.second;
+        if (!volume->IsReady || volume->IsDying)
+            continue;
+        TKeyValue kv(VolumesKV / volume->Id);
+        volume->SaveTo(kv);
+        auto node = handoff.add_volumes();
+        node->set_name(volume->Id);
+        for (auto &data: kv.Data) {
+            auto pair = node->add_pairs();
+            pair->set_key(data.first);
+            pair->set_val(data.second);
+        }
+    }
+    volumes_lock.unlock();
+
+#ifdef __NR_memfd_create
+    fd = syscall(__NR_memfd_create, "portod-handoff", 1 /* MFD_CLOEXEC */);
+#else
+    errno = ENOSYS;
+#endif
+    if (fd < 0) {
+        L_WRN("Cannot hand off state: {}", TError(EError::Unknown, errno, "memfd_create"));
+        return;
+    }
+
+    if (!handoff.SerializeToFileDescriptor(fd)) {
+        L_WRN("Cannot hand off state: cannot serialize");
+        close(fd);
+        return;
+    }
+
+    /* State is always the first descriptor */
+    error = sock.SendFd(fd);
+    close(fd);
+    if (error) {
+        L_WRN("Cannot hand off state: {}", error);
+        return;
+    }
+
+    for (auto &reactor: Reactors) {
+        for (auto &it: reactor->Clients) {
+            auto &client = it.second;
+            if (!client->CanHandoff())
+                continue;
+            error = sock.SendFd(client->Fd);
+            if (error) {
+                L_WRN("Cannot hand off client: {}", error);
+                goto out;
+            }
+            clients++;
+        }
+    }
+out:
+    L_SYS("Hand off {} containers, {} volumes and {} clients",
+          handoff.containers_size(), handoff.volumes_size(), clients);
+}
+
+/* Collects descriptors sent by exiting slave, they are inherited across exec */
+static void ReceiveHandoff() {
+    TUnixSocket sock(handoffSock);
+    uint64_t deadline = GetCurrentTimeMs() +
+                        config().daemon().portod_stop_timeout() * 1000;
+    struct pollfd pfd = { handoffSock, POLLIN, 0 };
+    int fd;
+
+    handoffSock = -1;
+
+    while (true) {
+        uint64_t now = GetCurrentTimeMs();
+        if (now >= deadline) {
+            L_WRN("Hand-off timed out");
+            break;
+        }
+        int ret = poll(&pfd, 1, deadline - now);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0 || sock.RecvFd(fd))
+            break;
+        handoffFds.push_back(fd);
+    }
+}
+
+/* Reads state passed by previous slave, connections are adopted later */
+static void ReadHandoff() {
+    int fd = handoffFds[0];
+
+    handoffFds.erase(handoffFds.begin());
+
+    if (lseek(fd, 0, SEEK_SET) || !handoffState.ParseFromFileDescriptor(fd)) {
+        L_WRN("Cannot read hand-off state, restore from keyvalue");
+        handoffState.Clear();
+    } else if (handoffState.backend() != config().keyvalue_backend()) {
+        L_WRN("Keyvalue backend changed, restore from keyvalue");
+        handoffState.Clear();
+    } else if (handoffState.version() != PORTO_VERSION ||
+               handoffState.revision() != PORTO_REVISION) {
+        /* Adopted containers skip knobs, logic of other build may differ */
+        L_WRN("Hand-off from version {} revision {}, restore from keyvalue",
+              handoffState.version(), handoffState.revision());
+        handoffState.Clear();
+    } else
+        handedOff = true;
+    close(fd);
+
+    L_SYS("Hand-off from {}: {} containers, {} volumes, {} clients",
+          handoffState.version(), handoffState.containers_size(),
+          handoffState.volumes_size(), handoffFds.size());
+}
+
+/* Checks containers adopted on hand-off against kernel, parents first */
+static void VerifyContainers(const std::atomic<bool> &stop) {
+    TClient client("<verify>");
+    uint64_t start = GetCurrentTimeMs();
+    size_t count = 0;
+
+    client.ClientContainer = RootContainer;
+
+    auto subtree = RootContainer->Subtree();
+    for (auto it = subtree.rbegin(); it != subtree.rend() && !stop; ++it) {
+        auto &ct = *it;
+        if (!ct->Adopted)
+            continue;
+        client.StartRequest();
+        /* lock verifies adopted container */
+        if (!client.LockContainer(ct))
+            count++;
+        client.ReleaseContainer();
+        client.FinishRequest();
+    }
+
+    L_SYS("Verified {} adopted containers in {} ms", count, GetCurrentTimeMs() - start);
 }
 
 static int SlaveRpc() {
     TRpcWorker worker(config().daemon().workers());
+    std::atomic<bool> verifyStop(false);
+    std::thread verifyThread;
     int ret = 0;
     TError error;
 
@@ -504,19 +874,49 @@ static int SlaveRpc() {
 
     std::vector<struct epoll_event> events;
 
+    KvCommitter.Start(config().daemon().kv_threads());
     worker.Start();
     EventQueue->Start();
 
+    for (uint32_t i = 0; i < std::max(config().daemon().rpc_reactors(), 1u); i++) {
+        Reactors.emplace_back(new TRpcReactor(worker, i));
+        error = Reactors.back()->Start();
+        if (error) {
+            L_ERR("Can't start rpc reactor: {}", error);
+            ret = EXIT_FAILURE;
+            goto exit;
+        }
+    }
+
     if (config().daemon().log_rotate_ms()) {
         TEvent ev(EEventType::RotateLogs);
         EventQueue->Add(config().daemon().log_rotate_ms(), ev);
     }
 
-    if (config().network().watchdog_ms()) {
+    Statistics->HandoffClients = 0;
+    for (auto fd: handoffFds) {
+        error = AddConnection(fd);
+        if (error)
+            L("Cannot adopt connection: {}", error);
+        else
+            Statistics->HandoffClients++;
+    }
+    handoffFds.clear();
+
+    if (Statistics->HandoffUnverified)
+        verifyThread = std::thread([&verifyStop] {
+            SetProcessName("portod-verify");
+            VerifyContainers(verifyStop);
+        });
+
+    /* First run refreshes networks deferred after restore */
+    {
         TEvent ev(EEventType::NetworkWatchdog);
-        EventQueue->Add(config().network().watchdog_ms(), ev);
+        EventQueue->Add(0, ev);
     }
 
+    Statistics->StartupTimeMs = GetCurrentTimeMs() - Statistics->SlaveStarted;
+
     while (true) {
         error = EpollLoop->GetEvents(events, -1);
         if (error) {
@@ -564,13 +964,19 @@ static int SlaveRpc() {
                         TContainer::DumpLocks();
                         break;
                     case SIGCHLD:
-                        if (!TTask::Deliver(sigInfo.ssi_pid, sigInfo.ssi_status)) {
+                    {
+                        int status = ChildExitStatus(sigInfo.ssi_code, sigInfo.ssi_status);
+
+                        /* wait tasks watched by pidfd are reaped in TaskExit */
+                        if (!TTask::Deliver(sigInfo.ssi_pid, status) &&
+                                !TContainer::PidFdWatched(sigInfo.ssi_pid)) {
                             TEvent e(EEventType::ChildExit);
                             e.Exit.Pid = sigInfo.ssi_pid;
-                            e.Exit.Status = sigInfo.ssi_status;
+                            e.Exit.Status = status;
                             EventQueue->Add(0, e);
                         }
                         break;
+                    }
                     default:
                         L_WRN("Unexpected signal: {}", sigInfo.ssi_signo);
                         break;
@@ -584,6 +990,15 @@ static int SlaveRpc() {
                 // from the clients (so clients see updated view of the
                 // world as soon as possible)
                 continue;
+            } else if (source->Flags & EPOLL_EVENT_PIDFD) {
+                auto container = source->Container.lock();
+
+                /* level triggered: status is taken once in event */
+                EpollLoop->StopInput(source->Fd);
+                if (container) {
+                    TEvent e(EEventType::TaskExit, container);
+                    EventQueue->Add(0, e);
+                }
             } else if (source->Flags & EPOLL_EVENT_OOM) {
                 auto container = source->Container.lock();
 
@@ -596,31 +1011,6 @@ static int SlaveRpc() {
                     EventQueue->Add(0, e);
                 }
 
-            } else if (Clients.find(source->Fd) != Clients.end()) {
-                auto client = Clients[source->Fd];
-
-                if (ev.events & EPOLLIN) {
-                    TRequest req {client};
-                    error = client->ReadRequest(req.Request);
-
-                    if (!error) {
-                        error = client->IdentifyClient(false);
-                        if (!error) {
-                            client->ClientContainer->ContainerRequests++;
-                            Statistics->RequestsQueued++;
-                            worker.Push(req);
-                        }
-                    }
-                }
-
-                if (ev.events & EPOLLOUT)
-                    error = client->SendResponse(false);
-
-                if ((ev.events & EPOLLHUP) || (ev.events & EPOLLERR) ||
-                        (error && error.GetError() != EError::Queued)) {
-                    Clients.erase(source->Fd);
-                    client->CloseConnection();
-                }
             } else {
                 L_WRN("Unknown event {}", source->Fd);
                 EpollLoop->RemoveSource(source->Fd);
@@ -629,12 +1019,26 @@ static int SlaveRpc() {
     }
 
 exit:
+    for (auto &reactor: Reactors)
+        reactor->Stop();
+
+    verifyStop = true;
+    if (verifyThread.joinable())
+        verifyThread.join();
+
     EventQueue->Stop();
     worker.Stop();
+    KvCommitter.Stop();
 
-    for (auto c : Clients)
-        c.second->CloseConnection();
-    Clients.clear();
+    if (ret == -SIGHUP && !failsafe && config().daemon().upgrade_handoff())
+        HandoffState();
+
+    for (auto &reactor: Reactors) {
+        for (auto &it: reactor->Clients)
+            it.second->CloseConnection();
+        reactor->Clients.clear();
+    }
+    Reactors.clear();
 
     return ret;
 }
@@ -643,12 +1047,18 @@ static TError TuneLimits() {
     struct rlimit rlim;
 
     /*
-     * two FDs for each container: OOM event and netlink
+     * three FDs for each container: OOM event, netlink and pidfd
      * one for each client
+     * cached cgroup knobs
+     * knobs opened by io_uring prefetch in each worker
      * plus some extra
      */
-    int maxFd = config().container().max_total() * 2 +
-                config().daemon().max_clients() + 1000;
+    int maxFd = config().container().max_total() * 3 +
+                config().daemon().max_clients() +
+                config().daemon().cgroup_knob_fds() + 1000;
+
+    if (config().daemon().stat_io_uring())
+        maxFd += config().daemon().workers() * KNOB_PREFETCH_BATCH;
 
     rlim.rlim_max = maxFd;
     rlim.rlim_cur = maxFd;
@@ -698,14 +1108,29 @@ static TError CreateRootContainer() {
 }
 
 static void RestoreContainers() {
+    std::map<std::string, const kv::THandoffNode *> handoff;
+    std::set<const TKeyValue *> adopted;
     std::list<TKeyValue> nodes;
 
     TError error = TKeyValue::ListAll(ContainersKV, nodes);
     if (error)
         FatalError("Cannot list container kv", error);
 
+    /* Nodes without keyvalue are gone, others are taken from hand-off */
+    for (auto &state: handoffState.containers())
+        handoff[state.name()] = &state;
+
     for (auto node = nodes.begin(); node != nodes.end(); ) {
-        error = node->Load();
+        auto it = handoff.find(node->Path.BaseName());
+        if (it != handoff.end()) {
+            for (auto &pair: it->second->pairs())
+                node->Data[pair.key()] = pair.val();
+            node->Stored = node->Data;
+            node->StoredSize = it->second->stored_size();
+            node->SnapshotSize = it->second->snapshot_size();
+            error = TError::Success();
+        } else
+            error = node->Load();
         if (!error) {
             if (!node->Has(P_RAW_ID))
                 error = TError(EError::Unknown, "id not found");
@@ -714,10 +1139,12 @@ static void RestoreContainers() {
         }
         if (error) {
             L_ERR("Cannot load {}: {}", node->Path, error);
-            (void)node->Path.Unlink();
+            (void)node->Remove();
             node = nodes.erase(node);
             continue;
         }
+        if (it != handoff.end())
+            adopted.insert(&*node);
         /* key for sorting */
         node->Name = node->Get(P_RAW_NAME);
         ++node;
@@ -725,24 +1152,84 @@ static void RestoreContainers() {
 
     nodes.sort();
 
-    for (auto &node : nodes) {
+    /* Parents are restored before children, siblings concurrently */
+    std::map<std::string, std::vector<TKeyValue *>> children;
+    std::deque<TKeyValue *> ready;
+    std::set<std::string> names;
+    size_t left = 0;
+
+    for (auto &node: nodes)
+        if (node.Name[0] != '/')
+            names.insert(node.Name);
+
+    for (auto &node: nodes) {
         if (node.Name[0] == '/')
             continue;
+        auto parent = TContainer::ParentName(node.Name);
+        if (names.count(parent))
+            children[parent].push_back(&node);
+        else
+            ready.push_back(&node);
+        left++;
+    }
 
-        std::shared_ptr<TContainer> ct;
-        error = TContainer::Restore(node, ct);
-        if (error) {
-            L_ERR("Cannot restore {}: {}", node.Name, error);
-            Statistics->RestoreFailed++;
-            node.Path.Unlink();
-            continue;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    auto restore = [&]() {
+        TClient client("<restore>");
+        client.ClientContainer = RootContainer;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (left && ready.empty())
+                cv.wait(lock);
+            if (!left)
+                break;
+
+            auto node = ready.front();
+            ready.pop_front();
+            lock.unlock();
+
+            std::shared_ptr<TContainer> ct;
+            client.StartRequest();
+            TError error = TContainer::Restore(*node, ct, adopted.count(node));
+            client.FinishRequest();
+            if (error) {
+                L_ERR("Cannot restore {}: {}", node->Name, error);
+                Statistics->RestoreFailed++;
+                node->Remove();
+            }
+
+            lock.lock();
+            auto it = children.find(node->Name);
+            if (it != children.end())
+                ready.insert(ready.end(), it->second.begin(), it->second.end());
+            left--;
+            cv.notify_all();
         }
-    }
+    };
+
+    uint64_t start = GetCurrentTimeMs();
+    size_t nr = std::min((size_t)std::max(config().daemon().restore_threads(), 1u), left);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < nr; i++)
+        threads.emplace_back([&restore] {
+            SetProcessName("portod-restore");
+            restore();
+        });
+    for (auto &thread: threads)
+        thread.join();
 
-    TNetwork::RefreshNetworks();
+    Statistics->RestoreTimeMs = GetCurrentTimeMs() - start;
+    Statistics->HandoffContainers = adopted.size();
+
+    /* Classes for managed devices are refreshed by network watchdog when rpc is served */
 }
 
 static void CleanupCgroups() {
+    auto containers = Containers.List();
     TError error;
     int pass = 0;
     bool retry;
@@ -775,9 +1262,9 @@ again:
                 continue;
 
             bool found = false;
-            for (auto &it: Containers) {
-                if (it.second->State != EContainerState::Stopped &&
-                        it.second->GetCgroup(*hy) == *cg) {
+            for (auto &ct: containers) {
+                if (ct->State != EContainerState::Stopped &&
+                        ct->GetCgroup(*hy) == *cg) {
                     found = true;
                     break;
                 }
@@ -811,9 +1298,8 @@ static void CleanupTempdir() {
         L_ERR("Cannot list temp dir: {}", error);
 
     for (auto &name: list) {
-        auto it = Containers.find(name);
-        if (it != Containers.end() &&
-                it->second->State != EContainerState::Stopped)
+        auto ct = Containers.Find(name);
+        if (ct && ct->State != EContainerState::Stopped)
             continue;
         TPath path = temp / name;
         error = ClearRecursive(path);
@@ -851,10 +1337,16 @@ static int SlaveMain() {
         AllocStatistics();
 
     Statistics->SlaveStarted = GetCurrentTimeMs();
+    ContainerGeneration = Statistics->SlaveStarted * 1000;
     Statistics->ContainersCount = 0;
     Statistics->ClientsCount = 0;
+    Statistics->EpollSources = 0;
     Statistics->VolumesCount = 0;
+    Statistics->QueuedEvents = 0;
     Statistics->RequestsQueued = 0;
+    Statistics->HandoffContainers = 0;
+    Statistics->HandoffVolumes = 0;
+    Statistics->HandoffUnverified = 0;
 
     DaemonPrepare(false);
 
@@ -885,6 +1377,12 @@ static int SlaveMain() {
             return EXIT_FAILURE;
     }
 
+    if (fcntl(HANDOFF_FD, F_SETFD, FD_CLOEXEC) < 0) {
+        L_ERR("Can't set close-on-exec flag on HANDOFF_FD: {}", strerror(errno));
+        if (!failsafe)
+            return EXIT_FAILURE;
+    }
+
     umask(0);
 
     error = SetOomScoreAdj(0);
@@ -927,6 +1425,9 @@ static int SlaveMain() {
             FatalError("Cannot create tmp_dir", error);
     }
 
+    if (!handoffFds.empty())
+        ReadHandoff();
+
     SystemClient.StartRequest();
 
     error = CreateRootContainer();
@@ -937,7 +1438,9 @@ static int SlaveMain() {
 
     RestoreContainers();
 
-    TVolume::RestoreAll();
+    TVolume::RestoreAll(handedOff ? &handoffState : nullptr);
+
+    handoffState.Clear();
 
     DestroyContainers(true);
 
@@ -950,11 +1453,14 @@ static int SlaveMain() {
 
     SystemClient.FinishRequest();
 
-    L("Remove cgroup leftovers...");
-    CleanupCgroups();
+    /* Previous slave was serving till hand-off, full restart cleans the rest */
+    if (!handedOff) {
+        L("Remove cgroup leftovers...");
+        CleanupCgroups();
 
-    L("Cleanup temp dir...");
-    CleanupTempdir();
+        L("Cleanup temp dir...");
+        CleanupTempdir();
+    }
 
     L("Done restoring");
 
@@ -989,6 +1495,8 @@ static int SlaveMain() {
 
         RootContainer = nullptr;
 
+        TKeyValue::CloseStores();
+
         error = ContainersKV.UmountAll();
         if (error)
             L_ERR("Can't destroy key-value storage: {}", error);
@@ -1091,13 +1599,29 @@ static int ReceiveAcks(int fd, std::map<int,int> &exited) {
 static int UpgradeMaster() {
     L_SYS("Updating");
 
+    /* Slave hands off clients only when asked, nobody reads otherwise */
+    if (config().daemon().upgrade_handoff()) {
+        char request = 'H';
+        if (send(handoffSock, &request, 1, MSG_DONTWAIT) != 1)
+            L_WRN("Cannot request hand-off: {}", strerror(errno));
+    }
+
     if (kill(slavePid, SIGHUP) < 0) {
         L_ERR("Cannot send SIGHUP to slave: {}", strerror(errno));
     } else {
+        ReceiveHandoff();
         if (waitpid(slavePid, NULL, 0) != slavePid)
             L_ERR("Cannot wait for slave exit status: {}", strerror(errno));
     }
 
+    if (!handoffFds.empty()) {
+        std::string fds;
+        for (auto fd: handoffFds)
+            fds += (fds.empty() ? "" : ",") + std::to_string(fd);
+        L_SYS("Hand-off descriptors: {}", fds);
+        setenv("PORTO_HANDOFF", fds.c_str(), 1);
+    }
+
     TLogger::CloseLog();
 
     std::vector<const char *> args = {PORTO_BINARY_PATH};
@@ -1125,6 +1649,7 @@ static int UpgradeMaster() {
 static int SpawnSlave(std::shared_ptr<TEpollLoop> loop, std::map<int,int> &exited) {
     int evtfd[2];
     int ackfd[2];
+    int hsk[2];
     int ret = EXIT_FAILURE;
     TError error;
 
@@ -1140,6 +1665,13 @@ static int SpawnSlave(std::shared_ptr<TEpollLoop> loop, std::map<int,int> &exite
         return EXIT_FAILURE;
     }
 
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, hsk) < 0) {
+        L_ERR("socketpair(): {}", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    handoffSock = hsk[0];
+
     auto AckSource = std::make_shared<TEpollSource>(ackfd[0]);
 
     int sigFd = SignalFd();
@@ -1154,12 +1686,15 @@ static int SpawnSlave(std::shared_ptr<TEpollLoop> loop, std::map<int,int> &exite
     } else if (slavePid == 0) {
         close(evtfd[1]);
         close(ackfd[0]);
+        close(hsk[0]);
         TLogger::CloseLog();
         loop->Destroy();
         dup2(evtfd[0], REAP_EVT_FD);
         dup2(ackfd[1], REAP_ACK_FD);
+        dup2(hsk[1], HANDOFF_FD);
         close(evtfd[0]);
         close(ackfd[1]);
+        close(hsk[1]);
         close(sigFd);
 
         _exit(SlaveMain());
@@ -1167,6 +1702,13 @@ static int SpawnSlave(std::shared_ptr<TEpollLoop> loop, std::map<int,int> &exite
 
     close(evtfd[0]);
     close(ackfd[1]);
+    close(hsk[1]);
+    hsk[1] = -1;
+
+    /* Only the first slave gets hand-off */
+    for (auto fd: handoffFds)
+        close(fd);
+    handoffFds.clear();
 
     L_SYS("Spawned slave {}", slavePid);
     Statistics->Spawned++;
@@ -1277,6 +1819,13 @@ exit:
     close(ackfd[0]);
     close(ackfd[1]);
 
+    if (handoffSock >= 0) {
+        close(handoffSock);
+        handoffSock = -1;
+    }
+    if (hsk[1] >= 0)
+        close(hsk[1]);
+
     return ret;
 }
 
@@ -1287,6 +1836,20 @@ static int MasterMain() {
 
     DaemonPrepare(true);
 
+    /* Descriptors passed by previous master across exec */
+    const char *handoff = getenv("PORTO_HANDOFF");
+    if (handoff) {
+        std::vector<std::string> fds;
+        int fd;
+
+        (void)SplitString(handoff, ',', fds);
+        for (auto &str: fds) {
+            if (!StringToInt(str, fd) && fd > 2 && !fcntl(fd, F_SETFD, FD_CLOEXEC))
+                handoffFds.push_back(fd);
+        }
+        unsetenv("PORTO_HANDOFF");
+    }
+
     TPath pathVer(PORTO_VERSION_FILE);
 
     if (pathVer.ReadAll(PreviousVersion)) {
@@ -1398,6 +1961,94 @@ static void KvDump() {
     TKeyValue::DumpAll(PORTO_VOLUMES_KV);
 }
 
+/* Compares save and restore of key-value backends in scratch tmpfs */
+static int KvBench(int count) {
+    TPath root = TPath(PORTO_CONTAINERS_KV).DirName() / "kvbench";
+    TError error;
+
+    TLogger::OpenLog(true, "", 0);
+
+    /* File per node takes at least page */
+    config().set_keyvalue_size(std::max(config().keyvalue_size(), (uint64_t)count * 8192));
+
+    for (std::string backend: { "files", "log" }) {
+        config().set_keyvalue_backend(backend);
+
+        error = TKeyValue::Mount(root);
+        if (error)
+            goto err;
+
+        uint64_t start = GetCurrentTimeMs();
+        for (int i = 0; i < count; i++) {
+            TKeyValue node(root / std::to_string(i));
+            node.Set(P_RAW_ID, std::to_string(i));
+            node.Set(P_RAW_NAME, "bench/" + std::to_string(i));
+            node.Set(D_STATE, "running");
+            node.Set(P_COMMAND, "/usr/bin/sleep infinity");
+            node.Set(P_ENV, "PATH=/usr/local/bin:/usr/bin:/bin;HOME=/place/db/" + std::to_string(i) +
+                     ";LANG=C.UTF-8;TASK=" + std::string(64, 'x'));
+            node.Set(P_BIND, "/place/db/" + std::to_string(i) + " /db rw;/etc/resolv.conf /etc/resolv.conf ro");
+            node.Set(P_MEM_LIMIT, "1073741824");
+            node.Set(P_CPU_LIMIT, "2c");
+            node.Set(P_RAW_ROOT_PID, std::to_string(10000 + i));
+            node.Set(P_RAW_START_TIME, std::to_string(GetCurrentTimeMs()));
+            error = node.Save();
+            if (error)
+                goto err;
+        }
+        uint64_t saveMs = GetCurrentTimeMs() - start;
+
+        TKeyValue::CloseStores();
+
+        start = GetCurrentTimeMs();
+        error = TKeyValue::Mount(root);
+        if (error)
+            goto err;
+
+        std::list<TKeyValue> nodes;
+        error = TKeyValue::ListAll(root, nodes);
+        if (error)
+            goto err;
+        for (auto &node: nodes) {
+            error = node.Load();
+            if (error)
+                goto err;
+        }
+        uint64_t restoreMs = GetCurrentTimeMs() - start;
+
+        std::cout << backend << ": " << nodes.size() << " nodes, save " << saveMs
+                  << " ms, restore " << restoreMs << " ms" << std::endl;
+
+        TKeyValue::CloseStores();
+
+        if (backend == "files") {
+            config().set_keyvalue_backend("log");
+            start = GetCurrentTimeMs();
+            error = TKeyValue::Mount(root);
+            if (error)
+                goto err;
+            std::cout << "files -> log migration " << GetCurrentTimeMs() - start
+                      << " ms" << std::endl;
+            TKeyValue::CloseStores();
+        }
+
+        error = root.UmountAll();
+        if (!error)
+            error = root.Rmdir();
+        if (error)
+            goto err;
+    }
+
+    return EXIT_SUCCESS;
+
+err:
+    std::cerr << "kvbench: " << error << std::endl;
+    TKeyValue::CloseStores();
+    (void)root.UmountAll();
+    (void)root.Rmdir();
+    return EXIT_FAILURE;
+}
+
 static void PrintVersion() {
     TPath thisBin, currBin;
 
@@ -1690,6 +2341,7 @@ static void Usage() {
         << "  reload          reexec portod" << std::endl
         << "  upgrade         upgrade running portod" << std::endl
         << "  dump            print internal key-value state" << std::endl
+        << "  kvbench [count] compare key-value backends" << std::endl
         << "  core            receive and forward core dump" << std::endl
         << "  help            print this message" << std::endl
         << "  version         print version and revision" << std::endl
@@ -1783,6 +2435,13 @@ int main(int argc, char **argv) {
         return EXIT_SUCCESS;
     }
 
+    if (cmd == "kvbench") {
+        int count = 10000;
+        if (opt + 1 < argc && StringToInt(argv[opt + 1], count))
+            count = 10000;
+        return KvBench(count);
+    }
+
     if (cmd == "core")
         return PortoCore(TTuple(argv + opt + 1, argv + argc));
 
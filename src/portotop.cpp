@@ -237,6 +237,7 @@ void TConsoleScreen::HelpDialog() {
 
 void TPortoValueCache::Register(const std::string &container,
                                 const std::string &variable) {
+    Changed = true;
     if (Containers.find(container) == Containers.end())
         Containers[container] = 1;
     else
@@ -248,6 +249,7 @@ void TPortoValueCache::Register(const std::string &container,
 }
 void TPortoValueCache::Unregister(const std::string &container,
                                   const std::string &variable) {
+    Changed = true;
     auto c = Containers.find(container);
     if (c != Containers.end()) {
         if (c->second == 1)
@@ -283,9 +285,21 @@ int TPortoValueCache::Update(Porto::Connection &api) {
     for (auto &iter : Variables)
         _variables.push_back(iter.first);
 
+    /* any new container or variable requires full get */
+    if (Changed) {
+        Changed = false;
+        Generation = 0;
+    }
+
+    /* delta get returns only changed properties, keep others */
     CacheSelector = !CacheSelector;
-    Cache[CacheSelector].clear();
-    int ret = api.Get(_containers, _variables, Cache[CacheSelector]);
+    if (Generation)
+        Cache[CacheSelector] = Cache[!CacheSelector];
+    else
+        Cache[CacheSelector].clear();
+    int ret = api.Get(_containers, _variables, Cache[CacheSelector], Generation);
+    if (ret)
+        Generation = 0;
     Time[CacheSelector] = GetCurrentTimeMs();
 
     api.GetVersion(Version, Revision);
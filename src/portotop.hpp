@@ -92,6 +92,8 @@ private:
     bool CacheSelector = false;
     std::map<std::string, std::map<std::string, Porto::GetResponse>> Cache[2];
     uint64_t Time[2] = {0, 0};
+    uint64_t Generation = 0;
+    bool Changed = true;
 };
 
 namespace ValueFlags {
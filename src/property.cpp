@@ -6,6 +6,7 @@
 #include "container.hpp"
 #include "network.hpp"
 #include "statistics.hpp"
+#include "rpc.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
 #include "util/unix.hpp"
@@ -40,6 +41,18 @@ TError TProperty::SetIndexed(const std::string &index, const std::string &value)
     return TError(EError::InvalidValue, "Invalid subscript for property");
 }
 
+TError TProperty::GetUint(uint64_t &) {
+    return TError(EError::NotSupported, "Not a number: " + Name);
+}
+
+TError TProperty::GetDouble(double &) {
+    return TError(EError::NotSupported, "Not a number: " + Name);
+}
+
+TError TProperty::GetUintMap(TUintMap &) {
+    return TError(EError::NotSupported, "Not a map: " + Name);
+}
+
 TError TProperty::GetToSave(std::string &value) {
     if (Prop != EProperty::NONE)
         return Get(value);
@@ -528,6 +541,10 @@ class TMemoryGuarantee : public TProperty {
 public:
     TError Set(const std::string &mem_guarantee);
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value) {
+        value = CT->MemGuarantee;
+        return TError::Success();
+    }
     TMemoryGuarantee() : TProperty(P_MEM_GUARANTEE, EProperty::MEM_GUARANTEE,
                                     "Guaranteed amount of memory "
                                     "[bytes] (dynamic)") {}
@@ -1419,6 +1436,7 @@ public:
     TError SetFromRestore(const std::string &value) {
         std::vector<std::string> val;
         TError error;
+        pid_t waitPid;
 
         SplitEscapedString(value, val, ';');
         if (val.size() > 0)
@@ -1430,9 +1448,11 @@ public:
         else
             CT->TaskVPid = 0;
         if (!error && val.size() > 2)
-            error = StringToInt(val[2], CT->WaitTask.Pid);
+            error = StringToInt(val[2], waitPid);
         else
-            CT->WaitTask.Pid = CT->Task.Pid;
+            waitPid = CT->Task.Pid;
+        if (!error)
+            CT->SetTaskPid(CT->WaitTask, waitPid);
         return error;
     }
 } static RawRootPid;
@@ -1448,7 +1468,11 @@ public:
         return TError::Success();
     }
     TError SetFromRestore(const std::string &value) {
-        return StringToInt(value, CT->SeizeTask.Pid);
+        pid_t pid;
+        TError error = StringToInt(value, pid);
+        if (!error)
+            CT->SetTaskPid(CT->SeizeTask, pid);
+        return error;
     }
 } static SeizePid;
 
@@ -1552,6 +1576,10 @@ class TMemoryLimit : public TProperty {
 public:
     TError Set(const std::string &limit);
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value) {
+        value = CT->MemLimit;
+        return TError::Success();
+    }
     TMemoryLimit() : TProperty(P_MEM_LIMIT, EProperty::MEM_LIMIT,
                                "Memory hard limit [bytes] (dynamic)") {}
 } static MemoryLimit;
@@ -1770,6 +1798,10 @@ class TCpuLimit : public TProperty {
 public:
     TError Set(const std::string &limit);
     TError Get(std::string &value);
+    TError GetDouble(double &value) {
+        value = CT->CpuLimit;
+        return TError::Success();
+    }
     TCpuLimit() : TProperty(P_CPU_LIMIT, EProperty::CPU_LIMIT,
                             "CPU limit: 0-100.0 [%] | 0.0c-<CPUS>c "
                             " [cores] (dynamic)") {}
@@ -1810,6 +1842,10 @@ class TCpuGuarantee : public TProperty {
 public:
     TError Set(const std::string &guarantee);
     TError Get(std::string &value);
+    TError GetDouble(double &value) {
+        value = CT->CpuGuarantee;
+        return TError::Success();
+    }
     TCpuGuarantee() : TProperty(P_CPU_GUARANTEE, EProperty::CPU_GUARANTEE,
                                 "CPU guarantee: 0-100.0 [%] | "
                                 "0.0c-<CPUS>c [cores] (dynamic)") {}
@@ -1854,6 +1890,10 @@ public:
         value = StringFormat("%lg", CT->CpuWeight);
         return TError::Success();
     }
+    TError GetDouble(double &value) {
+        value = CT->CpuWeight;
+        return TError::Success();
+    }
     TError Set(const std::string &value) {
         TError error = IsAlive();
         if (error)
@@ -2457,6 +2497,9 @@ TError TAgingTime::Set(const std::string &time) {
     CT->AgingTime = new_time * 1000;
     CT->SetProp(EProperty::AGING_TIME);
 
+    if (CT->State == EContainerState::Dead)
+        CT->ScheduleAging();
+
     return TError::Success();
 }
 
@@ -2712,6 +2755,10 @@ class TRespawnCount : public TProperty {
 public:
     TError SetFromRestore(const std::string &value);
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value) {
+        value = CT->RespawnCount;
+        return TError::Success();
+    }
     TRespawnCount() : TProperty(D_RESPAWN_COUNT, EProperty::RESPAWN_COUNT,
                                 "current respawn count (ro)") {
         IsReadOnly = true;
@@ -2795,20 +2842,26 @@ public:
 class TMemUsage : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TMemUsage() : TProperty(D_MEMORY_USAGE, EProperty::NONE,
                             "current memory usage [bytes] (ro)") {
         IsReadOnly = true;
+        Knobs = { { &MemorySubsystem, "memory.usage_in_bytes" } };
     }
 } static MemUsage;
 
-TError TMemUsage::Get(std::string &value) {
+TError TMemUsage::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(MemorySubsystem);
+    return MemorySubsystem.Usage(cg, value);
+}
+
+TError TMemUsage::Get(std::string &value) {
     uint64_t val;
-    error = MemorySubsystem.Usage(cg, val);
+    TError error = GetUint(val);
     if (!error)
         value = std::to_string(val);
     return error;
@@ -2817,20 +2870,31 @@ TError TMemUsage::Get(std::string &value) {
 class TAnonUsage : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TAnonUsage() : TProperty(D_ANON_USAGE, EProperty::NONE,
                              "current anonymous memory usage [bytes] (ro)") {
         IsReadOnly = true;
     }
+    void Init(void) {
+        if (MemorySubsystem.RootCgroup().Has(MemorySubsystem.ANON_USAGE))
+            Knobs = { { &MemorySubsystem, MemorySubsystem.ANON_USAGE } };
+        else
+            Knobs = { { &MemorySubsystem, MemorySubsystem.STAT } };
+    }
 } static AnonUsage;
 
-TError TAnonUsage::Get(std::string &value) {
+TError TAnonUsage::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(MemorySubsystem);
+    return MemorySubsystem.GetAnonUsage(cg, value);
+}
+
+TError TAnonUsage::Get(std::string &value) {
     uint64_t val;
-    error = MemorySubsystem.GetAnonUsage(cg, val);
+    TError error = GetUint(val);
     if (!error)
         value = std::to_string(val);
     return error;
@@ -2845,13 +2909,16 @@ public:
     void Init(void) {
         IsSupported = HugetlbSubsystem.Supported;
     }
-    TError Get(std::string &value) {
+    TError GetUint(uint64_t &value) {
         TError error = IsRunning();
         if (error)
             return error;
         auto cg = CT->GetCgroup(HugetlbSubsystem);
+        return HugetlbSubsystem.GetHugeUsage(cg, value);
+    }
+    TError Get(std::string &value) {
         uint64_t val;
-        error = HugetlbSubsystem.GetHugeUsage(cg, val);
+        TError error = GetUint(val);
         if (!error)
             value = std::to_string(val);
         return error;
@@ -2861,23 +2928,36 @@ public:
 class TMinorFaults : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TMinorFaults() : TProperty(D_MINOR_FAULTS, EProperty::NONE, "minor page faults (ro)") {
         IsReadOnly = true;
+        Knobs = { { &MemorySubsystem, "memory.stat" } };
     }
 } static MinorFaults;
 
-TError TMinorFaults::Get(std::string &value) {
+TError TMinorFaults::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(MemorySubsystem);
     TUintMap stat;
+    error = MemorySubsystem.Statistics(cg, stat);
+    if (!error)
+        value = stat["total_pgfault"] - stat["total_pgmajfault"];
+    return error;
+}
 
-    if (MemorySubsystem.Statistics(cg, stat))
+TError TMinorFaults::Get(std::string &value) {
+    TError error = IsRunning();
+    if (error)
+        return error;
+
+    uint64_t val;
+    if (GetUint(val))
         value = "-1";
     else
-        value = std::to_string(stat["total_pgfault"] - stat["total_pgmajfault"]);
+        value = std::to_string(val);
 
     return TError::Success();
 }
@@ -2885,23 +2965,36 @@ TError TMinorFaults::Get(std::string &value) {
 class TMajorFaults : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TMajorFaults() : TProperty(D_MAJOR_FAULTS, EProperty::NONE, "major page faults (ro)") {
         IsReadOnly = true;
+        Knobs = { { &MemorySubsystem, "memory.stat" } };
     }
 } static MajorFaults;
 
-TError TMajorFaults::Get(std::string &value) {
+TError TMajorFaults::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(MemorySubsystem);
     TUintMap stat;
+    error = MemorySubsystem.Statistics(cg, stat);
+    if (!error)
+        value = stat["total_pgmajfault"];
+    return error;
+}
 
-    if (MemorySubsystem.Statistics(cg, stat))
+TError TMajorFaults::Get(std::string &value) {
+    TError error = IsRunning();
+    if (error)
+        return error;
+
+    uint64_t val;
+    if (GetUint(val))
         value = "-1";
     else
-        value = std::to_string(stat["total_pgmajfault"]);
+        value = std::to_string(val);
 
     return TError::Success();
 }
@@ -2909,9 +3002,11 @@ TError TMajorFaults::Get(std::string &value) {
 class TMaxRss : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TMaxRss() : TProperty(D_MAX_RSS, EProperty::NONE,
                           "peak anonymous memory usage [bytes] (ro)") {
         IsReadOnly = true;
+        Knobs = { { &MemorySubsystem, "memory.stat" } };
     }
     void Init(void) {
         TCgroup rootCg = MemorySubsystem.RootCgroup();
@@ -2922,17 +3017,29 @@ public:
     }
 } static MaxRss;
 
-TError TMaxRss::Get(std::string &value) {
+TError TMaxRss::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(MemorySubsystem);
     TUintMap stat;
-    if (MemorySubsystem.Statistics(cg, stat))
+    error = MemorySubsystem.Statistics(cg, stat);
+    if (!error)
+        value = stat["total_max_rss"];
+    return error;
+}
+
+TError TMaxRss::Get(std::string &value) {
+    TError error = IsRunning();
+    if (error)
+        return error;
+
+    uint64_t val;
+    if (GetUint(val))
         value = "-1";
     else
-        value = std::to_string(stat["total_max_rss"]);
+        value = std::to_string(val);
 
     return TError::Success();
 }
@@ -2940,19 +3047,25 @@ TError TMaxRss::Get(std::string &value) {
 class TCpuUsage : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TCpuUsage() : TProperty(D_CPU_USAGE, EProperty::NONE, "consumed CPU time [nanoseconds] (ro)") {
         IsReadOnly = true;
+        Knobs = { { &CpuacctSubsystem, "cpuacct.usage" } };
     }
 } static CpuUsage;
 
-TError TCpuUsage::Get(std::string &value) {
+TError TCpuUsage::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(CpuacctSubsystem);
+    return CpuacctSubsystem.Usage(cg, value);
+}
+
+TError TCpuUsage::Get(std::string &value) {
     uint64_t val;
-    error = CpuacctSubsystem.Usage(cg, val);
+    TError error = GetUint(val);
     if (!error)
         value = std::to_string(val);
     return error;
@@ -2961,20 +3074,26 @@ TError TCpuUsage::Get(std::string &value) {
 class TCpuSystem : public TProperty {
 public:
     TError Get(std::string &value);
+    TError GetUint(uint64_t &value);
     TCpuSystem() : TProperty(D_CPU_SYSTEM, EProperty::NONE,
                              "consumed system CPU time [nanoseconds] (ro)") {
         IsReadOnly = true;
+        Knobs = { { &CpuacctSubsystem, "cpuacct.stat" } };
     }
 } static CpuSystem;
 
-TError TCpuSystem::Get(std::string &value) {
+TError TCpuSystem::GetUint(uint64_t &value) {
     TError error = IsRunning();
     if (error)
         return error;
 
     auto cg = CT->GetCgroup(CpuacctSubsystem);
+    return CpuacctSubsystem.SystemUsage(cg, value);
+}
+
+TError TCpuSystem::Get(std::string &value) {
     uint64_t val;
-    error = CpuacctSubsystem.SystemUsage(cg, val);
+    TError error = GetUint(val);
     if (!error)
         value = std::to_string(val);
     return error;
@@ -3045,12 +3164,16 @@ public:
         IsReadOnly = true;
     }
 
-    TError Get(std::string &value) {
+    TError GetUintMap(TUintMap &stat) {
         TError error = IsRunning();
         if (error)
             return error;
+        return CT->GetNetStat(Kind, stat);
+    }
+
+    TError Get(std::string &value) {
         TUintMap stat;
-        error = CT->GetNetStat(Kind, stat);
+        TError error = GetUintMap(stat);
         if (error)
             return error;
         return UintMapToString(stat, value);
@@ -3089,13 +3212,21 @@ public:
     TIoStat(std::string name, EProperty prop, std::string desc) : TProperty(name, prop, desc) {
         IsReadOnly = true;
     }
+    void Init(void) {
+        Knobs = { { &BlkioSubsystem, BlkioSubsystem.IoStatKnob(Name == D_IO_OPS) } };
+        if (MemorySubsystem.SupportIoLimit())
+            Knobs.push_back({ &MemorySubsystem, MemorySubsystem.STAT });
+    }
     virtual TError GetMap(TUintMap &map) = 0;
-    TError Get(std::string &value) {
+    TError GetUintMap(TUintMap &map) {
         TError error = IsRunning();
         if (error)
             return error;
+        return GetMap(map);
+    }
+    TError Get(std::string &value) {
         TUintMap map;
-        error = GetMap(map);
+        TError error = GetUintMap(map);
         if (error)
             return error;
         return UintMapToString(map, value);
@@ -3270,9 +3401,18 @@ void TPortoStat::Populate(TUintMap &m) {
     m["slave_uptime"] = (GetCurrentTimeMs() - Statistics->SlaveStarted) / 1000;
     m["queued_statuses"] = Statistics->QueuedStatuses;
     m["queued_events"] = Statistics->QueuedEvents;
+    m["event_lag_ms"] = Statistics->EventLagMs;
+    m["cancelled_events"] = Statistics->CancelledEvents;
     m["remove_dead"] = Statistics->RemoveDead;
     m["slave_timeout_ms"] = Statistics->SlaveTimeoutMs;
     m["restore_failed"] = Statistics->RestoreFailed;
+    m["restore_time_ms"] = Statistics->RestoreTimeMs;
+    m["startup_time_ms"] = Statistics->StartupTimeMs;
+    m["handoff_containers"] = Statistics->HandoffContainers;
+    m["handoff_volumes"] = Statistics->HandoffVolumes;
+    m["handoff_clients"] = Statistics->HandoffClients;
+    m["handoff_unverified"] = Statistics->HandoffUnverified;
+    m["pidfd_exits"] = Statistics->PidfdExits;
     uint64_t usage = 0;
     auto cg = MemorySubsystem.Cgroup(PORTO_DAEMON_CGROUP);
     TError error = MemorySubsystem.Usage(cg, usage);
@@ -3284,6 +3424,12 @@ void TPortoStat::Populate(TUintMap &m) {
 
     m["log_rotate_bytes"] = Statistics->LogRotateBytes;
     m["log_rotate_errors"] = Statistics->LogRotateErrors;
+    m["log_dropped"] = Statistics->LogDropped;
+
+    m["kv_saves"] = Statistics->KvSaves;
+    m["kv_writes"] = Statistics->KvWrites;
+    m["kv_batches"] = Statistics->KvBatches;
+    m["kv_coalesced"] = Statistics->KvCoalesced;
 
     m["containers"] = Statistics->ContainersCount - NR_SERVICE_CONTAINERS;
 
@@ -3301,6 +3447,8 @@ void TPortoStat::Populate(TUintMap &m) {
     m["container_clients"] = CT->ClientsCount;
     m["container_oom"] = CT->OomEvents;
     m["container_requests"] = CT->ContainerRequests;
+    m["container_lock_waits"] = CT->LockWaits;
+    m["container_lock_wait_ms"] = CT->LockWaitTime;
 
     m["requests_queued"] = Statistics->RequestsQueued;
     m["requests_completed"] = Statistics->RequestsCompleted;
@@ -3309,6 +3457,55 @@ void TPortoStat::Populate(TUintMap &m) {
     m["requests_longer_3s"] = Statistics->RequestsLonger3s;
     m["requests_longer_30s"] = Statistics->RequestsLonger30s;
     m["requests_longer_5m"] = Statistics->RequestsLonger5m;
+
+    static const char *phases[RPC_PHASE_NR] = { "queue", "lock", "exec", "send" };
+
+    for (int method = 0; method < RPC_STAT_METHODS; method++) {
+        auto &rpc = Statistics->Rpc[method];
+        uint64_t count = rpc.Count;
+
+        if (!count)
+            continue;
+
+        std::string prefix = "rpc_" + RpcMethodName(method) + "_";
+        m[prefix + "count"] = count;
+
+        for (int phase = 0; phase < RPC_PHASE_NR; phase++) {
+            uint64_t hist[RPC_STAT_BUCKETS], total = 0;
+
+            for (int i = 0; i < RPC_STAT_BUCKETS; i++)
+                total += hist[i] = rpc.Hist[phase][i];
+            if (!total)
+                continue;
+
+            /* upper bounds of buckets */
+            uint64_t sum = 0, p50 = 0, p99 = 0, max = 0;
+            int last = 0;
+            for (int i = 0; i < RPC_STAT_BUCKETS; i++) {
+                if (!hist[i])
+                    continue;
+                sum += hist[i];
+                max = 1ull << i;
+                last = i;
+                if (!p50 && sum * 2 >= total)
+                    p50 = max;
+                if (!p99 && sum * 100 >= total * 99)
+                    p99 = max;
+            }
+
+            std::string name = prefix + phases[phase];
+            m[name + "_p50_us"] = p50;
+            m[name + "_p99_us"] = p99;
+            m[name + "_max_us"] = max;
+
+            /* cumulative, up to the last non-empty bucket */
+            sum = 0;
+            for (int i = 0; i <= last; i++) {
+                sum += hist[i];
+                m[name + "_le_" + std::to_string(1ull << i) + "_us"] = sum;
+            }
+        }
+    }
 }
 
 TError TPortoStat::Get(std::string &value) {
@@ -3364,17 +3561,21 @@ public:
     TProcessCount() : TProperty(D_PROCESS_COUNT, EProperty::NONE, "Total process count (ro)") {
         IsReadOnly = true;
     }
-    TError Get(std::string &value) {
+    TError GetUint(uint64_t &count) {
         TError error = IsRunning();
         if (error)
             return error;
-        uint64_t count;
         if (CT->IsRoot()) {
             count = 0; /* too much work */
         } else {
             auto cg = CT->GetCgroup(FreezerSubsystem);
             error = cg.GetCount(false, count);
         }
+        return error;
+    }
+    TError Get(std::string &value) {
+        uint64_t count;
+        TError error = GetUint(count);
         if (!error)
             value = std::to_string(count);
         return error;
@@ -3386,11 +3587,10 @@ public:
     TThreadCount() : TProperty(D_THREAD_COUNT, EProperty::NONE, "Total thread count (ro)") {
         IsReadOnly = true;
     }
-    TError Get(std::string &value) {
+    TError GetUint(uint64_t &count) {
         TError error = IsRunning();
         if (error)
             return error;
-        uint64_t count;
         if (CT->IsRoot()) {
             count = GetTotalThreads();
         } else if (CT->Controllers & CGROUP_PIDS) {
@@ -3400,6 +3600,11 @@ public:
             auto cg = CT->GetCgroup(FreezerSubsystem);
             error = cg.GetCount(true, count);
         }
+        return error;
+    }
+    TError Get(std::string &value) {
+        uint64_t count;
+        TError error = GetUint(count);
         if (!error)
             value = std::to_string(count);
         return error;
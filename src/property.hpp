@@ -2,7 +2,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include "common.hpp"
+#include "util/string.hpp"
 
 constexpr const char *P_RAW_ROOT_PID = "_root_pid";
 constexpr const char *P_SEIZE_PID = "seize_pid";
@@ -203,6 +205,15 @@ constexpr int VIRT_MODE_APP = 0;
 constexpr int VIRT_MODE_OS = 1;
 constexpr const char *P_CMD_VIRT_MODE_OS = "/sbin/init";
 
+class TSubsystem;
+
+struct TTypedValue {
+    enum EType { None, Uint, Double, UintMap } Type = None;
+    uint64_t UintValue = 0;
+    double DoubleValue = 0;
+    TUintMap MapValue;
+};
+
 class TProperty {
 public:
     std::string Name;
@@ -211,6 +222,10 @@ public:
     bool IsSupported = true;
     bool IsReadOnly = false;
     bool IsHidden = false;
+
+    /* cgroup knobs read by Get, prefetched in bulk by combined get */
+    std::vector<std::pair<const TSubsystem *, std::string>> Knobs;
+
     TError IsAliveAndStopped(void);
     TError IsAlive(void);
     TError IsDead(void);
@@ -226,6 +241,11 @@ public:
     virtual TError GetIndexed(const std::string &index, std::string &value);
     virtual TError SetIndexed(const std::string &index, const std::string &value);
 
+    /* Typed values for clients who don't want to parse strings, NotSupported by default */
+    virtual TError GetUint(uint64_t &value);
+    virtual TError GetDouble(double &value);
+    virtual TError GetUintMap(TUintMap &value);
+
     virtual TError GetToSave(std::string &value);
     virtual TError SetFromRestore(const std::string &value);
 
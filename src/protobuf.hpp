@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <ostream>
 
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
@@ -14,3 +15,14 @@ bool WriteDelimitedTo(const google::protobuf::MessageLite& message,
                       google::protobuf::io::ZeroCopyOutputStream* rawOutput);
 
 TError ConnectToRpcServer(const std::string& path, int &fd);
+
+/* Message is printed only if log line is really formatted */
+struct TShortDebug {
+    const google::protobuf::Message &Msg;
+
+    TShortDebug(const google::protobuf::Message &msg) : Msg(msg) { }
+
+    friend std::ostream& operator<<(std::ostream& os, const TShortDebug &dbg) {
+        return os << dbg.Msg.ShortDebugString();
+    }
+};
@@ -5,6 +5,7 @@
 #include "version.hpp"
 #include "property.hpp"
 #include "container.hpp"
+#include "cgroup.hpp"
 #include "volume.hpp"
 #include "event.hpp"
 #include "protobuf.hpp"
@@ -36,6 +37,9 @@ static std::string RequestAsString(const rpc::TContainerRequest &req) {
                          req.setproperty().value();
     else if (req.has_getdata())
         return "dget " + req.getdata().name() + " " + req.getdata().data();
+    else if (req.has_batch())
+        return "batch " + req.batch().name() + " " +
+               std::to_string(req.batch().step_size()) + " steps";
     else if (req.has_get()) {
         std::string ret = "get";
 
@@ -74,6 +78,13 @@ static std::string RequestAsString(const rpc::TContainerRequest &req) {
         if (req.wait().has_timeout())
             ret += " timeout " + std::to_string(req.wait().timeout());
 
+        return ret;
+    } else if (req.has_subscribe()) {
+        std::string ret = "subscribe";
+
+        for (int i = 0; i < req.subscribe().name_size(); i++)
+            ret += " " + req.subscribe().name(i);
+
         return ret;
     } else if (req.has_createvolume()) {
         std::string ret = "volumeAPI: create " + req.createvolume().path();
@@ -153,6 +164,8 @@ static std::string ResponseAsString(const rpc::TContainerResponse &resp) {
                 ret = "Wait timeout";
             else
                 ret = "Wait " + resp.wait().name();
+        } else if (resp.has_subscribe()) {
+            ret = "Subscribed at " + std::to_string(resp.subscribe().seq());
         } else if (resp.has_convertpath())
             ret = resp.convertpath().path();
         else
@@ -245,6 +258,7 @@ static bool ValidRequest(const rpc::TContainerRequest &req) {
     return
         req.has_create() +
         req.has_createweak() +
+        req.has_batch() +
         req.has_destroy() +
         req.has_list() +
         req.has_getproperty() +
@@ -260,6 +274,7 @@ static bool ValidRequest(const rpc::TContainerRequest &req) {
         req.has_kill() +
         req.has_version() +
         req.has_wait() +
+        req.has_subscribe() +
         req.has_listvolumeproperties() +
         req.has_createvolume() +
         req.has_linkvolume() +
@@ -281,15 +296,38 @@ static bool ValidRequest(const rpc::TContainerRequest &req) {
         req.has_locateprocess() == 1;
 }
 
-static void SendReply(TClient &client, rpc::TContainerResponse &rsp, bool silent) {
-    if (!silent || Verbose)
+int RpcMethod(const rpc::TContainerRequest &req) {
+    auto desc = req.GetDescriptor();
+    auto refl = req.GetReflection();
+
+    /* request has exactly one method field, request_id is not message */
+    for (int i = 0; i < desc->field_count() && i < RPC_STAT_METHODS - 1; i++) {
+        auto field = desc->field(i);
+        if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE &&
+                refl->HasField(req, field))
+            return i;
+    }
+
+    return RPC_STAT_METHODS - 1;
+}
+
+std::string RpcMethodName(int method) {
+    auto desc = rpc::TContainerRequest::descriptor();
+
+    if (method < desc->field_count() && method < RPC_STAT_METHODS - 1)
+        return desc->field(method)->lowercase_name();
+
+    return "unknown";
+}
+
+static void SendReply(TClient &client, rpc::TContainerResponse &rsp, bool silent, int method) {
+    if ((!silent || LogEnabled(LOG_CAT_VERBOSE)) && LogEnabled(LOG_CAT_RESPONSE))
         L_RSP("{} to {} (request took {} ms)",
               ResponseAsString(rsp), client, client.RequestTimeMs);
 
-    if (Verbose)
-        L_RSP("{} to {}", rsp.ShortDebugString(), client);
+    L_VRB(LOG_RESPONSE, "{} to {}", TShortDebug(rsp), client);
 
-    TError error = client.QueueResponse(rsp);
+    TError error = client.QueueResponse(rsp, true, method);
     if (error)
         L_WRN("Cannot send response for {} : {}", client, error);
 }
@@ -300,7 +338,8 @@ static TError CheckPortoWriteAccess() {
     return TError::Success();
 }
 
-static noinline TError CreateContainer(std::string reqName, bool weak) {
+static noinline TError CreateContainer(std::string reqName, bool weak,
+                                       bool locked = false) {
     TError error = CheckPortoWriteAccess();
     if (error)
         return error;
@@ -311,7 +350,7 @@ static noinline TError CreateContainer(std::string reqName, bool weak) {
         return error;
 
     std::shared_ptr<TContainer> ct;
-    error = TContainer::Create(name, ct);
+    error = TContainer::Create(name, ct, locked);
     if (error)
         return error;
 
@@ -373,15 +412,15 @@ noinline TError ResumeContainer(const rpc::TContainerResumeRequest &req) {
 noinline TError ListContainers(const rpc::TContainerListRequest &req,
                                rpc::TContainerResponse &rsp) {
     std::string mask = req.has_mask() ? req.mask() : "***";
-    auto lock = LockContainers();
-    for (auto &it: Containers) {
-        auto &ct = it.second;
+    auto names = rsp.mutable_list()->mutable_name();
+    for (auto &ct: Containers.List()) {
         std::string name;
         if (ct->IsRoot() || CL->ComposeName(ct->Name, name) ||
                 !StringMatch(name, mask))
             continue;
-        rsp.mutable_list()->add_name(name);
+        *names->Add() = name;
     }
+    std::sort(names->begin(), names->end());
     return TError::Success();
 }
 
@@ -398,11 +437,8 @@ noinline TError GetContainerProperty(const rpc::TContainerGetPropertyRequest &re
     return error;
 }
 
-noinline TError SetContainerProperty(const rpc::TContainerSetPropertyRequest &req) {
-    std::string property = req.property();
-    std::string value = req.value();
-
-    /* legacy kludge */
+/* legacy kludge */
+static void LegacyProperty(std::string &property, std::string &value) {
     if (property.find('.') != std::string::npos) {
         if (property == "cpu.smart") {
             if (value == "0") {
@@ -421,6 +457,13 @@ noinline TError SetContainerProperty(const rpc::TContainerSetPropertyRequest &re
             value = value == "0" ? "false" : "true";
         }
     }
+}
+
+noinline TError SetContainerProperty(const rpc::TContainerSetPropertyRequest &req) {
+    std::string property = req.property();
+    std::string value = req.value();
+
+    LegacyProperty(property, value);
 
     std::shared_ptr<TContainer> ct;
     TError error = CL->WriteContainer(req.name(), ct);
@@ -430,6 +473,119 @@ noinline TError SetContainerProperty(const rpc::TContainerSetPropertyRequest &re
     return ct->SetProperty(property, value);
 }
 
+static void AddBatchResult(rpc::TContainerResponse &rsp, const TError &error) {
+    auto result = rsp.mutable_batch()->add_step();
+    result->set_error(error.GetError());
+    if (error)
+        result->set_errormsg(error.GetMsg());
+}
+
+noinline TError ContainerBatch(const rpc::TContainerBatchRequest &req,
+                               rpc::TContainerResponse &rsp) {
+    std::vector<TContainer::TPropertyState> changed;
+    std::shared_ptr<TContainer> ct;
+    bool created = false, started = false;
+    TError error;
+
+    if (!req.step_size())
+        return TError(EError::InvalidValue, "Empty batch");
+
+    for (int i = 0; i < req.step_size(); i++) {
+        auto &step = req.step(i);
+        if (step.create() + step.createweak() + step.has_property() +
+                step.start() + step.stop() != 1)
+            return TError(EError::InvalidMethod, "Batch step " + std::to_string(i) +
+                          " must have exactly one operation");
+        if (i && (step.create() || step.createweak()))
+            return TError(EError::InvalidValue, "Create must be first batch step");
+        /* Stopped task cannot be brought back by revert */
+        if (step.stop() && i != req.step_size() - 1)
+            return TError(EError::InvalidValue, "Stop must be last batch step");
+        if (step.has_property() && !step.has_value())
+            return TError(EError::InvalidValue, "No value for property " + step.property());
+    }
+
+    rsp.mutable_batch();
+
+    /* Created container is locked at once, nobody could touch it before */
+    if (req.step(0).create() || req.step(0).createweak()) {
+        error = CreateContainer(req.name(), req.step(0).createweak(), true);
+        AddBatchResult(rsp, error);
+        if (error)
+            return error;
+        created = true;
+        ct = CL->LockedContainer;
+    } else {
+        error = CL->WriteContainer(req.name(), ct);
+        if (error) {
+            AddBatchResult(rsp, error);
+            return error;
+        }
+    }
+
+    ct->DeferSave = true;
+
+    for (int i = created ? 1 : 0; i < req.step_size(); i++) {
+        auto &step = req.step(i);
+
+        if (step.has_property()) {
+            std::string property = step.property();
+            std::string value = step.value();
+            TContainer::TPropertyState state;
+
+            LegacyProperty(property, value);
+
+            /* Change which cannot be reverted must not be made */
+            error = ct->SavePropertyState(property, state);
+            if (!error)
+                error = ct->SetProperty(property, value);
+            if (!error)
+                changed.push_back(state);
+        } else if (step.start()) {
+            error = ct->Start();
+            started = !error;
+        } else if (step.stop()) {
+            error = ct->Stop(step.has_timeout_ms() ? step.timeout_ms() :
+                             config().container().stop_timeout_ms());
+        }
+
+        AddBatchResult(rsp, error);
+        if (error)
+            break;
+    }
+
+    if (error) {
+        L_ACT("Revert batch for {}: {}", ct->Name, error);
+
+        if (created) {
+            ct->DeferSave = false;
+            ct->SavePending = false;
+            (void)ct->Destroy();
+            return error;
+        }
+
+        if (started)
+            (void)ct->Stop(config().container().stop_timeout_ms());
+
+        for (auto it = changed.rbegin(); it != changed.rend(); it++) {
+            TError err = ct->RevertProperty(*it);
+            if (err)
+                L_WRN("Cannot revert {} for {}: {}", it->Name, ct->Name, err);
+        }
+    }
+
+    /* Save whatever state we end up with, even after revert */
+    ct->DeferSave = false;
+    if (ct->SavePending) {
+        ct->SavePending = false;
+        TError err = ct->Save();
+        if (!error)
+            error = err;
+    }
+
+    return error;
+}
+
 noinline TError GetContainerData(const rpc::TContainerGetDataRequest &req,
                                  rpc::TContainerResponse &rsp) {
     std::shared_ptr<TContainer> ct;
@@ -443,28 +599,76 @@ noinline TError GetContainerData(const rpc::TContainerGetDataRequest &req,
     return error;
 }
 
+static bool IsStaticProperty(const std::string &var) {
+    auto it = ContainerProperties.find(var.substr(0, var.find('[')));
+    return it != ContainerProperties.end() && !it->second->IsReadOnly &&
+        it->second->Prop != EProperty::NONE;
+}
+
+static void SetTypedValue(rpc::TContainerGetResponse::TContainerGetValueResponse &keyval,
+                          const TTypedValue &value) {
+    switch (value.Type) {
+    case TTypedValue::Uint:
+        keyval.set_value_uint(value.UintValue);
+        break;
+    case TTypedValue::Double:
+        keyval.set_value_double(value.DoubleValue);
+        break;
+    case TTypedValue::UintMap:
+        for (auto &it: value.MapValue) {
+            auto entry = keyval.add_value_map();
+            entry->set_key(it.first);
+            entry->set_val(it.second);
+        }
+        break;
+    case TTypedValue::None:
+        break;
+    }
+}
+
 static void FillGetResponse(const rpc::TContainerGetRequest &req,
                             rpc::TContainerGetResponse &rsp,
-                            std::string &name) {
+                            std::string &name,
+                            uint64_t since,
+                            TCgroupStat *stat = nullptr) {
     std::shared_ptr<TContainer> ct;
 
-    auto lock = LockContainers();
     TError containerError = CL->ResolveContainer(name, ct);
-    lock.unlock();
 
     auto entry = rsp.add_list();
     entry->set_name(name);
+
+    /* configured properties cannot change without bumping generation */
+    bool unchanged = !containerError && ct->ChangeGeneration() <= since;
+    bool typed = req.has_typed() && req.typed();
+
+    /* read each cgroup knob once for all requested properties */
+    TCgroupStatCache statCache(stat);
+
     for (int j = 0; j < req.variable_size(); j++) {
         auto var = req.variable(j);
 
+        if (unchanged && IsStaticProperty(var))
+            continue;
+
         auto keyval = entry->add_keyval();
         std::string value;
 
+        keyval->set_variable(var);
+
+        if (typed && !containerError) {
+            TTypedValue typedValue;
+            if (!ct->GetTypedProperty(var, typedValue)) {
+                SetTypedValue(*keyval, typedValue);
+                continue;
+            }
+            /* otherwise string value or error as usual */
+        }
+
         TError error = containerError;
         if (!error)
             error = ct->GetProperty(var, value);
 
-        keyval->set_variable(var);
         if (error) {
             keyval->set_error(error.GetError());
             keyval->set_errormsg(error.GetMsg());
@@ -489,21 +693,23 @@ noinline TError GetContainerCombined(const rpc::TContainerGetRequest &req,
     }
 
     if (!masks.empty()) {
-        auto lock = LockContainers();
-        for (auto &it: Containers) {
-            auto &ct = it.second;
+        std::vector<std::string> matched;
+
+        for (auto &ct: Containers.List()) {
             std::string name;
             if (ct->IsRoot() || CL->ComposeName(ct->Name, name))
                 continue;
-            if (masks.empty())
-                names.push_back(name);
             for (auto &mask: masks) {
                 if (StringMatch(name, mask)) {
-                    names.push_back(name);
+                    matched.push_back(name);
                     break;
                 }
             }
         }
+
+        /* sort only matched names */
+        std::sort(matched.begin(), matched.end());
+        names.insert(names.end(), matched.begin(), matched.end());
     }
 
     /* Lock all containers for read. TODO: lock only common ancestor */
@@ -514,8 +720,49 @@ noinline TError GetContainerCombined(const rpc::TContainerGetRequest &req,
     if (error)
         return error;
 
-    for (auto &name: names)
-        FillGetResponse(req, *get, name);
+    uint64_t generation = ContainerGeneration;
+    uint64_t since = req.has_since_generation() ? req.since_generation() : 0;
+
+    /* generation from future belongs to another daemon, return everything */
+    if (since > generation)
+        since = 0;
+
+    get->set_generation(generation);
+
+    /* read stat knobs of all containers in bulk before filling response */
+    std::vector<TCgroupStat> stats;
+
+    if (config().daemon().stat_io_uring()) {
+        TCgroupPrefetch prefetch;
+        size_t index = 0;
+
+        stats.resize(names.size());
+        for (auto &name: names) {
+            std::shared_ptr<TContainer> ct;
+            auto &stat = stats[index++];
+
+            if (CL->ResolveContainer(name, ct) ||
+                    ct->State == EContainerState::Stopped)
+                continue;
+
+            for (int i = 0; i < req.variable_size(); i++) {
+                auto var = req.variable(i);
+                auto prop = ContainerProperties.find(var.substr(0, var.find('[')));
+                if (prop == ContainerProperties.end())
+                    continue;
+                for (auto &knob: prop->second->Knobs)
+                    prefetch.Add(stat, ct->GetCgroup(*knob.first), knob.second);
+            }
+        }
+
+        (void)prefetch.Run();
+    }
+
+    size_t index = 0;
+    for (auto &name: names) {
+        auto stat = stats.empty() ? nullptr : &stats[index++];
+        FillGetResponse(req, *get, name, since, stat);
+    }
 
     RootContainer->Unlock();
 
@@ -575,12 +822,19 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
     if (!req.name_size())
         return TError(EError::InvalidValue, "Containers are not specified");
 
-    auto fn = [] (std::shared_ptr<TClient> client,
-                  TError error, std::string name) {
+    bool hasId = rsp.has_request_id();
+    uint64_t id = rsp.request_id();
+    int method = client->RequestMethod;
+
+    /* called by other threads while worker handles next request */
+    auto fn = [hasId, id, method] (std::shared_ptr<TClient> client,
+                                   TError error, std::string name) {
         rpc::TContainerResponse response;
+        if (hasId)
+            response.set_request_id(id);
         response.set_error(error.GetError());
         response.mutable_wait()->set_name(name);
-        SendReply(*client, response, !error && name.empty());
+        SendReply(*client, response, !error && name.empty(), method);
     };
 
     auto waiter = std::make_shared<TContainerWaiter>(client, fn);
@@ -615,8 +869,7 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
     }
 
     if (!waiter->Wildcards.empty()) {
-        for (auto &it: Containers) {
-            auto &ct = it.second;
+        for (auto &ct: Containers.List()) {
             if (ct->IsRoot())
                 continue;
 
@@ -643,17 +896,42 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
         return TError::Success();
     }
 
-    client->Waiter = waiter;
+    client->Waiters.push_back(waiter);
 
     if (req.has_timeout()) {
         TEvent e(EEventType::WaitTimeout, nullptr);
         e.WaitTimeout.Waiter = waiter;
-        EventQueue->Add(req.timeout(), e);
+        uint64_t timer = EventQueue->Add(req.timeout(), e), none = 0;
+        /* container could wake up waiter already */
+        if (!waiter->Timer.compare_exchange_strong(none, timer))
+            EventQueue->Cancel(timer);
     }
 
     return TError::Queued();
 }
 
+noinline TError Subscribe(const rpc::TContainerSubscribeRequest &req,
+                          rpc::TContainerResponse &rsp,
+                          std::shared_ptr<TClient> &client) {
+    if (!req.name_size()) {
+        client->SetSubscriber(nullptr);
+        return TError::Success();
+    }
+
+    std::vector<std::string> names(req.name().begin(), req.name().end());
+    auto subscriber = std::make_shared<TContainerSubscriber>(client, names,
+                            rsp.has_request_id(), rsp.request_id());
+
+    client->SetSubscriber(subscriber);
+    TContainerSubscriber::Add(subscriber, [&] (uint64_t seq) {
+        rsp.set_error(EError::Success);
+        rsp.mutable_subscribe()->set_seq(seq);
+        SendReply(*client, rsp, false, client->RequestMethod);
+    });
+
+    return TError::Queued();
+}
+
 noinline TError ConvertPath(const rpc::TConvertPathRequest &req,
                             rpc::TContainerResponse &rsp) {
     std::shared_ptr<TContainer> src, dst;
@@ -1169,13 +1447,14 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
     client->StartRequest();
 
     bool silent = SilentRequest(req);
-    if (!silent || Verbose)
+    if ((!silent || LogEnabled(LOG_CAT_VERBOSE)) && LogEnabled(LOG_CAT_REQUEST))
         L_REQ("{} from {}", RequestAsString(req), *client);
 
-    if (Verbose)
-        L_REQ("{} from {}", req.ShortDebugString(), *client);
+    L_VRB(LOG_REQUEST, "{} from {}", TShortDebug(req), *client);
 
     rsp.set_error(EError::Unknown);
+    if (req.has_request_id())
+        rsp.set_request_id(req.request_id());
 
     TError error;
     try {
@@ -1194,6 +1473,8 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
             error = GetContainerProperty(req.getproperty(), rsp);
         else if (req.has_setproperty())
             error = SetContainerProperty(req.setproperty());
+        else if (req.has_batch())
+            error = ContainerBatch(req.batch(), rsp);
         else if (req.has_getdata())
             error = GetContainerData(req.getdata(), rsp);
         else if (req.has_get())
@@ -1216,6 +1497,8 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
             error = Version(rsp);
         else if (req.has_wait())
             error = Wait(req.wait(), rsp, client);
+        else if (req.has_subscribe())
+            error = Subscribe(req.subscribe(), rsp, client);
         else if (req.has_listvolumeproperties())
             error = ListVolumeProperties(rsp);
         else if (req.has_createvolume())
@@ -1270,18 +1553,24 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
         error = TError(EError::Unknown, "unknown error");
     }
 
-    client->FinishRequest();
+    TError commitError = client->FinishRequest();
+    if (commitError && !error)
+        error = commitError;
 
     if (error.GetError() != EError::Queued) {
+        if (req.has_request_id())
+            rsp.set_request_id(req.request_id());
         rsp.set_error(error.GetError());
         rsp.set_errormsg(error.GetMsg());
 
         /* log failed or slow silent requests */
-        if (silent && !Verbose && (error || client->RequestTimeMs >= 1000)) {
+        if (silent && !LogEnabled(LOG_CAT_VERBOSE) &&
+                (error || client->RequestTimeMs >= 1000) &&
+                LogEnabled(LOG_CAT_REQUEST)) {
             L_REQ("{} from {}", RequestAsString(req), *client);
             silent = false;
         }
 
-        SendReply(*client, rsp, silent && !error);
+        SendReply(*client, rsp, silent && !error, client->RequestMethod);
     }
 }
@@ -5,3 +5,7 @@
 
 void HandleRpcRequest(const rpc::TContainerRequest &req,
 		      std::shared_ptr<TClient> client);
+
+/* Index of request method in TStatistics::Rpc */
+int RpcMethod(const rpc::TContainerRequest &req);
+std::string RpcMethodName(int method);
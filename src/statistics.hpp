@@ -1,6 +1,24 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+
+/* Latency phases of one rpc request */
+enum ERpcPhase {
+    RPC_PHASE_QUEUE,    /* from receive or previous pipelined request till worker picks it */
+    RPC_PHASE_LOCK,     /* waiting for container locks */
+    RPC_PHASE_EXEC,     /* handling without lock waits */
+    RPC_PHASE_SEND,     /* from queueing response till output is sent */
+    RPC_PHASE_NR,
+};
+
+constexpr int RPC_STAT_METHODS = 64;    /* last one is for unknown */
+constexpr int RPC_STAT_BUCKETS = 32;    /* bucket N counts [2^(N-1), 2^N) us, 0 - [0, 1) */
+
+struct TRpcStat {
+    std::atomic<uint64_t> Count;
+    std::atomic<uint64_t> Hist[RPC_PHASE_NR][RPC_STAT_BUCKETS];
+};
 
 struct TStatistics {
     std::atomic<uint64_t> Spawned;
@@ -10,6 +28,8 @@ struct TStatistics {
     std::atomic<uint64_t> SlaveStarted;
     std::atomic<uint64_t> QueuedStatuses;
     std::atomic<uint64_t> QueuedEvents;
+    std::atomic<uint64_t> EventLagMs;
+    std::atomic<uint64_t> CancelledEvents;
     std::atomic<uint64_t> ContainersCreated;
     std::atomic<uint64_t> ContainersStarted;
     std::atomic<uint64_t> ContainersFailedStart;
@@ -18,7 +38,19 @@ struct TStatistics {
     std::atomic<int> SlaveTimeoutMs;
     std::atomic<uint64_t> LogRotateBytes;
     std::atomic<uint64_t> LogRotateErrors;
+    std::atomic<uint64_t> LogDropped;
+    std::atomic<uint64_t> KvSaves;
+    std::atomic<uint64_t> KvWrites;
+    std::atomic<uint64_t> KvBatches;
+    std::atomic<uint64_t> KvCoalesced;
     std::atomic<uint64_t> RestoreFailed;
+    std::atomic<uint64_t> RestoreTimeMs;
+    std::atomic<uint64_t> StartupTimeMs;
+    std::atomic<uint64_t> HandoffContainers;
+    std::atomic<uint64_t> HandoffVolumes;
+    std::atomic<uint64_t> HandoffClients;
+    std::atomic<uint64_t> HandoffUnverified;
+    std::atomic<uint64_t> PidfdExits;
     std::atomic<uint64_t> EpollSources;
     std::atomic<uint64_t> ContainersCount;
     std::atomic<uint64_t> VolumesCount;
@@ -29,6 +61,17 @@ struct TStatistics {
     std::atomic<uint64_t> RequestsLonger3s;
     std::atomic<uint64_t> RequestsLonger30s;
     std::atomic<uint64_t> RequestsLonger5m;
+    TRpcStat Rpc[RPC_STAT_METHODS];
 };
 
 extern TStatistics *Statistics;
+
+static inline int RpcStatBucket(uint64_t us) {
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    return bucket < RPC_STAT_BUCKETS ? bucket : RPC_STAT_BUCKETS - 1;
+}
+
+/* Lock-free, relaxed counters are enough for statistics */
+static inline void RecordRpcPhase(int method, ERpcPhase phase, uint64_t us) {
+    Statistics->Rpc[method].Hist[phase][RpcStatBucket(us)].fetch_add(1, std::memory_order_relaxed);
+}
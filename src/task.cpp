@@ -1,6 +1,7 @@
 #include <climits>
 #include <sstream>
 #include <iterator>
+#include <list>
 #include <csignal>
 
 #include "task.hpp"
@@ -19,6 +20,7 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <wordexp.h>
@@ -401,19 +403,33 @@ void TTaskEnv::StartChild() {
 
 TError TTaskEnv::Start() {
     TError error, error2;
+    pid_t waitPid;
 
     CT->Task.Pid = 0;
     CT->TaskVPid = 0;
-    CT->WaitTask.Pid = 0;
-    CT->SeizeTask.Pid = 0;
+    CT->SetTaskPid(CT->WaitTask, 0);
+    CT->SetTaskPid(CT->SeizeTask, 0);
 
     error = TUnixSocket::SocketPair(MasterSock, Sock);
     if (error)
         return error;
 
-    // we want our child to have portod master as parent, so we
-    // are doing double fork here (fork + clone);
+    // we are doing double fork here (fork + clone), wait task is
+    // reparented to portod master unless slave can watch it via pidfd,
+    // then it is cloned as our own child to be reaped by slave;
     // we also need to know child pid so we are using pipe to send it back
+    bool slaveReaps = PidFdSupported();
+
+    /* Child only writes itself into cgroups opened here */
+    std::list<TFile> procs;
+    for (auto &cg : Cgroups) {
+        procs.emplace_back();
+        error = cg.OpenAttach(procs.back());
+        if (error) {
+            Sock.Close();
+            return error;
+        }
+    }
 
     TTask task;
 
@@ -444,11 +460,13 @@ TError TTaskEnv::Start() {
         (void)setsid();
 
         // move to target cgroups
-        for (auto &cg : Cgroups) {
-            error = cg.Attach(GetPid());
+        auto cg = Cgroups.begin();
+        for (auto &file : procs) {
+            error = (cg++)->AttachSelf(file);
             if (error)
                 Abort(error);
         }
+        procs.clear();
 
         error = TPath("/proc/self/oom_score_adj").WriteAll(std::to_string(CT->OomScoreAdj));
         if (error && CT->OomScoreAdj)
@@ -483,9 +501,12 @@ TError TTaskEnv::Start() {
         if (TripleFork) {
             /*
              * Enter into pid-namespace. fork() hangs in libc if child pid
-             * collide with parent pid outside. vfork() has no such problem.
+             * collide with parent pid outside. vfork() has no such problem,
+             * as well as raw clone() which bypasses libc fork handlers.
              */
-            pid_t forkPid = vfork();
+            pid_t forkPid = slaveReaps ?
+                syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0) :
+                vfork();
             if (forkPid < 0)
                 Abort(TError(EError::Unknown, errno, "fork()"));
 
@@ -501,6 +522,8 @@ TError TTaskEnv::Start() {
         }
 
         int cloneFlags = SIGCHLD;
+        if (slaveReaps && !TripleFork)
+            cloneFlags |= CLONE_PARENT;
         if (CT->Isolate)
             cloneFlags |= CLONE_NEWPID | CLONE_NEWIPC;
 
@@ -563,15 +586,18 @@ TError TTaskEnv::Start() {
     }
 
     Sock.Close();
+    procs.clear();
 
     error = MasterSock.SetRecvTimeout(config().container().start_timeout_ms());
     if (error)
         goto kill_all;
 
-    error = MasterSock.RecvPid(CT->WaitTask.Pid, CT->TaskVPid);
+    error = MasterSock.RecvPid(waitPid, CT->TaskVPid);
     if (error)
         goto kill_all;
 
+    CT->SetTaskPid(CT->WaitTask, waitPid);
+
     /* Ack WPid */
     error = MasterSock.SendZero();
     if (error)
@@ -608,7 +634,7 @@ kill_all:
     }
     CT->Task.Pid = 0;
     CT->TaskVPid = 0;
-    CT->WaitTask.Pid = 0;
-    CT->SeizeTask.Pid = 0;
+    CT->SetTaskPid(CT->WaitTask, 0);
+    CT->SetTaskPid(CT->SeizeTask, 0);
     return error;
 }
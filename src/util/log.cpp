@@ -1,4 +1,7 @@
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "statistics.hpp"
 #include "log.hpp"
@@ -11,9 +14,14 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/uio.h>
+#include <pthread.h>
 }
 
 bool Verbose;
+unsigned LogCategories = (1u << LOG_CAT_ACTION) | (1u << LOG_CAT_REQUEST) |
+                         (1u << LOG_CAT_RESPONSE) | (1u << LOG_CAT_CGROUP);
 
 TStatistics *Statistics = nullptr;
 
@@ -39,6 +47,215 @@ protected:
 static __thread TLogBuf *logBuf;
 static __thread std::ostream *logStream;
 
+/*
+ * Bounded multi-producer ring by Dmitry Vyukov: slot sequence tells
+ * whether it is free for position or holds message written at position.
+ * Producers take positions with CAS, single flusher consumes in order.
+ */
+class TLogQueue {
+    struct TSlot {
+        std::atomic<uint64_t> Seq;
+        time_t Time;
+        std::string Msg;
+    };
+
+    std::vector<TSlot> Slots;
+    uint64_t Mask;
+    std::atomic<uint64_t> Head;
+    uint64_t Tail = 0;          /* protected with FlushMutex */
+
+    std::mutex WakeMutex;
+    std::condition_variable WakeCv;
+    std::atomic<bool> Sleeping;
+
+public:
+    std::mutex FlushMutex;
+    bool Block;
+
+    TLogQueue(size_t size, bool block) : Slots(size), Mask(size - 1),
+                                         Head(0), Sleeping(false), Block(block) {
+        for (size_t i = 0; i < size; i++)
+            Slots[i].Seq = i;
+    }
+
+    bool Push(time_t time, std::string &msg) {
+        uint64_t pos = Head.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto &slot = Slots[pos & Mask];
+            int64_t diff = slot.Seq.load(std::memory_order_acquire) - pos;
+
+            if (diff == 0) {
+                if (Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.Time = time;
+                    slot.Msg.swap(msg);
+                    slot.Seq.store(pos + 1, std::memory_order_release);
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else
+                pos = Head.load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (Sleeping.load(std::memory_order_relaxed))
+            Wake();
+
+        return true;
+    }
+
+    /* under FlushMutex */
+    bool Pop(time_t &time, std::string &msg) {
+        auto &slot = Slots[Tail & Mask];
+
+        if (slot.Seq.load(std::memory_order_acquire) != Tail + 1)
+            return false;
+
+        time = slot.Time;
+        msg.swap(slot.Msg);
+        slot.Seq.store(Tail + Mask + 1, std::memory_order_release);
+        Tail++;
+        return true;
+    }
+
+    void Wake() {
+        std::unique_lock<std::mutex> lock(WakeMutex);
+        WakeCv.notify_one();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(WakeMutex);
+        Sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto &slot = Slots[Tail & Mask];
+        if (slot.Seq.load(std::memory_order_acquire) != Tail + 1)
+            WakeCv.wait_for(lock, std::chrono::milliseconds(100));
+        Sleeping = false;
+    }
+
+    size_t Flush();
+    void Run();
+};
+
+static TLogQueue *logQueue;
+/* Flusher thread exists only in original process, forked children log synchronously */
+static bool logAsync;
+static uint64_t logDropped;
+
+static void WriteLogIov(struct iovec *iov, int count) {
+    while (count) {
+        ssize_t ret = writev(logBufFd, iov, count);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (count && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+}
+
+/* Writes queued messages in batches, under FlushMutex */
+size_t TLogQueue::Flush() {
+    constexpr int batch = 256;
+    static std::string msgs[batch], stamps[batch];
+    struct iovec iov[batch * 2 + 1];
+    std::string dropped;
+    size_t total = 0;
+    time_t time, last = 0;
+    int count, stamp = -1;
+
+    do {
+        int nr_iov = 0;
+
+        if (Statistics && Statistics->LogDropped != logDropped) {
+            uint64_t nr = Statistics->LogDropped;
+            dropped = FormatTime(::time(nullptr)) + " portod-log: WRN Dropped " +
+                      std::to_string(nr - logDropped) + " messages\n";
+            logDropped = nr;
+            iov[nr_iov++] = { (void *)dropped.data(), dropped.size() };
+        }
+
+        for (count = 0; count < batch && Pop(time, msgs[count]); count++) {
+            if (time != last || stamp < 0) {
+                stamps[++stamp] = FormatTime(time) + " ";
+                last = time;
+            }
+            iov[nr_iov++] = { (void *)stamps[stamp].data(), stamps[stamp].size() };
+            iov[nr_iov++] = { (void *)msgs[count].data(), msgs[count].size() };
+        }
+
+        WriteLogIov(iov, nr_iov);
+        total += count;
+        stamp = -1;
+    } while (count == batch);
+
+    return total;
+}
+
+void TLogQueue::Run() {
+    SetProcessName("portod-log");
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(FlushMutex);
+            while (Flush());
+        }
+        Wait();
+    }
+}
+
+/* Serializes changes of log fd with flusher */
+static std::unique_lock<std::mutex> LockLogFlush() {
+    if (logAsync)
+        return std::unique_lock<std::mutex>(logQueue->FlushMutex);
+    return std::unique_lock<std::mutex>();
+}
+
+void TLogger::StartAsync(size_t size, bool block) {
+    /* flusher is not restarted, it works till exit */
+    if (!size || logQueue)
+        return;
+
+    /* round up to power of two */
+    size_t slots = 1;
+    while (slots < size)
+        slots <<= 1;
+
+    if (Statistics)
+        logDropped = Statistics->LogDropped;
+
+    logQueue = new TLogQueue(slots, block);
+    std::thread(&TLogQueue::Run, logQueue).detach();
+    logAsync = true;
+    pthread_atfork(nullptr, nullptr, [] { logAsync = false; });
+}
+
+void TLogger::StopAsync() {
+    if (!logAsync)
+        return;
+
+    logAsync = false;
+
+    /* flusher might be stuck or crashed, do not wait it forever */
+    for (int i = 0; i < 1000; i++) {
+        if (logQueue->FlushMutex.try_lock()) {
+            logQueue->Flush();
+            logQueue->FlushMutex.unlock();
+            break;
+        }
+        usleep(1000);
+    }
+}
+
 static inline void PrepareLog() {
     if (!logBuf) {
         logBuf = new TLogBuf(1024);
@@ -48,6 +265,7 @@ static inline void PrepareLog() {
 
 void TLogger::OpenLog(bool std, const TPath &path, const unsigned int mode) {
     PrepareLog();
+    auto lock = LockLogFlush();
     if (std) {
         // because in task.cpp we expect that nothing should be in 0-2 fd,
         // we need to duplicate our std log somewhere else
@@ -75,6 +293,9 @@ int TLogger::GetFd() {
 
 void TLogger::CloseLog() {
     PrepareLog();
+    auto lock = LockLogFlush();
+    if (lock)
+        logQueue->Flush();
     int fd = logBuf->GetFd();
     if (fd > 2)
         close(fd);
@@ -146,6 +367,23 @@ void TLogger::Log(std::string log_msg, ELogLevel level) {
     if (level == LOG_ERROR && Verbose)
         Stacktrace();
 
+    if (logAsync) {
+        std::string msg = name + "[" + std::to_string(GetTid()) + "]: " +
+                          prefix[level] + log_msg + "\n";
+        time_t now = time(nullptr);
+
+        while (!logQueue->Push(now, msg)) {
+            if (!logQueue->Block) {
+                if (Statistics)
+                    Statistics->LogDropped++;
+                break;
+            }
+            logQueue->Wake();
+            sched_yield();
+        }
+        return;
+    }
+
     std::string msg = FormatTime(time(nullptr)) + " " + name + "[" + 
                       std::to_string(GetTid()) + "]: " + prefix[level] + log_msg;
 
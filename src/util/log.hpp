@@ -14,6 +14,27 @@
 
 extern bool Verbose;
 
+/* Optional messages, formatting is skipped when category is disabled */
+enum ELogCategory {
+    LOG_CAT_ACTION = 0,
+    LOG_CAT_REQUEST = 1,
+    LOG_CAT_RESPONSE = 2,
+    LOG_CAT_CGROUP = 3,     /* cgroup knob writes */
+    LOG_CAT_LOCK = 4,       /* container locking, debug only */
+    LOG_CAT_VERBOSE = 5,    /* silent requests and whole messages */
+};
+
+extern unsigned LogCategories;
+
+static inline bool LogEnabled(ELogCategory category) {
+#ifndef PORTO_DEBUG_LOG
+    /* compiled out unless build asks for it */
+    if (category == LOG_CAT_LOCK)
+        return false;
+#endif
+    return LogCategories & (1u << category);
+}
+
 enum ELogLevel {
     LOG_NOTICE = 0,
     LOG_WARN = 1,
@@ -33,6 +54,15 @@ public:
     static void DisableLog();
     static int GetFd();
     static void Log(std::string log_msg, ELogLevel level = LOG_NOTICE);
+
+    /*
+     * Messages are queued into lock-free ring of given size and written in
+     * batches by flusher thread. Forked and cloned children log synchronously.
+     * When ring is full message is dropped and counted or caller waits.
+     */
+    static void StartAsync(size_t size, bool block);
+    /* Writes queued messages and switches to synchronous logging for crash */
+    static void StopAsync();
 };
 
 template <typename... Args> inline void L(const char* fmt, const Args&... args) {
@@ -52,15 +82,34 @@ template <typename... Args> inline void L_EVT(const char* fmt, const Args&... ar
 }
 
 template <typename... Args> inline void L_ACT(const char* fmt, const Args&... args) {
-    TLogger::Log(fmt::format(fmt, args...), LOG_ACTION);
+    if (LogEnabled(LOG_CAT_ACTION))
+        TLogger::Log(fmt::format(fmt, args...), LOG_ACTION);
 }
 
 template <typename... Args> inline void L_REQ(const char* fmt, const Args&... args) {
-    TLogger::Log(fmt::format(fmt, args...), LOG_REQUEST);
+    if (LogEnabled(LOG_CAT_REQUEST))
+        TLogger::Log(fmt::format(fmt, args...), LOG_REQUEST);
 }
 
 template <typename... Args> inline void L_RSP(const char* fmt, const Args&... args) {
-    TLogger::Log(fmt::format(fmt, args...), LOG_RESPONSE);
+    if (LogEnabled(LOG_CAT_RESPONSE))
+        TLogger::Log(fmt::format(fmt, args...), LOG_RESPONSE);
+}
+
+template <typename... Args> inline void L_CG(const char* fmt, const Args&... args) {
+    if (LogEnabled(LOG_CAT_CGROUP))
+        TLogger::Log(fmt::format(fmt, args...), LOG_ACTION);
+}
+
+template <typename... Args> inline void L_LCK(const char* fmt, const Args&... args) {
+    if (LogEnabled(LOG_CAT_LOCK))
+        TLogger::Log(fmt::format(fmt, args...), LOG_NOTICE);
+}
+
+/* Level keeps prefix of request or response */
+template <typename... Args> inline void L_VRB(ELogLevel level, const char* fmt, const Args&... args) {
+    if (LogEnabled(LOG_CAT_VERBOSE))
+        TLogger::Log(fmt::format(fmt, args...), level);
 }
 
 template <typename... Args> inline void L_SYS(const char* fmt, const Args&... args) {
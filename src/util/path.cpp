@@ -1211,6 +1211,31 @@ TError TFile::ReadAll(std::string &text, size_t max) const {
     return TError::Success();
 }
 
+/* Rereads from start without seek, short read is treated as end of file */
+TError TFile::PreadAll(std::string &text, size_t max) const {
+    size_t size = std::max(text.capacity(), (size_t)4096);
+    size_t off = 0;
+    ssize_t ret;
+
+    text.resize(size);
+    while (1) {
+        ret = pread(Fd, &text[off], size - off, off);
+        if (ret < 0)
+            return TError(EError::Unknown, errno, "pread");
+        off += ret;
+        if (off < size)
+            break;
+        size += 16384;
+        if (size > max)
+            return TError(EError::Unknown, "File too large: " + std::to_string(size));
+        text.resize(size);
+    }
+
+    text.resize(off);
+
+    return TError::Success();
+}
+
 TError TFile::WriteAll(const std::string &text) const {
     size_t len = text.length(), off = 0;
     do {
@@ -0,0 +1,94 @@
+#include "util/scan.hpp"
+#include "util/path.hpp"
+
+/* memchr and memcmp in libc are vectorized, no need for own simd */
+
+bool TTextScanner::NextLine(TStringRef &line) {
+    if (Pos >= End)
+        return false;
+
+    const char *eol = (const char *)memchr(Pos, '\n', End - Pos);
+    if (!eol)
+        eol = End;
+
+    line = TStringRef(Pos, eol - Pos);
+    Pos = eol < End ? eol + 1 : End;
+    return true;
+}
+
+bool TTextScanner::NextWord(TStringRef &word, char sep) {
+    while (Pos < End && (*Pos == sep || *Pos == ' ' || *Pos == '\t'))
+        Pos++;
+
+    const char *begin = Pos;
+    while (Pos < End && *Pos != sep && *Pos != '\n')
+        Pos++;
+
+    word = TStringRef(begin, Pos - begin);
+    return Pos != begin;
+}
+
+bool TTextScanner::NextField(TStringRef &field, char sep) {
+    if (Pos >= End)
+        return false;
+
+    const char *end = (const char *)memchr(Pos, sep, End - Pos);
+    if (!end)
+        end = End;
+
+    field = TStringRef(Pos, end - Pos);
+    Pos = end < End ? end + 1 : End;
+    return true;
+}
+
+bool TTextScanner::NextUint64(uint64_t &value) {
+    while (Pos < End && (*Pos == ' ' || *Pos == '\t' || *Pos == '\n'))
+        Pos++;
+
+    if (Pos >= End || *Pos < '0' || *Pos > '9')
+        return false;
+
+    uint64_t val = 0;
+    do {
+        unsigned digit = *Pos - '0';
+        if (val > (UINT64_MAX - digit) / 10)
+            return false;
+        val = val * 10 + digit;
+        Pos++;
+    } while (Pos < End && *Pos >= '0' && *Pos <= '9');
+
+    value = val;
+    return true;
+}
+
+bool TTextScanner::NextInt(int &value) {
+    while (Pos < End && (*Pos == ' ' || *Pos == '\t' || *Pos == '\n'))
+        Pos++;
+
+    bool neg = Pos < End && *Pos == '-';
+    if (neg)
+        Pos++;
+
+    uint64_t val;
+    if (!NextUint64(val) || val > (uint64_t)INT32_MAX + neg)
+        return false;
+
+    value = neg ? -(int64_t)val : val;
+    return true;
+}
+
+TError ReadFileBuffer(const TPath &path, const std::string *&text) {
+    static thread_local std::string buffer;
+    TFile file;
+
+    TError error = file.OpenRead(path);
+    if (error)
+        return error;
+
+    error = file.ReadAll(buffer, 16 << 20);
+    if (error)
+        return TError(error, path.ToString());
+
+    text = &buffer;
+    return TError::Success();
+}
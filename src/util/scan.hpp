@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#include "util/error.hpp"
+
+class TPath;
+
+/*
+ * Allocation-free parsing of procfs and cgroupfs text.
+ * Scanner walks over caller's buffer and never copies it.
+ */
+
+struct TStringRef {
+    const char *Data = nullptr;
+    size_t Size = 0;
+
+    TStringRef() { }
+    TStringRef(const char *data, size_t size) : Data(data), Size(size) { }
+
+    bool Empty() const { return !Size; }
+    std::string ToString() const { return std::string(Data, Size); }
+
+    friend bool operator==(const TStringRef &lhs, const std::string &rhs) {
+        return lhs.Size == rhs.size() && !memcmp(lhs.Data, rhs.data(), lhs.Size);
+    }
+
+    friend bool operator!=(const TStringRef &lhs, const std::string &rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator==(const TStringRef &lhs, const char *rhs) {
+        return strlen(rhs) == lhs.Size && !memcmp(lhs.Data, rhs, lhs.Size);
+    }
+};
+
+class TTextScanner {
+    const char *Pos;
+    const char *End;
+
+public:
+    TTextScanner(const char *data, size_t size) : Pos(data), End(data + size) { }
+    TTextScanner(const std::string &text) : TTextScanner(text.data(), text.size()) { }
+    TTextScanner(const TStringRef &ref) : TTextScanner(ref.Data, ref.Size) { }
+
+    bool Eof() const { return Pos >= End; }
+
+    /* Next line without trailing newline */
+    bool NextLine(TStringRef &line);
+
+    /* Skips separators and returns next non-empty word till separator or newline */
+    bool NextWord(TStringRef &word, char sep = ' ');
+
+    /* Part till separator, might be empty, separator is consumed */
+    bool NextField(TStringRef &field, char sep);
+
+    /* Skips leading whitespaces, fails on overflow or missing digits */
+    bool NextUint64(uint64_t &value);
+    bool NextInt(int &value);
+};
+
+/*
+ * Reads whole file into thread-local buffer which keeps its capacity.
+ * Result is valid till next call in the same thread.
+ */
+TError ReadFileBuffer(const TPath &path, const std::string *&text);
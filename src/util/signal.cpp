@@ -93,6 +93,7 @@ void Stacktrace() {
 }
 
 void Crash() {
+    TLogger::StopAsync();
     L_ERR("Crashed");
     Stacktrace();
 
@@ -103,6 +104,7 @@ void Crash() {
 }
 
 void FatalSignal(int sig) {
+    TLogger::StopAsync();
     L_ERR("Fatal signal: {}", std::string(strsignal(sig)));
     Stacktrace();
 
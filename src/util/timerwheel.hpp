@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+#include "common.hpp"
+
+/*
+ * Hierarchical timer wheel with millisecond tick: 4 levels of 64 slots,
+ * slot of level N spans 64^N ms. Timers due later than 2^24 ms are parked
+ * in the top level and cascaded again. Add, Cancel and expiry are O(1),
+ * next tick is found by one bit scan per level. Not thread-safe.
+ */
+
+template <typename T>
+class TTimerWheel : public TNonCopyable {
+    static constexpr int LEVELS = 4;
+    static constexpr int BITS = 6;
+    static constexpr int SLOTS = 1 << BITS;
+    static constexpr uint64_t SPAN = 1ull << (BITS * LEVELS);
+
+    struct TTimer {
+        uint64_t Id;
+        uint64_t DueMs;
+        T Value;
+    };
+
+    typedef std::list<TTimer> TSlot;
+
+    struct TPosition {
+        TSlot *Slot;
+        typename TSlot::iterator Iter;
+    };
+
+    TSlot Wheel[LEVELS][SLOTS];
+    uint64_t Occupied[LEVELS] = {};     /* bitmap of non-empty slots */
+    TSlot Ready;                        /* expired but not taken yet */
+    std::unordered_map<uint64_t, TPosition> Index;
+    uint64_t Now;                       /* ticks till now are processed */
+    uint64_t NextId = 1;
+
+    void Place(TSlot &from, typename TSlot::iterator it) {
+        TSlot *slot = &Ready;
+
+        if (it->DueMs > Now) {
+            uint64_t due = std::min(it->DueMs, Now + SPAN - 1);
+            uint64_t delta = due - Now;
+            int level = 0;
+
+            while (level < LEVELS - 1 && delta >= (1ull << (BITS * (level + 1))))
+                level++;
+
+            int index = (due >> (BITS * level)) & (SLOTS - 1);
+            slot = &Wheel[level][index];
+            Occupied[level] |= 1ull << index;
+        }
+
+        slot->splice(slot->end(), from, it);
+        Index[it->Id] = TPosition{slot, it};
+    }
+
+    void Cascade(int level, int index) {
+        TSlot slot;
+
+        slot.splice(slot.end(), Wheel[level][index]);
+        Occupied[level] &= ~(1ull << index);
+
+        while (!slot.empty())
+            Place(slot, slot.begin());
+    }
+
+public:
+    TTimerWheel(uint64_t now) : Now(now) { }
+
+    /* Returns handle for Cancel, never zero */
+    uint64_t Add(uint64_t dueMs, const T &value) {
+        uint64_t id = NextId++;
+        TSlot slot;
+
+        slot.push_back(TTimer{id, dueMs, value});
+        Place(slot, slot.begin());
+        return id;
+    }
+
+    /* False if timer is already taken or cancelled */
+    bool Cancel(uint64_t id) {
+        auto it = Index.find(id);
+        if (it == Index.end())
+            return false;
+
+        TSlot *slot = it->second.Slot;
+        slot->erase(it->second.Iter);
+        Index.erase(it);
+
+        if (slot != &Ready && slot->empty()) {
+            size_t offset = slot - &Wheel[0][0];
+            Occupied[offset / SLOTS] &= ~(1ull << (offset % SLOTS));
+        }
+
+        return true;
+    }
+
+    /* First tick after Now when some slot is processed, UINT64_MAX if none */
+    uint64_t NextTick() const {
+        uint64_t next = UINT64_MAX;
+
+        for (int level = 0; level < LEVELS; level++) {
+            uint64_t bits = Occupied[level];
+            if (!bits)
+                continue;
+
+            uint64_t slot = (Now >> (BITS * level)) + 1;
+            int shift = slot & (SLOTS - 1);
+            if (shift)
+                bits = (bits >> shift) | (bits << (SLOTS - shift));
+
+            uint64_t tick = (slot + __builtin_ctzll(bits)) << (BITS * level);
+            next = std::min(next, tick);
+        }
+
+        return next;
+    }
+
+    /* Moves timers due till now into ready */
+    void Advance(uint64_t now) {
+        while (Now < now) {
+            uint64_t tick = NextTick();
+
+            if (tick > now) {
+                Now = now;
+                break;
+            }
+
+            Now = tick;
+
+            for (int level = LEVELS - 1; level > 0; level--) {
+                if (!(Now & ((1ull << (BITS * level)) - 1)))
+                    Cascade(level, (Now >> (BITS * level)) & (SLOTS - 1));
+            }
+
+            Cascade(0, Now & (SLOTS - 1));
+        }
+    }
+
+    bool HasReady() const {
+        return !Ready.empty();
+    }
+
+    /* Takes one expired timer */
+    bool Pop(T &value, uint64_t &dueMs) {
+        if (Ready.empty())
+            return false;
+
+        auto &timer = Ready.front();
+        value = std::move(timer.Value);
+        dueMs = timer.DueMs;
+        Index.erase(timer.Id);
+        Ready.pop_front();
+        return true;
+    }
+
+    size_t Size() const {
+        return Index.size();
+    }
+};
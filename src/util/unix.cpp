@@ -95,6 +95,66 @@ uint64_t TaskHandledSignals(pid_t pid) {
     return res == 1 ? mask : 0;
 }
 
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+int PidFdOpen(pid_t pid) {
+    return syscall(__NR_pidfd_open, pid, 0);
+}
+
+bool PidFdSupported() {
+    static bool supported = [] {
+        int fd = PidFdOpen(getpid());
+        if (fd < 0)
+            return false;
+        close(fd);
+        return true;
+    }();
+    return supported;
+}
+
+bool PidFdExited(int pidfd) {
+    struct pollfd pfd = { pidfd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+int ChildExitStatus(int code, int status) {
+    if (code == CLD_KILLED)
+        return status;
+    if (code == CLD_DUMPED)
+        return status | (1 << 7);
+    return status << 8; /* CLD_EXITED */
+}
+
+static bool PidFdWait(int pidfd, int &status, int flags) {
+    siginfo_t info;
+
+    if (!PidFdExited(pidfd))
+        return false;
+
+    memset(&info, 0, sizeof(info));
+
+    /* Fails with ECHILD if task is not our child */
+    if (waitid((idtype_t)P_PIDFD, pidfd, &info, WEXITED | WNOHANG | flags) || !info.si_pid)
+        return false;
+
+    status = ChildExitStatus(info.si_code, info.si_status);
+    return true;
+}
+
+bool PidFdPeek(int pidfd, int &status) {
+    return PidFdWait(pidfd, status, WNOWAIT);
+}
+
+bool PidFdReap(int pidfd, int &status) {
+    return PidFdWait(pidfd, status, 0);
+}
+
 pid_t GetPid() {
     return syscall(SYS_getpid);
 }
@@ -162,6 +222,12 @@ uint64_t GetCurrentTimeMs() {
     return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+uint64_t GetCurrentTimeUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 bool WaitDeadline(uint64_t deadline, uint64_t wait) {
     uint64_t now = GetCurrentTimeMs();
     if (!deadline || int64_t(deadline - now) < 0)
@@ -39,6 +39,7 @@ pid_t GetTid();
 TError GetTaskChildrens(pid_t pid, std::vector<pid_t> &childrens);
 
 uint64_t GetCurrentTimeMs();
+uint64_t GetCurrentTimeUs();
 bool WaitDeadline(uint64_t deadline, uint64_t sleep = 10);
 uint64_t GetTotalMemory();
 uint64_t GetTotalThreads();
@@ -46,6 +47,17 @@ void SetProcessName(const std::string &name);
 void SetDieOnParentExit(int sig);
 std::string GetTaskName(pid_t pid = 0);
 uint64_t TaskHandledSignals(pid_t pid);
+
+/* Returns -1 if kernel has no pidfd */
+int PidFdOpen(pid_t pid);
+bool PidFdSupported();
+bool PidFdExited(int pidfd);
+/* Wait status from si_code and si_status of SIGCHLD */
+int ChildExitStatus(int code, int status);
+/* Exit status of own child but zombie stays, false if it's still running */
+bool PidFdPeek(int pidfd, int &status);
+/* Reaps exited own child, false if it's still running or not our child */
+bool PidFdReap(int pidfd, int &status);
 TError GetTaskCgroups(const int pid, std::map<std::string, std::string> &cgmap);
 std::string GetHostName();
 TError SetHostName(const std::string &name);
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cstring>
+
+#include "util/uring.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+}
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+# define HAVE_IO_URING
+extern "C" {
+# include <linux/io_uring.h>
+}
+#endif
+
+TUring::~TUring() {
+    if (Sqes)
+        munmap(Sqes, SqesSize);
+    if (CqRing && CqRing != SqRing)
+        munmap(CqRing, CqRingSize);
+    if (SqRing)
+        munmap(SqRing, SqRingSize);
+    if (Fd >= 0)
+        close(Fd);
+}
+
+#ifdef HAVE_IO_URING
+
+TError TUring::Setup(unsigned entries) {
+    struct io_uring_params params = {};
+
+    Fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (Fd < 0)
+        return TError(EError::NotSupported, errno, "io_uring_setup");
+
+    if (!(params.features & IORING_FEAT_NODROP))
+        return TError(EError::NotSupported, "io_uring without IORING_FEAT_NODROP");
+
+    TError error = Probe();
+    if (error)
+        return error;
+
+    Entries = params.sq_entries;
+
+    SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize);
+
+    SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+    if (SqRing == MAP_FAILED) {
+        SqRing = nullptr;
+        return TError(EError::Unknown, errno, "mmap sq ring");
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        CqRing = SqRing;
+    } else {
+        CqRing = mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+        if (CqRing == MAP_FAILED) {
+            CqRing = nullptr;
+            return TError(EError::Unknown, errno, "mmap cq ring");
+        }
+    }
+
+    Sqes = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES);
+    if (Sqes == MAP_FAILED) {
+        Sqes = nullptr;
+        return TError(EError::Unknown, errno, "mmap sqes");
+    }
+
+    char *sq = (char *)SqRing, *cq = (char *)CqRing;
+
+    SqHead = (unsigned *)(sq + params.sq_off.head);
+    SqTail = (unsigned *)(sq + params.sq_off.tail);
+    SqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    SqArray = (unsigned *)(sq + params.sq_off.array);
+
+    CqHead = (unsigned *)(cq + params.cq_off.head);
+    CqTail = (unsigned *)(cq + params.cq_off.tail);
+    CqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    Cqes = cq + params.cq_off.cqes;
+
+    return TError::Success();
+}
+
+/* IORING_OP_OPENAT and IORING_OP_CLOSE appeared in 5.6 together with probe */
+TError TUring::Probe() {
+#ifdef IO_URING_OP_SUPPORTED
+    const unsigned nr_ops = 256;
+    std::vector<char> buf(sizeof(struct io_uring_probe) +
+                          nr_ops * sizeof(struct io_uring_probe_op));
+    auto probe = (struct io_uring_probe *)buf.data();
+
+    if (syscall(__NR_io_uring_register, Fd, IORING_REGISTER_PROBE, probe, nr_ops))
+        return TError(EError::NotSupported, errno, "io_uring probe");
+
+    for (int op: { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE }) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return TError(EError::NotSupported, "io_uring without opcode " + std::to_string(op));
+    }
+
+    return TError::Success();
+#else
+    return TError(EError::NotSupported, "io_uring headers without IORING_REGISTER_PROBE");
+#endif
+}
+
+TError TUring::Submit(std::vector<TOp> &ops) {
+    auto sqes = (struct io_uring_sqe *)Sqes;
+    auto cqes = (struct io_uring_cqe *)Cqes;
+    size_t next = 0;
+
+    /* after failure caller must know which opens returned fd */
+    for (auto &op: ops)
+        op.Result = -ECANCELED;
+
+    while (next < ops.size()) {
+        unsigned tail = *SqTail;
+        unsigned count = 0;
+
+        while (next + count < ops.size() && count < Entries) {
+            auto &op = ops[next + count];
+            unsigned index = tail & *SqMask;
+            auto sqe = &sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            switch (op.Op) {
+            case Open:
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)op.Path;
+                sqe->open_flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+                break;
+            case Read:
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = op.Fd;
+                sqe->addr = (uint64_t)op.Buf;
+                sqe->len = op.Size;
+                sqe->off = 0;
+                break;
+            case Close:
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = op.Fd;
+                break;
+            }
+            sqe->user_data = next + count;
+
+            SqArray[index] = index;
+            tail++;
+            count++;
+        }
+
+        __atomic_store_n(SqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned submit = count, done = 0;
+        while (done < count) {
+            int ret = syscall(__NR_io_uring_enter, Fd, submit, count - done,
+                              IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                return TError(EError::Unknown, errno, "io_uring_enter");
+            }
+            submit -= std::min((unsigned)ret, submit);
+
+            unsigned head = *CqHead;
+            unsigned ready = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+            for (; head != ready; head++, done++) {
+                auto cqe = &cqes[head & *CqMask];
+                ops[cqe->user_data].Result = cqe->res;
+            }
+            __atomic_store_n(CqHead, head, __ATOMIC_RELEASE);
+        }
+
+        next += count;
+    }
+
+    return TError::Success();
+}
+
+#else
+
+TError TUring::Setup(unsigned entries) {
+    (void)entries;
+    return TError(EError::NotSupported, "Built without io_uring");
+}
+
+TError TUring::Submit(std::vector<TOp> &ops) {
+    (void)ops;
+    return TError(EError::NotSupported, "Built without io_uring");
+}
+
+#endif
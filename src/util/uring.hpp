@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+/*
+ * Minimal io_uring without liburing: submits batch of open/read/close
+ * and waits for all completions with one io_uring_enter per ring-full.
+ * Setup fails with NotSupported if kernel or headers have no io_uring
+ * or kernel cannot do all of these operations.
+ */
+
+class TUring : public TNonCopyable {
+public:
+    enum EOp {
+        Open,   /* Path -> Result is fd */
+        Read,   /* Fd, Buf, Size from offset 0 -> Result is bytes */
+        Close,  /* Fd */
+    };
+
+    struct TOp {
+        EOp Op;
+        int Fd = -1;
+        const char *Path = nullptr;
+        char *Buf = nullptr;
+        unsigned Size = 0;
+        int Result = 0;     /* or -errno, -ECANCELED if not completed */
+
+        TOp(EOp op) : Op(op) { }
+    };
+
+    TUring() { }
+    ~TUring();
+
+    TError Setup(unsigned entries);
+    TError Submit(std::vector<TOp> &ops);
+
+private:
+    int Fd = -1;
+    unsigned Entries = 0;
+
+    TError Probe();
+
+    void *SqRing = nullptr;
+    void *CqRing = nullptr;
+    void *Sqes = nullptr;
+    size_t SqRingSize = 0;
+    size_t CqRingSize = 0;
+    size_t SqesSize = 0;
+
+    unsigned *SqHead, *SqTail, *SqMask, *SqArray;
+    unsigned *CqHead, *CqTail, *CqMask;
+    void *Cqes;
+};
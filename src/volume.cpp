@@ -12,6 +12,7 @@
 #include "util/loop.hpp"
 #include "config.hpp"
 #include "kvalue.hpp"
+#include "kv.pb.h"
 #include "helpers.hpp"
 #include "client.hpp"
 #include "filesystem.hpp"
@@ -1426,11 +1427,7 @@ TError TVolume::Destroy(bool strict) {
 
         for (auto &name: volume->Containers) {
             L_ACT("Forced unlink volume {} from {}", volume->Path, name);
-            volumes_lock.unlock();
-            auto containers_lock = LockContainers();
             auto container = TContainer::Find(name);
-            containers_lock.unlock();
-            volumes_lock.lock();
             if (container) {
                 auto vol_iter = std::find(container->Volumes.begin(),
                                           container->Volumes.end(),
@@ -1543,8 +1540,8 @@ TError TVolume::DestroyOne(bool strict) {
         }
     }
 
-    TPath node(VolumesKV / Id);
-    error = node.Unlink();
+    TKeyValue node(VolumesKV / Id);
+    error = node.Remove();
     if (!ret && error)
         ret = error;
 
@@ -1735,9 +1732,13 @@ TStringMap TVolume::DumpConfig(const TPath &root) {
 
 TError TVolume::Save() {
     TKeyValue node(VolumesKV / Id);
-    TError error;
-    std::string tmp;
 
+    SaveTo(node);
+
+    return node.Save();
+}
+
+void TVolume::SaveTo(TKeyValue &node) {
     /*
      * Storing all state values on save,
      * the previous scheme stored knobs selectively.
@@ -1770,8 +1771,6 @@ TError TVolume::Save() {
 
     if (CustomPlace)
         node.Set(V_PLACE, Place.ToString());
-
-    return node.Save();
 }
 
 TError TVolume::Restore(const TKeyValue &node) {
@@ -1936,10 +1935,16 @@ TError TVolume::Create(const TStringMap &cfg, std::shared_ptr<TVolume> &volume)
     return TError::Success();
 }
 
-void TVolume::RestoreAll(void) {
+void TVolume::RestoreAll(const kv::THandoff *handoff) {
+    std::map<std::string, const kv::THandoffNode *> adopted;
     std::list<TKeyValue> nodes;
     TError error;
 
+    if (handoff) {
+        for (auto &state: handoff->volumes())
+            adopted[state.name()] = &state;
+    }
+
     TPath place(PORTO_PLACE);
     error = TStorage::CheckPlace(place);
     if (error)
@@ -1950,10 +1955,16 @@ void TVolume::RestoreAll(void) {
         L_ERR("Cannot list nodes: {}", error);
 
     for (auto &node : nodes) {
-        error = node.Load();
+        auto it = adopted.find(node.Path.BaseName());
+        if (it != adopted.end()) {
+            for (auto &pair: it->second->pairs())
+                node.Data[pair.key()] = pair.val();
+            error = TError::Success();
+        } else
+            error = node.Load();
         if (error) {
             L_WRN("Cannot load {} removed: {}", node.Path, error);
-            node.Path.Unlink();
+            node.Remove();
             continue;
         }
 
@@ -2001,10 +2012,15 @@ void TVolume::RestoreAll(void) {
 
         containers_lock.unlock();
 
-        error = volume->Save();
-        if (error) {
-            broken_volumes.push_back(volume);
-            continue;
+        /* Adopted node is the same as stored */
+        if (adopted.count(node.Path.BaseName())) {
+            Statistics->HandoffVolumes++;
+        } else {
+            error = volume->Save();
+            if (error) {
+                broken_volumes.push_back(volume);
+                continue;
+            }
         }
 
         if (!volume->Containers.size()) {
@@ -47,6 +47,10 @@ class TVolume;
 class TContainer;
 class TKeyValue;
 
+namespace kv {
+    class THandoff;
+}
+
 class TVolumeBackend {
 public:
     TVolume *Volume;
@@ -133,9 +137,11 @@ public:
     TError Destroy(bool strict = false);
 
     TError Save(void);
+    void SaveTo(TKeyValue &node);
     TError Restore(const TKeyValue &node);
 
-    static void RestoreAll(void);
+    /* Nodes handed off by previous slave are taken instead of keyvalue */
+    static void RestoreAll(const kv::THandoff *handoff = nullptr);
 
     TError LinkContainer(TContainer &container);
     TError UnlinkContainer(TContainer &container, bool strict = false);
@@ -4,6 +4,8 @@
 #include <cstdio>
 #include <climits>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 
 #include "version.hpp"
 #include "libporto.hpp"
@@ -14,6 +16,9 @@
 #include "util/loop.hpp"
 #include "util/cred.hpp"
 #include "util/idmap.hpp"
+#include "util/timerwheel.hpp"
+#include "util/scan.hpp"
+#include "kvalue.hpp"
 #include "protobuf.hpp"
 #include "test.hpp"
 #include "rpc.hpp"
@@ -24,6 +29,7 @@ extern "C" {
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <grp.h>
 #include <linux/capability.h>
 }
@@ -876,6 +882,44 @@ static void TestExitStatus(Porto::Connection &api) {
     ExpectApiSuccess(api.Destroy(name));
 }
 
+static void TestPidFdExit(Porto::Connection &api) {
+    std::string c = "pidfd", pid, v;
+    TUintMap before, after;
+
+    if (!PidFdSupported()) {
+        Say() << "pidfd is not supported, skip" << std::endl;
+        return;
+    }
+
+    Say() << "Check exit status of wait task reaped via pidfd" << std::endl;
+
+    ExpectApiSuccess(api.Create(c));
+    ExpectApiSuccess(api.SetProperty(c, "command", "sleep 1000"));
+    ExpectApiSuccess(api.SetProperty(c, "isolate", "false"));
+    ExpectApiSuccess(api.Start(c));
+    ExpectApiSuccess(api.GetData(c, "root_pid", pid));
+
+    /* Cloned with CLONE_PARENT: child of slave, not of master */
+    TTask task;
+    task.Pid = stoi(pid);
+    ExpectEq(task.GetPPid(), ReadPid(PORTO_SLAVE_PIDFILE));
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, before));
+
+    ExpectEq(kill(task.Pid, SIGKILL), 0);
+    WaitContainer(api, c);
+    WaitProcessExit(pid);
+
+    ExpectApiSuccess(api.GetData(c, "exit_status", v));
+    ExpectEq(v, "9");
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, after));
+    ExpectEq(after["pidfd_exits"], before["pidfd_exits"] + 1);
+
+    ExpectApiSuccess(api.Destroy(c));
+}
+
 static void TestStreams(Porto::Connection &api) {
     string ret;
 
@@ -2874,6 +2918,48 @@ static void TestIdmap(Porto::Connection &api) {
     ExpectEq(id, 1);
 }
 
+static void TestTimerWheel(Porto::Connection &api) {
+    TTimerWheel<int> wheel(1000);
+    std::vector<uint64_t> handles;
+    uint64_t now = 1000, due;
+    int value = 0, fired = 0;
+
+    /* Spread over all levels and beyond wheel span */
+    handles.push_back(0);
+    for (int i = 1; i <= 40; i++)
+        handles.push_back(wheel.Add(1000 + (1ull << i) - 1, i));
+    ExpectEq(wheel.Size(), 40);
+
+    Expect(wheel.Cancel(handles[7]));
+    Expect(!wheel.Cancel(handles[7]));
+    ExpectEq(wheel.Size(), 39);
+
+    while (wheel.Size()) {
+        uint64_t next = wheel.NextTick();
+        Expect(next > now);
+        now = next;
+        wheel.Advance(now);
+        while (wheel.Pop(value, due)) {
+            ExpectEq(due, now);
+            ExpectEq(due, 1000 + (1ull << value) - 1);
+            Expect(!wheel.Cancel(handles[value]));
+            fired++;
+        }
+    }
+    ExpectEq(fired, 39);
+    ExpectEq(wheel.NextTick(), UINT64_MAX);
+
+    /* Large jump fires everything overdue */
+    wheel.Add(now + 5, 1);
+    wheel.Add(now + 100000, 2);
+    wheel.Advance(now + 1000000);
+    ExpectEq(wheel.Pop(value, due), true);
+    ExpectEq(value, 1);
+    ExpectEq(wheel.Pop(value, due), true);
+    ExpectEq(value, 2);
+    ExpectEq(wheel.Pop(value, due), false);
+}
+
 static void TestFormat(Porto::Connection &api) {
     uint64_t v;
 
@@ -4409,6 +4495,419 @@ static void TestPerf(Porto::Connection &api) {
     Expect(ms < destroyMs * nr);
 }
 
+static void TestExitPerf(Porto::Connection &api) {
+    std::vector<int> levels = { 100, 1000, 10000 };
+    uint64_t nrMax = config().container().max_total();
+    std::string name = "exit_perf", v;
+    const int nrExits = 100;
+    uint64_t baseMs = 0;
+    int nr = 0;
+
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "command", "true"));
+
+    for (auto level: levels) {
+        if ((uint64_t)level >= nrMax) {
+            Say() << "Skip " << level << " containers, limit is " << nrMax << std::endl;
+            break;
+        }
+
+        for (; nr < level; nr++)
+            ExpectApiSuccess(api.Create("exit_perf_" + std::to_string(nr)));
+
+        uint64_t begin = GetCurrentTimeMs();
+        for (int i = 0; i < nrExits; i++) {
+            ExpectApiSuccess(api.Start(name));
+            ExpectApiSuccess(api.WaitContainers({name}, v, -1));
+            ExpectApiSuccess(api.Stop(name));
+        }
+        uint64_t ms = GetCurrentTimeMs() - begin;
+
+        Say() << "Exit " << nrExits << " times among " << level << " containers took " << ms / 1000.0 << "s" << std::endl;
+
+        if (!baseMs)
+            baseMs = ms;
+        else
+            ExpectLessEq(ms, baseMs * 2);
+    }
+
+    for (int i = 0; i < nr; i++)
+        ExpectApiSuccess(api.Destroy("exit_perf_" + std::to_string(i)));
+    ExpectApiSuccess(api.Destroy(name));
+}
+
+static void TestStartPerf(Porto::Connection &api) {
+    std::string name = "start_perf", task = "start_perf/task";
+    const int nr = 300;
+    const int cycleMs = 100;
+
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "isolate", "false"));
+    ExpectApiSuccess(api.Create(task));
+    ExpectApiSuccess(api.SetProperty(task, "isolate", "false"));
+    ExpectApiSuccess(api.SetProperty(task, "command", "true"));
+
+    uint64_t startUs = 0, stopUs = 0;
+    for (int i = 0; i < nr; i++) {
+        uint64_t begin = GetCurrentTimeUs();
+        ExpectApiSuccess(api.Start(task));
+        uint64_t middle = GetCurrentTimeUs();
+        ExpectApiSuccess(api.Stop(task));
+        startUs += middle - begin;
+        stopUs += GetCurrentTimeUs() - middle;
+    }
+
+    Say() << "Start " << nr << " times took " << startUs / 1000000.0 << "s, "
+          << startUs / nr << " us per start, " << stopUs / nr << " us per stop" << std::endl;
+    ExpectLessEq((startUs + stopUs) / 1000, (uint64_t)cycleMs * nr);
+
+    ExpectApiSuccess(api.Destroy(name));
+}
+
+static uint64_t RpcRate(int level, int nrRequests) {
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+
+    uint64_t begin = GetCurrentTimeMs();
+    for (int t = 0; t < level; t++) {
+        threads.push_back(std::thread([&failed, nrRequests] {
+            Porto::Connection conn;
+            std::string v;
+            for (int i = 0; i < nrRequests; i++)
+                if (conn.GetData("/", "state", v))
+                    failed++;
+        }));
+    }
+    for (auto &thread: threads)
+        thread.join();
+    uint64_t ms = std::max(GetCurrentTimeMs() - begin, (uint64_t)1);
+    ExpectEq(failed.load(), 0);
+
+    return (uint64_t)level * nrRequests * 1000 / ms;
+}
+
+/* New slave reads config again */
+static void ReloadPortod(Porto::Connection &api) {
+    int slavePid = ReadPid(PORTO_SLAVE_PIDFILE);
+
+    ExpectEq(kill(ReadPid(PORTO_MASTER_PIDFILE), SIGHUP), 0);
+    WaitProcessExit(std::to_string(slavePid));
+    WaitPortod(api);
+}
+
+/* Appends text to /etc/portod.conf, original is restored even if test fails */
+class TConfigOverride : public TNonCopyable {
+    TPath Path;
+    std::string Saved;
+    bool Existed;
+    bool Changed = false;
+
+    void Revert() {
+        if (Existed)
+            (void)Path.WriteAll(Saved);
+        else
+            (void)Path.Unlink();
+    }
+
+public:
+    TConfigOverride() : Path("/etc/portod.conf") {
+        Existed = Path.Exists();
+        if (Existed)
+            ExpectSuccess(Path.ReadAll(Saved));
+    }
+
+    ~TConfigOverride() {
+        int pid;
+        if (Changed) {
+            Revert();
+            if (!TPath(PORTO_MASTER_PIDFILE).ReadInt(pid))
+                (void)kill(pid, SIGHUP);
+        }
+    }
+
+    void Set(Porto::Connection &api, const std::string &text) {
+        Changed = true;
+        ExpectSuccess(Path.WriteAll(Saved + "\n" + text + "\n"));
+        ReloadPortod(api);
+    }
+
+    void Restore(Porto::Connection &api) {
+        Revert();
+        Changed = false;
+        ReloadPortod(api);
+    }
+};
+
+static void TestRpcPerf(Porto::Connection &api) {
+    std::vector<int> levels = { 1, 4, 16, 64 };
+    unsigned cpus = std::thread::hardware_concurrency();
+    /* Reactors scale only with spare cpus for them and for clients */
+    std::vector<uint32_t> reactors = { 1, std::min(std::max(cpus / 2, 2u), 8u) };
+    std::map<uint32_t, std::vector<uint64_t>> rates;
+    const int nrRequests = 2000;
+    TConfigOverride conf;
+
+    AsRoot(api);
+
+    for (auto nr: reactors) {
+        conf.Set(api, "daemon { rpc_reactors: " + std::to_string(nr) + " }");
+
+        for (auto level: levels) {
+            uint64_t rate = RpcRate(level, nrRequests);
+            Say() << "Rpc " << nr << " reactors, " << level << " clients x " << nrRequests
+                  << " requests: " << rate << " requests/s" << std::endl;
+            rates[nr].push_back(rate);
+        }
+    }
+
+    conf.Restore(api);
+
+    auto &single = rates[reactors[0]], &multi = rates[reactors[1]];
+    for (size_t i = 0; i < levels.size(); i++) {
+        Say() << "Rpc " << levels[i] << " clients: " << reactors[1] << " reactors give "
+              << multi[i] * 100 / std::max(single[i], (uint64_t)1) << "% of single reactor rate" << std::endl;
+        if (cpus >= reactors[1] * 2 && (uint32_t)levels[i] >= reactors[1])
+            ExpectLessEq(single[i] * 3 / 2, multi[i]);
+    }
+
+    if (cpus < reactors[1] * 2)
+        Say() << "Scaling is not checked with " << cpus << " cpus" << std::endl;
+}
+
+static uint64_t StatGetUs(Porto::Connection &api, const std::vector<std::string> &names,
+                          const std::vector<std::string> &vars, int nrLoops,
+                          std::map<std::string, std::map<std::string, Porto::GetResponse>> &result) {
+    /* first get opens knobs, measure steady state */
+    ExpectApiSuccess(api.Get(names, vars, result));
+
+    uint64_t begin = GetCurrentTimeUs();
+    for (int i = 0; i < nrLoops; i++) {
+        result.clear();
+        ExpectApiSuccess(api.Get(names, vars, result));
+    }
+    return (GetCurrentTimeUs() - begin) / nrLoops;
+}
+
+/* Combined get of 8 stats from thousands of containers, prefetched and not */
+static void TestStatPerf(Porto::Connection &api) {
+    std::vector<std::string> vars = { "memory_usage", "anon_usage", "minor_faults",
+                                      "major_faults", "max_rss", "cpu_usage",
+                                      "cpu_usage_system", "io_read" };
+    /* idle cgroups, these do not change between gets */
+    std::vector<std::string> stable = { "minor_faults", "major_faults", "cpu_usage" };
+    uint64_t nrMax = config().container().max_total();
+    int nr = std::min(nrMax > 10 ? nrMax - 10 : 0, (uint64_t)5000);
+    std::string name = "stat_perf";
+    std::vector<std::string> names;
+    const int nrLoops = 10;
+    TConfigOverride conf;
+
+    AsRoot(api);
+
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "isolate", "false"));
+    ExpectApiSuccess(api.Start(name));
+
+    for (int i = 0; i < nr; i++) {
+        names.push_back(name + "/" + std::to_string(i));
+        ExpectApiSuccess(api.Create(names.back()));
+        ExpectApiSuccess(api.SetProperty(names.back(), "isolate", "false"));
+        ExpectApiSuccess(api.Start(names.back()));
+    }
+
+    std::map<std::string, std::map<std::string, Porto::GetResponse>> plain, prefetch;
+
+    conf.Set(api, "daemon { stat_io_uring: false }");
+    uint64_t plainUs = StatGetUs(api, names, vars, nrLoops, plain);
+
+    conf.Set(api, "daemon { stat_io_uring: true }");
+    uint64_t prefetchUs = StatGetUs(api, names, vars, nrLoops, prefetch);
+
+    conf.Restore(api);
+
+    Say() << "Get " << vars.size() << " stats of " << nr << " containers: "
+          << plainUs / 1000.0 << "ms plain, " << prefetchUs / 1000.0
+          << "ms with io_uring" << std::endl;
+
+    /* prefetch must give the same answers */
+    ExpectEq(prefetch.size(), names.size());
+    for (auto &ct: names) {
+        for (auto &var: vars) {
+            auto &a = plain[ct][var], &b = prefetch[ct][var];
+            ExpectEq(b.Error, a.Error);
+            if (!a.Error && std::find(stable.begin(), stable.end(), var) != stable.end())
+                ExpectEq(b.Value, a.Value);
+        }
+    }
+
+    /* without io_uring both are the same path, allow noise */
+    ExpectLessEq(prefetchUs, plainUs * 5 / 4);
+
+    ExpectApiSuccess(api.Destroy(name));
+}
+
+static uint64_t CreateRate(int level, int nrContainers) {
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+
+    uint64_t begin = GetCurrentTimeMs();
+    for (int t = 0; t < level; t++) {
+        threads.push_back(std::thread([&failed, nrContainers, t] {
+            Porto::Connection conn;
+            for (int i = 0; i < nrContainers; i++) {
+                std::string name = "kv_perf_" + std::to_string(t) + "_" + std::to_string(i);
+                if (conn.Create(name) || conn.SetProperty(name, "private", "x"))
+                    failed++;
+            }
+            for (int i = 0; i < nrContainers; i++)
+                if (conn.Destroy("kv_perf_" + std::to_string(t) + "_" + std::to_string(i)))
+                    failed++;
+        }));
+    }
+    for (auto &thread: threads)
+        thread.join();
+    uint64_t ms = std::max(GetCurrentTimeMs() - begin, (uint64_t)1);
+    ExpectEq(failed.load(), 0);
+
+    return (uint64_t)level * nrContainers * 1000 / ms;
+}
+
+/* Concurrent creates with one and several threads writing container state */
+static void TestKvPerf(Porto::Connection &api) {
+    std::vector<uint32_t> lanes = { 1, std::max(config().daemon().kv_threads(), 2u) };
+    std::vector<uint64_t> rates;
+    const int level = 16, nrContainers = 100;
+    TConfigOverride conf;
+
+    AsRoot(api);
+
+    for (auto nr: lanes) {
+        conf.Set(api, "daemon { kv_threads: " + std::to_string(nr) + " }");
+        rates.push_back(CreateRate(level, nrContainers));
+        Say() << "Create " << level << " x " << nrContainers << " containers with "
+              << nr << " kv threads: " << rates.back() << " containers/s" << std::endl;
+    }
+
+    conf.Restore(api);
+
+    /* lanes cannot help on single cpu, beyond noise they must not hurt */
+    ExpectLessEq(rates[0] * 3 / 4, rates[1]);
+}
+
+/* Former fscanf-based parsers of cgroup knobs */
+static void LegacyParseUintMap(const TPath &path, TUintMap &value) {
+    FILE *file = fopen(path.c_str(), "r");
+    char *key;
+    unsigned long long val;
+
+    Expect(file != nullptr);
+    while (fscanf(file, "%ms %llu\n", &key, &val) == 2) {
+        value[std::string(key)] = val;
+        free(key);
+    }
+    fclose(file);
+}
+
+static void LegacyParsePids(const TPath &path, std::vector<pid_t> &pids) {
+    FILE *file = fopen(path.c_str(), "r");
+    int pid;
+
+    Expect(file != nullptr);
+    while (fscanf(file, "%d", &pid) == 1)
+        pids.push_back(pid);
+    fclose(file);
+}
+
+static void ParseUintMap(const TPath &path, TUintMap &value) {
+    const std::string *text;
+    ExpectSuccess(ReadFileBuffer(path, text));
+
+    TTextScanner scan(*text);
+    TStringRef line;
+    std::string key;
+
+    while (scan.NextLine(line)) {
+        TTextScanner words(line);
+        TStringRef word;
+        uint64_t val;
+        if (!words.NextWord(word) || !words.NextUint64(val))
+            break;
+        key.assign(word.Data, word.Size);
+        value[key] = val;
+    }
+}
+
+static void ParsePids(const TPath &path, std::vector<pid_t> &pids) {
+    const std::string *text;
+    ExpectSuccess(ReadFileBuffer(path, text));
+
+    TTextScanner scan(*text);
+    int pid;
+    while (scan.NextInt(pid))
+        pids.push_back(pid);
+}
+
+static void TestParsePerf(Porto::Connection &api) {
+    TPath stat("/tmp/porto-parse-stat"), pids("/tmp/porto-parse-pids");
+    const int nrLoops = 20000;
+    std::string text;
+
+    (void)stat.Unlink();
+    (void)pids.Unlink();
+    ExpectSuccess(stat.Mkfile(0644));
+    ExpectSuccess(pids.Mkfile(0644));
+
+    for (int i = 0; i < 64; i++)
+        text += "total_inactive_file_" + std::to_string(i) + " " +
+                std::to_string(1000000007ull * i) + "\n";
+    ExpectSuccess(stat.WriteAll(text));
+
+    text = "";
+    for (int i = 0; i < 1000; i++)
+        text += std::to_string(100000 + i) + "\n";
+    ExpectSuccess(pids.WriteAll(text));
+
+    TUintMap legacyMap, map;
+    std::vector<pid_t> legacyPids, list;
+
+    LegacyParseUintMap(stat, legacyMap);
+    ParseUintMap(stat, map);
+    ExpectEq(map.size(), 64);
+    ExpectEq(map == legacyMap, true);
+
+    LegacyParsePids(pids, legacyPids);
+    ParsePids(pids, list);
+    ExpectEq(list.size(), 1000);
+    ExpectEq(list == legacyPids, true);
+
+    uint64_t begin = GetCurrentTimeMs();
+    for (int i = 0; i < nrLoops; i++) {
+        legacyMap.clear();
+        LegacyParseUintMap(stat, legacyMap);
+        legacyPids.clear();
+        LegacyParsePids(pids, legacyPids);
+    }
+    uint64_t legacyMs = GetCurrentTimeMs() - begin;
+
+    begin = GetCurrentTimeMs();
+    for (int i = 0; i < nrLoops; i++) {
+        map.clear();
+        ParseUintMap(stat, map);
+        list.clear();
+        ParsePids(pids, list);
+    }
+    uint64_t ms = GetCurrentTimeMs() - begin;
+
+    Say() << "Parse " << nrLoops << " loops: fscanf " << legacyMs / 1000.0
+          << "s, scanner " << ms / 1000.0 << "s" << std::endl;
+    ExpectLessEq(ms, legacyMs);
+
+    ExpectSuccess(stat.Unlink());
+    ExpectSuccess(pids.Unlink());
+
+    (void)api;
+}
+
 static void CleanupVolume(Porto::Connection &api, const std::string &path) {
     AsRoot(api);
     TPath dir(path);
@@ -4624,6 +5123,344 @@ static void TestSigPipe(Porto::Connection &api) {
     ExpectEq(before, after);
 }
 
+static void TestPipeline(Porto::Connection &api) {
+    std::vector<rpc::TContainerRequest> requests;
+    std::vector<rpc::TContainerResponse> responses;
+    std::string padding(4000, 'x');
+    const int nr = 1000;
+
+    /* wildcard wait without match completes only by timeout */
+    requests.emplace_back();
+    requests.back().mutable_wait()->add_name("pipeline-*");
+    requests.back().mutable_wait()->set_timeout(500);
+
+    for (int i = 0; i < nr; i++) {
+        requests.emplace_back();
+        requests.back().mutable_getdata()->set_name("/");
+        requests.back().mutable_getdata()->set_data("state");
+    }
+
+    /*
+     * Megabytes of requests and responses: porto stops reading requests
+     * while client does not read responses, client must not block in send.
+     */
+    for (int i = 0; i < nr; i++) {
+        requests.emplace_back();
+        requests.back().mutable_get()->add_name("/");
+        requests.back().mutable_get()->add_variable("porto_stat");
+        requests.back().mutable_get()->add_variable("pipeline-missing-" + padding);
+    }
+
+    requests.emplace_back();
+    requests.back().mutable_version();
+
+    ExpectApiSuccess(api.Pipeline(requests, responses));
+    ExpectEq(responses.size(), requests.size());
+
+    ExpectEq(responses[0].error(), EError::Success);
+    Expect(responses[0].has_wait());
+
+    for (int i = 1; i <= nr; i++) {
+        ExpectEq(responses[i].error(), EError::Success);
+        ExpectEq(responses[i].getdata().value(), "meta");
+    }
+
+    for (int i = nr + 1; i <= 2 * nr; i++) {
+        ExpectEq(responses[i].error(), EError::Success);
+        ExpectEq(responses[i].get().list(0).keyval_size(), 2);
+        ExpectEq(responses[i].get().list(0).keyval(0).error(), EError::Success);
+        Expect(responses[i].get().list(0).keyval(1).error() != EError::Success);
+    }
+
+    ExpectEq(responses[2 * nr + 1].error(), EError::Success);
+    ExpectEq(responses[2 * nr + 1].version().tag(), PORTO_VERSION);
+
+    /* request without required fields is not sent */
+    requests.clear();
+    requests.emplace_back();
+    requests.back().mutable_getdata()->set_name("/");
+    ExpectApiFailure(api.Pipeline(requests, responses), EError::InvalidValue);
+
+    /* connection is still usable for plain requests */
+    std::string v;
+    ExpectApiSuccess(api.GetData("/", "state", v));
+    ExpectEq(v, "meta");
+}
+
+/* Much more than pipeline limit in one write, porto parses them in portions */
+static void TestPipelineBurst(Porto::Connection &api) {
+    rpc::TContainerRequest req;
+    rpc::TContainerResponse rsp;
+    std::string data;
+    const int nr = 1000;
+    uint32_t size;
+    int fd;
+
+    (void)api;
+
+    {
+        google::protobuf::io::StringOutputStream output(&data);
+        for (int i = 0; i < nr; i++) {
+            req.Clear();
+            req.set_request_id(i + 1);
+            req.mutable_getdata()->set_name("/");
+            req.mutable_getdata()->set_data("state");
+            Expect(WriteDelimitedTo(req, &output));
+        }
+    }
+
+    ExpectSuccess(ConnectToRpcServer(PORTO_SOCKET_PATH, fd));
+    struct timeval tv = { 30, 0 };
+    ExpectEq(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+
+    ExpectEq(write(fd, data.c_str(), data.size()), data.size());
+
+    google::protobuf::io::FileInputStream pre(fd);
+    google::protobuf::io::CodedInputStream input(&pre);
+    for (int i = 0; i < nr; i++) {
+        rsp.Clear();
+        Expect(input.ReadVarint32(&size));
+        auto limit = input.PushLimit(size);
+        Expect(rsp.ParseFromCodedStream(&input));
+        input.PopLimit(limit);
+
+        ExpectEq(rsp.request_id(), i + 1);
+        ExpectEq(rsp.error(), EError::Success);
+        ExpectEq(rsp.getdata().value(), "meta");
+    }
+
+    close(fd);
+}
+
+static void TestBatch(Porto::Connection &api) {
+    std::string name = "batch", v;
+
+    Say() << "Create, set and start in one batch" << std::endl;
+    std::vector<Porto::BatchStep> steps = {
+        { Porto::BatchStep::Create },
+        { Porto::BatchStep::SetProperty, "command", "true" },
+        { Porto::BatchStep::SetProperty, "private", "batch" },
+        { Porto::BatchStep::Start },
+    };
+    ExpectApiSuccess(api.Batch(name, steps));
+    for (auto &step: steps)
+        ExpectEq(step.Error, EError::Success);
+    ExpectApiSuccess(api.GetProperty(name, "private", v));
+    ExpectEq(v, "batch");
+    ExpectApiSuccess(api.WaitContainers({name}, v, -1));
+    ExpectApiSuccess(api.GetData(name, "state", v));
+    ExpectEq(v, "dead");
+    ExpectApiSuccess(api.Destroy(name));
+
+    Say() << "Failed batch destroys created container" << std::endl;
+    steps = {
+        { Porto::BatchStep::Create },
+        { Porto::BatchStep::SetProperty, "private", "batch" },
+        { Porto::BatchStep::SetProperty, "__invalid_property__", "value" },
+        { Porto::BatchStep::Start },
+    };
+    ExpectApiFailure(api.Batch(name, steps), EError::InvalidProperty);
+    ExpectEq(steps[0].Error, EError::Success);
+    ExpectEq(steps[1].Error, EError::Success);
+    ExpectEq(steps[2].Error, EError::InvalidProperty);
+    ExpectEq(steps[3].Error, EError::Success);
+    ExpectApiFailure(api.GetData(name, "state", v), EError::ContainerDoesNotExist);
+
+    Say() << "Failed batch reverts properties" << std::endl;
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "private", "before"));
+    steps = {
+        { Porto::BatchStep::SetProperty, "private", "after" },
+        { Porto::BatchStep::SetProperty, "memory_limit", "invalid" },
+    };
+    ExpectApiFailure(api.Batch(name, steps), EError::InvalidValue);
+    ExpectApiSuccess(api.GetProperty(name, "private", v));
+    ExpectEq(v, "before");
+
+    Say() << "Create is allowed only as first step" << std::endl;
+    steps = {
+        { Porto::BatchStep::SetProperty, "private", "after" },
+        { Porto::BatchStep::Create },
+    };
+    ExpectApiFailure(api.Batch(name, steps), EError::InvalidValue);
+    ExpectApiSuccess(api.GetProperty(name, "private", v));
+    ExpectEq(v, "before");
+
+    Say() << "Stop is allowed only as last step" << std::endl;
+    ExpectApiSuccess(api.SetProperty(name, "command", "sleep 1000"));
+    ExpectApiSuccess(api.Start(name));
+    steps = {
+        { Porto::BatchStep::Stop },
+        { Porto::BatchStep::SetProperty, "private", "after" },
+    };
+    ExpectApiFailure(api.Batch(name, steps), EError::InvalidValue);
+    ExpectApiSuccess(api.GetData(name, "state", v));
+    ExpectEq(v, "running");
+
+    steps = {
+        { Porto::BatchStep::SetProperty, "private", "after" },
+        { Porto::BatchStep::Stop },
+    };
+    ExpectApiSuccess(api.Batch(name, steps));
+    ExpectApiSuccess(api.GetData(name, "state", v));
+    ExpectEq(v, "stopped");
+    ExpectApiSuccess(api.GetProperty(name, "private", v));
+    ExpectEq(v, "after");
+
+    ExpectApiSuccess(api.Destroy(name));
+}
+
+static void TestSubscribe(Porto::Connection &api) {
+    Porto::Connection sub;
+    std::vector<Porto::ContainerEvent> events, all;
+    std::string name = "subscribe", v;
+    uint64_t seq;
+
+    ExpectEq(sub.Subscribe({name}, seq), 0);
+
+    ExpectApiSuccess(api.Create("subscribe-other"));
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "command", "true"));
+    ExpectApiSuccess(api.Start(name));
+    ExpectApiSuccess(api.WaitContainers({name}, v, -1));
+    ExpectApiSuccess(api.Destroy(name));
+    ExpectApiSuccess(api.Destroy("subscribe-other"));
+
+    while (!all.size() || all.back().Event != Porto::ContainerEvent::Destroy) {
+        ExpectEq(sub.ReadEvents(events, 5000), 0);
+        ExpectNeq(events.size(), 0);
+        all.insert(all.end(), events.begin(), events.end());
+    }
+
+    std::string types;
+    for (auto &event: all) {
+        ExpectEq(event.Name, name);
+        ExpectLess(seq, event.Seq);
+        seq = event.Seq;
+        types += std::to_string(event.Event) + " ";
+    }
+
+    /* create, set, starting, start, death, stopped, destroy */
+    ExpectEq(types, "1 7 8 2 3 8 6 ");
+    ExpectEq(all[1].Property, "command");
+    ExpectEq(all[4].State, "dead");
+
+    /* other requests aren't allowed, empty list cancels subscription */
+    ExpectEq(sub.Subscribe({}, seq), 0);
+}
+
+static void TestDeltaGet(Porto::Connection &api) {
+    std::map<std::string, std::map<std::string, Porto::GetResponse>> result;
+    std::vector<std::string> names = {"delta-a", "delta-a/b"};
+    std::vector<std::string> vars = {"command", "state", "parent"};
+    uint64_t generation = 0;
+
+    ExpectApiSuccess(api.Create("delta-a"));
+    ExpectApiSuccess(api.Create("delta-a/b"));
+
+    Say() << "Full get returns everything" << std::endl;
+    ExpectApiSuccess(api.Get(names, vars, result, generation));
+    ExpectNeq(generation, 0);
+    ExpectEq(result["delta-a/b"].size(), 3);
+
+    Say() << "Unchanged properties are skipped, data is returned" << std::endl;
+    result.clear();
+    ExpectApiSuccess(api.Get(names, vars, result, generation));
+    ExpectEq(result["delta-a"].count("command"), 0);
+    ExpectEq(result["delta-a"]["state"].Value, "stopped");
+    ExpectEq(result["delta-a/b"].count("command"), 0);
+
+    Say() << "Changes of container and parent are returned" << std::endl;
+    ExpectApiSuccess(api.SetProperty("delta-a", "command", "sleep 1"));
+    result.clear();
+    ExpectApiSuccess(api.Get(names, vars, result, generation));
+    ExpectEq(result["delta-a"]["command"].Value, "sleep 1");
+    ExpectEq(result["delta-a/b"].count("command"), 1);
+
+    result.clear();
+    ExpectApiSuccess(api.Get(names, vars, result, generation));
+    ExpectEq(result["delta-a"].count("command"), 0);
+
+    Say() << "Generation from another daemon gets everything" << std::endl;
+    uint64_t future = generation + (1ull << 40);
+    result.clear();
+    ExpectApiSuccess(api.Get(names, vars, result, future));
+    ExpectEq(result["delta-a"].count("command"), 1);
+
+    ExpectApiSuccess(api.Destroy("delta-a"));
+}
+
+static void TestTypedGet(Porto::Connection &api) {
+    std::map<std::string, std::map<std::string, Porto::GetResponse>> result;
+    std::vector<std::string> vars = {"command", "memory_limit", "cpu_limit",
+                                     "respawn_count", "cpu_usage", "io_read"};
+    Porto::Connection typed;
+
+    typed.SetTypedValues(true);
+
+    ExpectApiSuccess(api.Create("typed"));
+    ExpectApiSuccess(api.SetProperty("typed", "memory_limit", "1G"));
+    ExpectApiSuccess(api.SetProperty("typed", "cpu_limit", "0.5c"));
+
+    ExpectApiSuccess(typed.Get({"typed", "/"}, vars, result));
+
+    auto &ct = result["typed"];
+    ExpectEq(ct["command"].ValueType, Porto::GetResponse::String);
+    ExpectEq(ct["memory_limit"].ValueType, Porto::GetResponse::Uint);
+    ExpectEq(ct["memory_limit"].UintValue, 1ull << 30);
+    ExpectEq(ct["memory_limit"].Value, "");
+    ExpectEq(ct["cpu_limit"].ValueType, Porto::GetResponse::Double);
+    Expect(ct["cpu_limit"].DoubleValue == 0.5);
+    ExpectEq(ct["respawn_count"].ValueType, Porto::GetResponse::Uint);
+    ExpectEq(ct["respawn_count"].UintValue, 0);
+    ExpectNeq(ct["cpu_usage"].Error, 0);
+
+    auto &root = result["/"];
+    ExpectEq(root["cpu_usage"].ValueType, Porto::GetResponse::Uint);
+    ExpectNeq(root["cpu_usage"].UintValue, 0);
+    ExpectEq(root["io_read"].Error, 0);
+
+    std::string value;
+    ExpectApiSuccess(api.GetData("/", "io_read", value));
+    if (value.size())
+        ExpectEq(root["io_read"].ValueType, Porto::GetResponse::UintMap);
+
+    ExpectApiSuccess(api.Destroy("typed"));
+}
+
+static void TestRpcStat(Porto::Connection &api) {
+    std::string tag, revision, v;
+    TUintMap stat;
+    uint64_t before;
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, stat));
+    before = stat["rpc_version_count"];
+
+    for (int i = 0; i < 10; i++)
+        ExpectApiSuccess(api.GetVersion(tag, revision));
+
+    stat.clear();
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, stat));
+    ExpectEq(stat["rpc_version_count"], before + 10);
+    ExpectEq(stat.count("rpc_version_exec_p50_us"), 1);
+    ExpectLessEq(stat["rpc_version_exec_p50_us"], stat["rpc_version_exec_p99_us"]);
+    ExpectLessEq(stat["rpc_version_exec_p99_us"], stat["rpc_version_exec_max_us"]);
+    ExpectEq(stat.count("rpc_getdata_queue_p99_us"), 1);
+    ExpectEq(stat.count("rpc_version_send_max_us"), 1);
+
+    /* cumulative buckets end with all requests at max */
+    ExpectEq(stat.count("rpc_version_exec_le_1_us"), 1);
+    std::string last = "rpc_version_exec_le_" + std::to_string(stat["rpc_version_exec_max_us"]) + "_us";
+    ExpectEq(stat.count(last), 1);
+    ExpectEq(stat[last], stat["rpc_version_count"]);
+    ExpectLessEq(stat["rpc_version_exec_le_1_us"], stat[last]);
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat[rpc_version_count]", v));
+    ExpectEq(v, std::to_string(before + 10));
+}
+
 static void InitErrorCounters(Porto::Connection &api) {
     std::string v;
 
@@ -4784,6 +5621,471 @@ static void TestWait(Porto::Connection &api) {
     ExpectApiSuccess(api.Destroy(c));
 }
 
+static void TestKvJournal(Porto::Connection &api) {
+    std::string c = "journal", v;
+
+    Say() << "Make sure appended changes survive restart" << std::endl;
+
+    ExpectApiSuccess(api.Create(c));
+    ExpectApiSuccess(api.SetProperty(c, "command", "sleep 1000"));
+    for (int i = 0; i < 200; i++)
+        ExpectApiSuccess(api.SetProperty(c, "env", "A=" + std::to_string(i) + ";B=" + std::string(100, 'b')));
+    ExpectApiSuccess(api.SetProperty(c, "private", "journal"));
+
+    KillSlave(api, SIGKILL);
+
+    ExpectApiSuccess(api.GetProperty(c, "env", v));
+    ExpectEq(v, "A=199;B=" + std::string(100, 'b'));
+    ExpectApiSuccess(api.GetProperty(c, "private", v));
+    ExpectEq(v, "journal");
+    ExpectApiSuccess(api.GetProperty(c, "command", v));
+    ExpectEq(v, "sleep 1000");
+
+    ExpectApiSuccess(api.SetProperty(c, "private", "again"));
+
+    KillSlave(api, SIGKILL);
+
+    ExpectApiSuccess(api.GetProperty(c, "private", v));
+    ExpectEq(v, "again");
+
+    ExpectApiSuccess(api.Destroy(c));
+}
+
+/* Flips byte of record data or zeroes magic of record with this marker */
+static void BreakKvRecord(const TPath &path, const std::string &marker, bool magic) {
+    std::string text;
+
+    ExpectSuccess(path.ReadAll(text, 1 << 20));
+    auto off = text.find(marker);
+    Expect(off != std::string::npos);
+    if (magic)
+        text.replace(off - 4 - 16, 4, 4, '\0'); /* name "torn", 16 bytes header */
+    else
+        text[off] ^= 1;
+    ExpectSuccess(path.WriteAll(text));
+}
+
+static void TestKvStore(Porto::Connection &api) {
+    TPath root("/tmp/porto-kv-store");
+    TPath path = root / ".store";
+    std::string backend = config().keyvalue_backend();
+    std::string v;
+
+    AsRoot(api);
+
+    (void)root.UmountAll();
+    (void)root.RemoveAll();
+    ExpectSuccess(root.MkdirAll(0755));
+
+    Say() << "Make sure last record wins and removal survives reopen" << std::endl;
+    {
+        TKeyValueStore store(path);
+        ExpectSuccess(store.Open(65536));
+        ExpectSuccess(store.Write("a", "1"));
+        ExpectSuccess(store.Write("b", "2"));
+        ExpectSuccess(store.Write("a", "3"));
+        ExpectSuccess(store.Remove("b"));
+        Expect(!!store.Remove("b"));
+        Expect(!!store.Write("c", ""));
+    }
+    {
+        TKeyValueStore store(path);
+        ExpectSuccess(store.Open(0));
+        ExpectEq(store.List().size(), 1);
+        ExpectSuccess(store.Read("a", v));
+        ExpectEq(v, "3");
+        Expect(!!store.Read("b", v));
+    }
+
+    Say() << "Make sure log ends at bad checksum and at torn record" << std::endl;
+    for (bool magic: { false, true }) {
+        {
+            TKeyValueStore store(path);
+            ExpectSuccess(store.Open(0));
+            ExpectSuccess(store.Write("torn", "TORN-MARKER"));
+            ExpectSuccess(store.Write("after", "x"));
+        }
+        BreakKvRecord(path, "TORN-MARKER", magic);
+        {
+            TKeyValueStore store(path);
+            ExpectSuccess(store.Open(0));
+            Expect(!!store.Read("torn", v));
+            Expect(!!store.Read("after", v));
+            ExpectSuccess(store.Read("a", v));
+            ExpectEq(v, "3");
+
+            /* tail is reused by next append */
+            ExpectSuccess(store.Write("d", std::to_string(magic)));
+        }
+        {
+            TKeyValueStore store(path);
+            ExpectSuccess(store.Open(0));
+            ExpectSuccess(store.Read("d", v));
+            ExpectEq(v, std::to_string(magic));
+            ExpectEq(store.List().size(), 2);
+        }
+    }
+    ExpectSuccess(path.Unlink());
+
+    Say() << "Make sure garbage is compacted and full store is reported" << std::endl;
+    {
+        TKeyValueStore store(path);
+        ExpectSuccess(store.Open(4096));
+        ExpectSuccess(store.Write("keep", "k"));
+        for (int i = 0; i < 200; i++)
+            ExpectSuccess(store.Write("a", std::to_string(i) + std::string(100, 'a')));
+        ExpectSuccess(store.Compact());
+        Expect(!TPath(path.ToString() + ".tmp").Exists());
+        ExpectEq(store.List().size(), 2);
+        ExpectSuccess(store.Read("a", v));
+        ExpectEq(v, "199" + std::string(100, 'a'));
+
+        TError error = store.Write("big", std::string(8192, 'b'));
+        ExpectEq(error.GetError(), EError::ResourceNotAvailable);
+    }
+    {
+        TKeyValueStore store(path);
+        ExpectSuccess(store.Open(0));
+        ExpectSuccess(store.Read("keep", v));
+        ExpectEq(v, "k");
+        ExpectSuccess(store.Read("a", v));
+        ExpectEq(v, "199" + std::string(100, 'a'));
+    }
+    ExpectSuccess(path.Unlink());
+
+    Say() << "Make sure nodes migrate from files to log and back" << std::endl;
+
+    config().set_keyvalue_backend("files");
+    ExpectSuccess(TKeyValue::Mount(root));
+    for (int i = 0; i < 3; i++) {
+        TKeyValue node(root / std::to_string(i));
+        node.Set("id", std::to_string(i));
+        ExpectSuccess(node.Save());
+    }
+
+    config().set_keyvalue_backend("log");
+    ExpectSuccess(TKeyValue::Mount(root));
+    Expect(path.Exists());
+    Expect(!(root / "0").Exists());
+    {
+        std::list<TKeyValue> nodes;
+        ExpectSuccess(TKeyValue::ListAll(root, nodes));
+        ExpectEq(nodes.size(), 3);
+        for (auto &node: nodes) {
+            ExpectSuccess(node.Load());
+            ExpectEq(node.Get("id"), node.Path.BaseName());
+        }
+    }
+    {
+        TKeyValue node(root / "1");
+        ExpectSuccess(node.Load());
+        node.Set("extra", "log");
+        ExpectSuccess(node.Save());
+        ExpectSuccess(TKeyValue(root / "2").Remove());
+    }
+
+    TKeyValue::CloseStores();
+    config().set_keyvalue_backend("files");
+    ExpectSuccess(TKeyValue::Mount(root));
+    Expect(!path.Exists());
+    Expect(!(root / "2").Exists());
+    {
+        TKeyValue node(root / "1");
+        ExpectSuccess(node.Load());
+        ExpectEq(node.Get("id"), "1");
+        ExpectEq(node.Get("extra"), "log");
+    }
+
+    config().set_keyvalue_backend(backend);
+    ExpectSuccess(root.UmountAll());
+    ExpectSuccess(root.RemoveAll());
+}
+
+static void TestKvCommit(Porto::Connection &api) {
+    std::string c = "commit", v;
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+    TUintMap before, after;
+
+    Say() << "Make sure concurrent saves are committed before reply" << std::endl;
+
+    ExpectApiSuccess(api.Create(c));
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, before));
+
+    for (int t = 0; t < 8; t++) {
+        threads.push_back(std::thread([&failed, c, t] {
+            Porto::Connection conn;
+            for (int i = 0; i < 50; i++)
+                if (conn.SetProperty(c, "private", std::to_string(t * 100 + i)))
+                    failed++;
+        }));
+    }
+    for (auto &thread: threads)
+        thread.join();
+    ExpectEq(failed.load(), 0);
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat", v));
+    ExpectSuccess(StringToUintMap(v, after));
+    ExpectLessEq(before["kv_saves"] + 400, after["kv_saves"]);
+
+    /* Save is either written or overridden by next one before write */
+    ExpectLess(before["kv_coalesced"], after["kv_coalesced"]);
+    ExpectEq(after["kv_saves"] - before["kv_saves"],
+             after["kv_writes"] - before["kv_writes"] +
+             after["kv_coalesced"] - before["kv_coalesced"]);
+
+    ExpectApiSuccess(api.SetProperty(c, "private", "last"));
+
+    KillSlave(api, SIGKILL);
+
+    ExpectApiSuccess(api.GetProperty(c, "private", v));
+    ExpectEq(v, "last");
+
+    ExpectApiSuccess(api.Destroy(c));
+}
+
+static void TestParallelRestore(Porto::Connection &api) {
+    std::vector<std::string> containers;
+    std::string v;
+
+    Say() << "Make sure subtrees are restored with parents first" << std::endl;
+
+    for (int i = 0; i < 4; i++) {
+        std::string a = "restore" + std::to_string(i);
+        ExpectApiSuccess(api.Create(a));
+        for (int j = 0; j < 4; j++) {
+            std::string b = a + "/b" + std::to_string(j);
+            ExpectApiSuccess(api.Create(b));
+            ExpectApiSuccess(api.SetProperty(b, "private", b));
+            ExpectApiSuccess(api.Create(b + "/c"));
+        }
+    }
+
+    KillSlave(api, SIGKILL);
+
+    ExpectApiSuccess(api.List(containers));
+    ExpectEq(containers.size(), 4 * (1 + 4 * 2));
+    ExpectApiSuccess(api.GetProperty("restore3/b2", "private", v));
+    ExpectEq(v, "restore3/b2");
+    ExpectApiSuccess(api.GetData("restore3/b2/c", "state", v));
+    ExpectEq(v, "stopped");
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat[restore_time_ms]", v));
+    ExpectApiSuccess(api.GetData("/", "porto_stat[startup_time_ms]", v));
+    ExpectNeq(v, "0");
+
+    for (int i = 0; i < 4; i++)
+        ExpectApiSuccess(api.Destroy("restore" + std::to_string(i)));
+}
+
+/* Version request on raw connection, which cannot reconnect behind our back */
+static void ExpectRawVersion(int fd) {
+    rpc::TContainerRequest req;
+    rpc::TContainerResponse rsp;
+    uint32_t size;
+
+    req.mutable_version();
+
+    google::protobuf::io::FileOutputStream post(fd);
+    Expect(WriteDelimitedTo(req, &post));
+    Expect(post.Flush());
+
+    google::protobuf::io::FileInputStream pre(fd);
+    google::protobuf::io::CodedInputStream input(&pre);
+    Expect(input.ReadVarint32(&size));
+    auto limit = input.PushLimit(size);
+    Expect(rsp.ParseFromCodedStream(&input));
+    input.PopLimit(limit);
+
+    ExpectEq(rsp.error(), EError::Success);
+    ExpectEq(rsp.version().tag(), PORTO_VERSION);
+}
+
+/* How many times each event lane thread of slave was scheduled */
+static std::map<std::string, uint64_t> EventLaneRuns() {
+    TPath tasks("/proc/" + std::to_string(ReadPid(PORTO_SLAVE_PIDFILE)) + "/task");
+    std::map<std::string, uint64_t> runs;
+    std::vector<std::string> tids;
+
+    ExpectSuccess(tasks.ReadDirectory(tids));
+    for (auto &tid: tids) {
+        std::string comm, stat;
+        unsigned long long runTime, waitTime, count;
+
+        if ((tasks / tid / "comm").ReadAll(comm) ||
+                !StringStartsWith(comm, "portod-event") ||
+                (tasks / tid / "schedstat").ReadAll(stat))
+            continue;
+        if (sscanf(stat.c_str(), "%llu %llu %llu", &runTime, &waitTime, &count) == 3)
+            runs[StringTrim(comm)] = count;
+    }
+
+    return runs;
+}
+
+static void TestEventLanes(Porto::Connection &api) {
+    std::vector<Porto::ContainerEvent> events;
+    std::vector<std::string> names;
+    std::string name = "lanes", v;
+    const int nrLanes = 4, nr = 64, nrRespawns = 10;
+    TConfigOverride conf;
+    uint64_t seq;
+
+    AsRoot(api);
+
+    conf.Set(api, "daemon { event_workers: " + std::to_string(nrLanes) +
+             " } container { respawn_delay_ms: 10 }");
+
+    auto before = EventLaneRuns();
+    ExpectEq(before.size(), (size_t)nrLanes + 1);
+
+    Say() << "Check burst of exits is spread over container lanes" << std::endl;
+
+    for (int i = 0; i < nr; i++) {
+        names.push_back(name + std::to_string(i));
+        ExpectApiSuccess(api.Create(names.back()));
+        ExpectApiSuccess(api.SetProperty(names.back(), "command", "sleep 1"));
+        ExpectApiSuccess(api.Start(names.back()));
+    }
+
+    for (auto &ct: names) {
+        ExpectApiSuccess(api.WaitContainers({ct}, v, 10));
+        ExpectEq(v, ct);
+        ExpectApiSuccess(api.GetData(ct, "exit_status", v));
+        ExpectEq(v, "0");
+    }
+
+    auto after = EventLaneRuns();
+    for (int lane = 1; lane <= nrLanes; lane++) {
+        std::string thread = "portod-event" + std::to_string(lane);
+        Say() << thread << " scheduled " << after[thread] - before[thread] << " times" << std::endl;
+        ExpectLess(before[thread], after[thread]);
+    }
+
+    for (auto &ct: names)
+        ExpectApiSuccess(api.Destroy(ct));
+
+    Say() << "Check respawns of one container are handled in order" << std::endl;
+
+    Porto::Connection sub;
+    ExpectEq(sub.Subscribe({name}, seq), 0);
+
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "command", "true"));
+    ExpectApiSuccess(api.SetProperty(name, "respawn", "true"));
+    ExpectApiSuccess(api.SetProperty(name, "max_respawns", std::to_string(nrRespawns)));
+    ExpectApiSuccess(api.Start(name));
+
+    std::string order, expected;
+    for (int i = 0; i <= nrRespawns; i++)
+        expected += "SD";
+
+    while (order.size() < expected.size()) {
+        ExpectEq(sub.ReadEvents(events, 5000), 0);
+        ExpectNeq(events.size(), 0);
+        for (auto &event: events) {
+            ExpectLess(seq, event.Seq);
+            seq = event.Seq;
+            if (event.Event == Porto::ContainerEvent::Start)
+                order += "S";
+            else if (event.Event == Porto::ContainerEvent::Death)
+                order += "D";
+        }
+    }
+    ExpectEq(order, expected);
+
+    ExpectApiSuccess(api.GetData(name, "respawn_count", v));
+    ExpectEq(v, std::to_string(nrRespawns));
+    ExpectApiSuccess(api.GetData(name, "state", v));
+    ExpectEq(v, "dead");
+
+    ExpectEq(sub.Subscribe({}, seq), 0);
+    ExpectApiSuccess(api.Destroy(name));
+
+    conf.Restore(api);
+}
+
+static void TestUpgradeHandoff(Porto::Connection &api) {
+    std::string name = "handoff", volume = "/tmp/handoff_volume";
+    std::vector<Porto::Volume> volumes;
+    TConfigOverride conf;
+    std::string pid, v;
+    int fd;
+
+    /* Off by default, reload makes both master and slave read it */
+    AsRoot(api);
+    conf.Set(api, "daemon { upgrade_handoff: true }");
+    AsAlice(api);
+
+    ExpectSuccess(ConnectToRpcServer(PORTO_SOCKET_PATH, fd));
+    struct timeval tv = { 30, 0 };
+    ExpectEq(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+    ExpectRawVersion(fd);
+
+    ExpectApiSuccess(api.Create(name));
+    ExpectApiSuccess(api.SetProperty(name, "command", "sleep 1000"));
+    ExpectApiSuccess(api.SetProperty(name, "memory_limit", "100M"));
+    ExpectApiSuccess(api.Start(name));
+    ExpectApiSuccess(api.GetData(name, "root_pid", pid));
+
+    CleanupVolume(api, volume);
+    ExpectSuccess(TPath(volume).Mkdir(0775));
+    ExpectApiSuccess(api.CreateVolume(volume, {{"containers", name}}));
+
+    AsRoot(api);
+
+    /* Knob changed behind porto back must be fixed by lazy verification */
+    std::string limit = GetCgKnob("memory", name, "memory.limit_in_bytes");
+    ExpectSuccess(TPath(CgRoot("memory", name) + "memory.limit_in_bytes").WriteAll("52428800"));
+    ExpectEq(GetCgKnob("memory", name, "memory.limit_in_bytes"), "52428800");
+
+    Say() << "Make sure connection and state survive upgrade" << std::endl;
+
+    int slavePid = ReadPid(PORTO_SLAVE_PIDFILE);
+    ExpectEq(kill(ReadPid(PORTO_MASTER_PIDFILE), SIGHUP), 0);
+    WaitProcessExit(std::to_string(slavePid));
+    WaitPortod(api);
+
+    ExpectRawVersion(fd);
+    ExpectRawVersion(fd);
+    close(fd);
+
+    ExpectApiSuccess(api.GetData("/", "porto_stat[handoff_clients]", v));
+    ExpectNeq(v, "0");
+    ExpectApiSuccess(api.GetData("/", "porto_stat[handoff_containers]", v));
+    ExpectEq(v, "1");
+    ExpectApiSuccess(api.GetData("/", "porto_stat[handoff_volumes]", v));
+    ExpectEq(v, "1");
+
+    ExpectApiSuccess(api.GetData(name, "state", v));
+    ExpectEq(v, "running");
+    ExpectApiSuccess(api.GetData(name, "root_pid", v));
+    ExpectEq(v, pid);
+    ExpectApiSuccess(api.ListVolumes(volumes));
+    ExpectEq(volumes.size(), 1);
+    ExpectEq(volumes[0].Path, volume);
+
+    Say() << "Make sure adopted container is verified against kernel" << std::endl;
+
+    for (int i = 0; i < 100; i++) {
+        ExpectApiSuccess(api.GetData("/", "porto_stat[handoff_unverified]", v));
+        if (v == "0")
+            break;
+        usleep(100000);
+    }
+    ExpectEq(v, "0");
+    ExpectEq(GetCgKnob("memory", name, "memory.limit_in_bytes"), limit);
+
+    ExpectApiSuccess(api.Destroy(name));
+    ExpectApiSuccess(api.ListVolumes(volumes));
+    ExpectEq(volumes.size(), 0);
+
+    conf.Restore(api);
+    AsAlice(api);
+}
+
 static void TestWaitRecovery(Porto::Connection &api) {
     std::string c = "aaa";
     std::string d = "aaa/bbb";
@@ -4817,6 +6119,51 @@ static void TestWaitRecovery(Porto::Connection &api) {
     ExpectApiSuccess(api.Destroy(c));
 }
 
+static void TestPidFdRecovery(Porto::Connection &api) {
+    std::string c = "pidfd", pid, v;
+
+    if (!PidFdSupported()) {
+        Say() << "pidfd is not supported, skip" << std::endl;
+        return;
+    }
+
+    ExpectApiSuccess(api.Create(c));
+    ExpectApiSuccess(api.SetProperty(c, "command", "sleep 1000"));
+    ExpectApiSuccess(api.SetProperty(c, "isolate", "false"));
+
+    Say() << "Check exit of wait task started by previous slave" << std::endl;
+
+    ExpectApiSuccess(api.Start(c));
+    ExpectApiSuccess(api.GetData(c, "root_pid", pid));
+
+    KillSlave(api, SIGKILL);
+
+    /* Now it is child of master and must be reaped by it */
+    ExpectEq(kill(stoi(pid), SIGKILL), 0);
+    WaitContainer(api, c);
+    WaitProcessExit(pid);
+    ExpectApiSuccess(api.GetData(c, "exit_status", v));
+    ExpectEq(v, "9");
+    ExpectApiSuccess(api.Stop(c));
+
+    Say() << "Check exit status reaped via pidfd survives restart" << std::endl;
+
+    ExpectApiSuccess(api.Start(c));
+    ExpectApiSuccess(api.GetData(c, "root_pid", pid));
+    ExpectEq(kill(stoi(pid), SIGTERM), 0);
+    WaitContainer(api, c);
+    WaitProcessExit(pid);
+
+    KillSlave(api, SIGKILL);
+
+    ExpectApiSuccess(api.GetData(c, "state", v));
+    ExpectEq(v, "dead");
+    ExpectApiSuccess(api.GetData(c, "exit_status", v));
+    ExpectEq(v, std::to_string(SIGTERM));
+
+    ExpectApiSuccess(api.Destroy(c));
+}
+
 static void TestRecovery(Porto::Connection &api) {
     string pid, v;
     string name = "a:b";
@@ -5332,6 +6679,7 @@ int SelfTest(std::vector<std::string> args) {
     pair<string, std::function<void(Porto::Connection &)>> tests[] = {
         { "path", TestPath },
         { "idmap", TestIdmap },
+        { "timer_wheel", TestTimerWheel },
         { "format", TestFormat },
         { "root", TestRoot },
         { "data", TestData },
@@ -5342,6 +6690,7 @@ int SelfTest(std::vector<std::string> args) {
         { "state_machine", TestStateMachine },
         { "wait", TestWait },
         { "exit_status", TestExitStatus },
+        { "pidfd_exit", TestPidFdExit },
         { "streams", TestStreams },
         { "ns_cg_tc", TestNsCgTc },
         { "isolate_property", TestIsolateProperty },
@@ -5370,16 +6719,36 @@ int SelfTest(std::vector<std::string> args) {
         { "vholder", TestVolumeHolder },
         { "volume_impl", TestVolumeImpl },
         { "sigpipe", TestSigPipe },
+        { "pipeline", TestPipeline },
+        { "pipeline_burst", TestPipelineBurst },
+        { "batch", TestBatch },
+        { "subscribe", TestSubscribe },
+        { "delta_get", TestDeltaGet },
+        { "typed_get", TestTypedGet },
+        { "rpc_stat", TestRpcStat },
         { "stats", TestStats },
         { "daemon", TestDaemon },
         { "convert", TestConvertPath },
         { "leaks", TestLeaks },
         { "perf", TestPerf },
+        { "exit_perf", TestExitPerf },
+        { "start_perf", TestStartPerf },
+        { "rpc_perf", TestRpcPerf },
+        { "stat_perf", TestStatPerf },
+        { "kv_perf", TestKvPerf },
+        { "parse_perf", TestParsePerf },
 
         // the following tests will restart porto several times
         { "bad_client", TestBadClient },
         { "recovery", TestRecovery },
+        { "kv_journal", TestKvJournal },
+        { "kv_store", TestKvStore },
+        { "kv_commit", TestKvCommit },
+        { "parallel_restore", TestParallelRestore },
+        { "event_lanes", TestEventLanes },
+        { "upgrade_handoff", TestUpgradeHandoff },
         { "wait_recovery", TestWaitRecovery },
+        { "pidfd_recovery", TestPidFdRecovery },
         { "volume_recovery", TestVolumeRecovery },
         { "cgroups", TestCgroups },
         { "version", TestVersion },